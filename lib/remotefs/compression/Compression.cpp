@@ -0,0 +1,60 @@
+#include "Compression.h"
+
+#include <algorithm>
+#include <climits>
+
+#ifdef REMOTEFS_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "remotefs/tools/Casts.h"
+
+namespace remotefs {
+
+std::size_t compress(std::span<const std::byte> source, std::span<std::byte> target) {
+#ifdef REMOTEFS_HAVE_LZ4
+    auto ret = LZ4_compress_default(
+        reinterpret_cast<const char*>(source.data()), reinterpret_cast<char*>(target.data()),
+        narrow_cast<int>(source.size()), narrow_cast<int>(std::min<std::size_t>(target.size(), INT_MAX))
+    );
+    return ret > 0 ? static_cast<std::size_t>(ret) : 0;
+#else
+    (void)source;
+    (void)target;
+    return 0;
+#endif
+}
+
+long decompress(std::span<const std::byte> source, std::span<std::byte> target) {
+#ifdef REMOTEFS_HAVE_LZ4
+    return LZ4_decompress_safe(
+        reinterpret_cast<const char*>(source.data()), reinterpret_cast<char*>(target.data()),
+        narrow_cast<int>(source.size()), narrow_cast<int>(std::min<std::size_t>(target.size(), INT_MAX))
+    );
+#else
+    (void)source;
+    (void)target;
+    return -1;
+#endif
+}
+
+bool CompressionSampler::should_compress() {
+    if (skip > 0) {
+        skip--;
+        return false;
+    }
+    return true;
+}
+
+bool CompressionSampler::record(std::size_t original_size, std::size_t compressed_size) {
+    auto worth = compressed_size > 0 && static_cast<double>(compressed_size) <= worth_ratio * original_size;
+    if (worth) {
+        backoff = 1;
+    } else {
+        skip = backoff;
+        backoff = std::min(backoff * 2, max_skipped);
+    }
+    return worth;
+}
+
+}  // namespace remotefs
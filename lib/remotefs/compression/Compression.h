@@ -0,0 +1,43 @@
+#ifndef REMOTE_FS_COMPRESSION_H
+#define REMOTE_FS_COMPRESSION_H
+
+#include <cstddef>
+#include <span>
+
+namespace remotefs {
+
+#ifdef REMOTEFS_HAVE_LZ4
+inline constexpr bool compression_supported = true;
+#else
+inline constexpr bool compression_supported = false;
+#endif
+
+// LZ4 at its default, fastest, level. Returns the compressed size, or 0 if it doesn't fit in target or the library was
+// built without LZ4.
+std::size_t compress(std::span<const std::byte> source, std::span<std::byte> target);
+
+// Returns the decompressed size, or a negative value if source is malformed or doesn't fit in target.
+long decompress(std::span<const std::byte> source, std::span<std::byte> target);
+
+// Decides whether a file's data is worth compressing, from how well the previous samples compressed. Once a sample
+// doesn't pay off, compression is skipped for a number of reads that doubles with each miss, so that incompressible
+// files quickly stop costing CPU but are still sampled now and then in case their content changes.
+class CompressionSampler {
+   public:
+    // Compressed data must be at most this fraction of the original to be worth sending.
+    static constexpr auto worth_ratio = 0.9;
+    static constexpr auto max_skipped = 256;
+
+    [[nodiscard]] bool should_compress();
+
+    // compressed_size is 0 if compressing failed. Returns whether the compressed data is worth sending.
+    bool record(std::size_t original_size, std::size_t compressed_size);
+
+   private:
+    int skip = 0;     // Reads left before the next sample.
+    int backoff = 1;  // Reads skipped after the next miss.
+};
+
+}  // namespace remotefs
+
+#endif  // REMOTE_FS_COMPRESSION_H
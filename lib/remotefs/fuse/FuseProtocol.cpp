@@ -0,0 +1,147 @@
+#include "remotefs/fuse/FuseProtocol.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace remotefs::fuse {
+namespace {
+// Same as libfuse.
+std::uint64_t timeout_sec(double timeout) {
+    if (timeout > static_cast<double>(ULONG_MAX)) {
+        return ULONG_MAX;
+    }
+    return timeout < 0.0 ? 0 : static_cast<std::uint64_t>(timeout);
+}
+
+std::uint32_t timeout_nsec(double timeout) {
+    auto fraction = timeout - static_cast<double>(timeout_sec(timeout));
+    if (fraction < 0.0) {
+        return 0;
+    }
+    return fraction >= 0.999999999 ? 999999999 : static_cast<std::uint32_t>(fraction * 1.0e9);
+}
+
+fuse_attr convert(const struct stat& stat) {
+    return {
+        .ino = stat.st_ino,
+        .size = static_cast<std::uint64_t>(stat.st_size),
+        .blocks = static_cast<std::uint64_t>(stat.st_blocks),
+        .atime = static_cast<std::uint64_t>(stat.st_atim.tv_sec),
+        .mtime = static_cast<std::uint64_t>(stat.st_mtim.tv_sec),
+        .ctime = static_cast<std::uint64_t>(stat.st_ctim.tv_sec),
+        .atimensec = static_cast<std::uint32_t>(stat.st_atim.tv_nsec),
+        .mtimensec = static_cast<std::uint32_t>(stat.st_mtim.tv_nsec),
+        .ctimensec = static_cast<std::uint32_t>(stat.st_ctim.tv_nsec),
+        .mode = stat.st_mode,
+        .nlink = static_cast<std::uint32_t>(stat.st_nlink),
+        .uid = stat.st_uid,
+        .gid = stat.st_gid,
+        .rdev = static_cast<std::uint32_t>(stat.st_rdev),
+        .blksize = static_cast<std::uint32_t>(stat.st_blksize),
+        .padding = 0,
+    };
+}
+}  // namespace
+
+const char* InRequest::name(std::size_t offset) const {
+    if (offset >= arguments.size()) {
+        return nullptr;
+    }
+    auto* data = reinterpret_cast<const char*>(arguments.data()) + offset;
+    return std::memchr(data, '\0', arguments.size() - offset) != nullptr ? data : nullptr;
+}
+
+std::optional<InRequest> decode(std::span<const std::byte> buffer) {
+    if (buffer.size() < sizeof(fuse_in_header)) {
+        return std::nullopt;
+    }
+
+    const auto* header = reinterpret_cast<const fuse_in_header*>(buffer.data());
+    if (header->len < sizeof(fuse_in_header) || header->len > buffer.size()) {
+        return std::nullopt;
+    }
+    return InRequest{header, buffer.subspan(sizeof(fuse_in_header), header->len - sizeof(fuse_in_header))};
+}
+
+std::optional<InRequest> decode(
+    const UringRequestHeader& headers, std::span<const std::byte> payload, std::vector<std::byte>& scratch
+) {
+    auto header = fuse_in_header{};
+    std::memcpy(&header, headers.in_out.data(), sizeof(header));
+    // The first argument is in op_in, the others in the payload.
+    auto payload_size = std::size_t{headers.entry.payload_size};
+    if (header.len < sizeof(header) + payload_size || payload_size > payload.size() ||
+        header.len - sizeof(header) - payload_size > headers.op_in.size()) {
+        return std::nullopt;
+    }
+
+    auto op_size = header.len - sizeof(header) - payload_size;
+    scratch.resize(header.len);
+    auto out = std::ranges::copy(std::span{headers.in_out}.first(sizeof(header)), scratch.begin()).out;
+    out = std::ranges::copy(std::span{headers.op_in}.first(op_size), out).out;
+    std::ranges::copy(payload.first(payload_size), out);
+    return decode(scratch);
+}
+
+fuse_out_header out_header(std::uint64_t unique, int error, std::size_t payload_size) {
+    return {
+        .len = static_cast<std::uint32_t>(sizeof(fuse_out_header) + payload_size), .error = -error, .unique = unique};
+}
+
+fuse_entry_out entry_out(const fuse_entry_param& entry) {
+    return {
+        .nodeid = entry.ino,
+        .generation = entry.generation,
+        .entry_valid = timeout_sec(entry.entry_timeout),
+        .attr_valid = timeout_sec(entry.attr_timeout),
+        .entry_valid_nsec = timeout_nsec(entry.entry_timeout),
+        .attr_valid_nsec = timeout_nsec(entry.attr_timeout),
+        .attr = convert(entry.attr),
+    };
+}
+
+fuse_attr_out attr_out(const struct stat& attr, double timeout) {
+    return {
+        .attr_valid = timeout_sec(timeout),
+        .attr_valid_nsec = timeout_nsec(timeout),
+        .dummy = 0,
+        .attr = convert(attr),
+    };
+}
+
+fuse_open_out open_out(const fuse_file_info& file_info) {
+    auto flags = std::uint32_t{};
+    if (file_info.direct_io != 0) {
+        flags |= FOPEN_DIRECT_IO;
+    }
+    if (file_info.keep_cache != 0) {
+        flags |= FOPEN_KEEP_CACHE;
+    }
+    if (file_info.nonseekable != 0) {
+        flags |= FOPEN_NONSEEKABLE;
+    }
+    if (file_info.cache_readdir != 0) {
+        flags |= FOPEN_CACHE_DIR;
+    }
+    return {.fh = file_info.fh, .open_flags = flags, .padding = 0};
+}
+
+CreateOut create_out(const fuse_entry_param& entry, const fuse_file_info& file_info) {
+    return {.entry = entry_out(entry), .open = open_out(file_info)};
+}
+
+InvalInodeNotification inval_inode(std::uint64_t ino, std::int64_t offset, std::int64_t size) {
+    return {
+        .header = {.len = sizeof(InvalInodeNotification), .error = FUSE_NOTIFY_INVAL_INODE, .unique = 0},
+        .arguments = {.ino = ino, .off = offset, .len = size}};
+}
+
+StoreNotification store(std::uint64_t ino, std::uint64_t offset, std::uint32_t size) {
+    return {
+        .header = {.len = static_cast<std::uint32_t>(sizeof(StoreNotification) + size), .error = FUSE_NOTIFY_STORE,
+                   .unique = 0},
+        .arguments = {.nodeid = ino, .offset = offset, .size = size, .padding = 0}};
+}
+
+}  // namespace remotefs::fuse
@@ -0,0 +1,124 @@
+#ifndef REMOTE_FS_FUSEPROTOCOL_H
+#define REMOTE_FS_FUSEPROTOCOL_H
+
+#include <fuse3/fuse_kernel.h>
+#include <fuse_lowlevel.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Requests read from /dev/fuse and replies written to it, without going through libfuse.
+namespace remotefs::fuse {
+
+struct InRequest {
+    const fuse_in_header* header;
+    std::span<const std::byte> arguments;
+
+    // Null if the arguments are too short.
+    template <typename Arguments>
+    [[nodiscard]] const Arguments* get() const {
+        return arguments.size() >= sizeof(Arguments) ? reinterpret_cast<const Arguments*>(arguments.data()) : nullptr;
+    }
+
+    // The name at offset in the arguments, after those of create and friends, or first for lookup and friends. Null if
+    // it is not terminated.
+    [[nodiscard]] const char* name(std::size_t offset = 0) const;
+};
+
+// Empty if buffer doesn't hold a whole request.
+std::optional<InRequest> decode(std::span<const std::byte> buffer);
+
+fuse_out_header out_header(std::uint64_t unique, int error, std::size_t payload_size);
+fuse_entry_out entry_out(const fuse_entry_param& entry);
+fuse_attr_out attr_out(const struct stat& attr, double timeout);
+fuse_open_out open_out(const fuse_file_info& file_info);
+
+// The reply to FUSE_CREATE, the entry followed by the opened file.
+struct CreateOut {
+    fuse_entry_out entry;
+    fuse_open_out open;
+};
+CreateOut create_out(const fuse_entry_param& entry, const fuse_file_info& file_info);
+
+// Notifications are written to /dev/fuse like replies, with the code in the error of the header.
+struct InvalInodeNotification {
+    fuse_out_header header;
+    fuse_notify_inval_inode_out arguments;
+};
+// Drops the pages the kernel cached for ino from offset, for size bytes or up to the end with 0.
+InvalInodeNotification inval_inode(std::uint64_t ino, std::int64_t offset = 0, std::int64_t size = 0);
+
+struct StoreNotification {
+    fuse_out_header header;
+    fuse_notify_store_out arguments;
+};
+// Stores the size bytes written after it in the page cache of ino, from offset.
+StoreNotification store(std::uint64_t ino, std::uint64_t offset, std::uint32_t size);
+
+// FUSE over io_uring, from protocol 7.42, newer than the fuse_kernel.h in use. Requests are received in buffers
+// registered with the kernel, one queue per cpu, and replied to in the same buffers.
+inline constexpr std::uint64_t over_io_uring = 1ull << 41;  // FUSE_INIT flag, in flags2 with FUSE_INIT_EXT.
+inline constexpr std::uint32_t uring_cmd_register = 1;  // Registers a buffer, completes with a request in it.
+inline constexpr std::uint32_t uring_cmd_commit_and_fetch = 2;  // Replies, completes with the next request.
+
+struct UringEntryInOut {
+    std::uint64_t flags;
+    std::uint64_t commit_id;  // Identifies the request when replying.
+    std::uint32_t payload_size;  // Of the payload buffer in use, by the request or its reply.
+    std::uint32_t padding;
+    std::uint64_t reserved;
+};
+
+// First of the two buffers registered, the second one holds the payload.
+struct UringRequestHeader {
+    std::array<std::byte, 128> in_out;  // fuse_in_header, then fuse_out_header.
+    std::array<std::byte, 128> op_in;  // The first argument of the request, like fuse_read_in.
+    UringEntryInOut entry;
+};
+
+// Payload of the commands.
+struct UringCommand {
+    std::uint64_t flags;
+    std::uint64_t commit_id;
+    std::uint16_t queue;
+    std::array<std::uint8_t, 6> padding;
+};
+
+static_assert(sizeof(UringRequestHeader) == 288);
+static_assert(sizeof(UringCommand) == 24);
+
+// Same as above, for a request received in a ring buffer. It is copied to scratch as if it was read from /dev/fuse.
+std::optional<InRequest> decode(
+    const UringRequestHeader& headers, std::span<const std::byte> payload, std::vector<std::byte>& scratch
+);
+
+// Opcodes from max_opcode, like CUSE_INIT, are never handled natively.
+inline constexpr std::uint32_t max_opcode = 64;
+
+template <typename Engine>
+using Handler = void (Engine::*)(const InRequest&);
+
+template <typename Engine>
+struct Operation {
+    std::uint32_t opcode;
+    Handler<Engine> handler;
+};
+
+// Handlers indexed by opcode, built at compile time. Opcodes without one are left to libfuse.
+template <typename Engine>
+consteval std::array<Handler<Engine>, max_opcode> dispatch_table(std::initializer_list<Operation<Engine>> operations) {
+    auto table = std::array<Handler<Engine>, max_opcode>{};
+    for (auto operation : operations) {
+        table.at(operation.opcode) = operation.handler;
+    }
+    return table;
+}
+
+}  // namespace remotefs::fuse
+
+#endif  // REMOTE_FS_FUSEPROTOCOL_H
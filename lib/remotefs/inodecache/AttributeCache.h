@@ -0,0 +1,54 @@
+#ifndef REMOTE_FS_ATTRIBUTECACHE_H
+#define REMOTE_FS_ATTRIBUTECACHE_H
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace remotefs {
+
+// Attributes of the inodes given to the kernel, as last received from the server. Fresh ones answer getattr and the
+// lookups of a known entry, see RemoteInodes, without asking the server. Stale ones still answer them for a while, but
+// the first request to find them stale refreshes them in the background. Shared by the client threads.
+class AttributeCache {
+   public:
+    using fuse_ino_t = std::uint64_t;
+    using Clock = std::chrono::steady_clock;
+
+    struct Cached {
+        struct stat attr;
+        // Until the attributes are stale, zero once they are.
+        Clock::duration fresh_for;
+        // The caller refreshes the attributes, nobody else was asked to since they became stale.
+        bool refresh;
+    };
+
+    // Attributes are fresh for ttl, then stale for stale_ttl more before expiring.
+    AttributeCache(Clock::duration ttl, Clock::duration stale_ttl);
+    void update(fuse_ino_t ino, const struct stat& attr, Clock::time_point now = Clock::now());
+    // Empty if ino isn't cached, or expired.
+    [[nodiscard]] std::optional<Cached> find(fuse_ino_t ino, Clock::time_point now = Clock::now());
+    // Once the attributes changed, or the server failed to refresh them.
+    void invalidate(fuse_ino_t ino);
+    [[nodiscard]] Clock::duration ttl() const { return fresh_ttl; }
+
+   private:
+    struct Entry {
+        struct stat attr;
+        Clock::time_point updated;
+        bool refreshing = false;
+    };
+
+    Clock::duration fresh_ttl;
+    Clock::duration stale_ttl;
+    std::mutex lock{};
+    std::unordered_map<fuse_ino_t, Entry> entries;
+};
+
+}  // namespace remotefs
+
+#endif  // REMOTE_FS_ATTRIBUTECACHE_H
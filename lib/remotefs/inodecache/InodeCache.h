@@ -5,9 +5,12 @@
 
 #include <cassert>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace remotefs {
 
@@ -20,15 +23,26 @@ class InodeCache {
        public:
         explicit InodeValue(const struct stat& s);
         ~InodeValue() noexcept;
+        // Opens the handle unless it is already. Counts an opener either way.
         void open(std::string_view path);
-        void close();
+        // Opens a second handle, for writes, unless there is one already. Counts a writer either way.
+        void open_writable(std::string_view path);
+        // Takes over handle, opened for writes, unless there is one already. Counts a writer either way.
+        void set_write_handle(FileDescriptor handle);
+        // The handles are closed along with their last opener, or writer.
+        void close(bool writable);
         [[nodiscard]] bool is_open() const;
+        [[nodiscard]] bool is_writable() const;
         [[nodiscard]] FileDescriptor handle() const;
+        [[nodiscard]] FileDescriptor write_handle() const;
 
         struct stat stat;
 
        private:
         FileDescriptor _handle;
+        FileDescriptor _write_handle;
+        int _openers = 0;
+        int _writers = 0;
     };
 
     using CacheType = std::unordered_map<std::string, InodeValue>;
@@ -38,8 +52,27 @@ class InodeCache {
     InodeCache();
     const Inode* find(const std::string& path) const;
     Inode* lookup(std::string path);
-    static void open(Inode& inode);
-    static void close(Inode& inode);
+    // Null if ino was not given by this cache, for example by a previous instance of the server.
+    Inode* find_ino(fuse_ino_t ino);
+    // The inodes are shared by the threads of the server, their handles are only opened once, under cache_lock.
+    // Throws std::system_error if the file can't be opened.
+    void open(Inode& inode, bool writable = false);
+    // Takes over handle, opened for writes by the caller, unless the inode has one already.
+    void set_write_handle(Inode& inode, int handle);
+    // writable tells whether it was opened for writes. Inodes removed while open are freed once closed by all.
+    void close(Inode& inode, bool writable = false);
+    // A copy of the stat of inode, which other threads may be updating.
+    [[nodiscard]] struct stat stat_of(const Inode& inode) const;
+    // Records a write of ino ending at end, which grows the file and updates its times. Nothing if ino was forgotten.
+    void wrote(fuse_ino_t ino, off_t end);
+    // Replaces the stat of ino by a fresh one, and returns it with its ino. Empty if ino was forgotten meanwhile.
+    std::optional<struct stat> update(fuse_ino_t ino, struct stat stat);
+    // Same as lookup, for a path just created or changed, whose stat is known.
+    Inode& add(std::string path, const struct stat& stat);
+    // An inode still open outlives its path, like the file would, and is freed along with the cache.
+    void remove(const std::string& path);
+    // The paths below a directory go with it. Replaces new_path, like remove.
+    void rename(std::string path, std::string new_path);
 
     [[nodiscard]] inline const Inode& inode_from_ino(fuse_ino_t ino) const {
         if (ino == 1) {
@@ -63,12 +96,19 @@ class InodeCache {
         auto lock = std::scoped_lock{cache_lock};
         auto [inode_iter, inserted] = cache.emplace(std::forward<Ts>(params)...);
         inode_iter->second.stat.st_ino = reinterpret_cast<fuse_ino_t>(&*inode_iter);
+        inos.insert(inode_iter->second.stat.st_ino);
         return *inode_iter;
     }
 
    private:
+    // cache_lock must be held.
+    void forget(const std::string& path);
+    void move(const std::string& path, const std::string& new_path);
+
     mutable std::mutex cache_lock{};
     CacheType cache;
+    std::unordered_set<fuse_ino_t> inos;
+    std::vector<CacheType::node_type> unlinked;
     Inode& root;
 };
 
@@ -0,0 +1,60 @@
+#ifndef REMOTE_FS_REMOTEINODES_H
+#define REMOTE_FS_REMOTEINODES_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace remotefs {
+
+// Inodes given to the kernel by the client. They outlive the inodes of the server they map to: when the server forgets
+// one, for example because it restarted, it is resolved again from its path instead of failing with ESTALE. Shared by
+// the client threads, as the kernel sends requests about an inode to any of them.
+class RemoteInodes {
+   public:
+    using fuse_ino_t = std::uint64_t;
+
+    static constexpr fuse_ino_t root = 1;
+    static constexpr fuse_ino_t unresolved = 0;
+
+    // Returns the inode of name in parent, which the server knows as server_ino.
+    fuse_ino_t add(fuse_ino_t parent, std::string_view name, fuse_ino_t server_ino);
+    // The inode of name in parent, unresolved if it was never looked up.
+    [[nodiscard]] fuse_ino_t find(fuse_ino_t parent, std::string_view name) const;
+    // unresolved if ino must be resolved again, or is unknown.
+    [[nodiscard]] fuse_ino_t server_ino(fuse_ino_t ino) const;
+    void resolved(fuse_ino_t ino, fuse_ino_t server_ino);
+    // Forgets the server inode of ino, it is resolved again from its path.
+    void invalidate(fuse_ino_t ino);
+    // Relative to the root, empty for the root itself. Empty if ino is unknown.
+    [[nodiscard]] std::optional<std::string> path(fuse_ino_t ino) const;
+    // Once the server removed name from parent. Its inode stays, the kernel may still use it, but can't be resolved
+    // again.
+    void remove(fuse_ino_t parent, std::string_view name);
+    // Once the server moved it, the inodes below go with it. Replaces new_name in new_parent, like remove.
+    void rename(fuse_ino_t parent, std::string_view name, fuse_ino_t new_parent, std::string_view new_name);
+
+   private:
+    // lock must be held.
+    void forget(const std::pair<fuse_ino_t, std::string>& key);
+
+    struct Inode {
+        fuse_ino_t parent;
+        std::string name;
+        fuse_ino_t server_ino;
+    };
+
+    mutable std::mutex lock{};
+    std::unordered_map<fuse_ino_t, Inode> inodes;
+    std::map<std::pair<fuse_ino_t, std::string>, fuse_ino_t> by_name;
+    fuse_ino_t next_ino = root + 1;
+};
+
+}  // namespace remotefs
+
+#endif  // REMOTE_FS_REMOTEINODES_H
@@ -0,0 +1,40 @@
+#include "remotefs/inodecache/AttributeCache.h"
+
+#include <utility>
+
+namespace remotefs {
+AttributeCache::AttributeCache(Clock::duration ttl, Clock::duration stale_ttl)
+    : fresh_ttl{ttl},
+      stale_ttl{stale_ttl} {}
+
+void AttributeCache::update(fuse_ino_t ino, const struct stat& attr, Clock::time_point now) {
+    auto guard = std::scoped_lock{lock};
+    entries.insert_or_assign(ino, Entry{.attr = attr, .updated = now});
+}
+
+std::optional<AttributeCache::Cached> AttributeCache::find(fuse_ino_t ino, Clock::time_point now) {
+    auto guard = std::scoped_lock{lock};
+    auto found = entries.find(ino);
+    if (found == entries.end()) {
+        return std::nullopt;
+    }
+
+    auto& entry = found->second;
+    auto age = now - entry.updated;
+    if (age < fresh_ttl) {
+        return Cached{.attr = entry.attr, .fresh_for = fresh_ttl - age, .refresh = false};
+    }
+    if (age < fresh_ttl + stale_ttl) {
+        auto refresh = !std::exchange(entry.refreshing, true);
+        return Cached{.attr = entry.attr, .fresh_for = Clock::duration::zero(), .refresh = refresh};
+    }
+    entries.erase(found);
+    return std::nullopt;
+}
+
+void AttributeCache::invalidate(fuse_ino_t ino) {
+    auto guard = std::scoped_lock{lock};
+    entries.erase(ino);
+}
+
+}  // namespace remotefs
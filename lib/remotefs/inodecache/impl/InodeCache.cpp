@@ -3,6 +3,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <ctime>
 #include <system_error>
 
 namespace remotefs {
@@ -33,51 +35,208 @@ InodeCache::Inode* InodeCache::lookup(std::string path) {
     return nullptr;
 }
 
+InodeCache::Inode* InodeCache::find_ino(fuse_ino_t ino) {
+    if (ino == 1) {
+        return &root;
+    }
+
+    auto lock = std::scoped_lock{cache_lock};
+    return inos.contains(ino) ? reinterpret_cast<Inode*>(ino) : nullptr;
+}
+
 InodeCache::InodeCache()
     : root{*lookup(".")} {
     root.second.stat.st_ino = 1;
 }
 
-void InodeCache::open(InodeCache::Inode& inode) {
-    if (!inode.second.is_open()) [[likely]] {
-        inode.second.open(inode.first);
+void InodeCache::open(InodeCache::Inode& inode, bool writable) {
+    auto lock = std::scoped_lock{cache_lock};
+    inode.second.open(inode.first);
+    if (writable) {
+        try {
+            inode.second.open_writable(inode.first);
+        } catch (const std::system_error&) {
+            inode.second.close(false);
+            throw;
+        }
+    }
+}
+
+void InodeCache::set_write_handle(InodeCache::Inode& inode, int handle) {
+    auto lock = std::scoped_lock{cache_lock};
+    inode.second.set_write_handle(handle);
+}
+
+void InodeCache::close(InodeCache::Inode& inode, bool writable) {
+    auto lock = std::scoped_lock{cache_lock};
+    inode.second.close(writable);
+    if (inode.second.is_open()) {
+        return;
+    }
+    auto removed = std::ranges::find(unlinked, &inode.second, [](auto& node) { return &node.mapped(); });
+    if (removed != unlinked.end()) {
+        inos.erase(inode.second.stat.st_ino);
+        unlinked.erase(removed);
+    }
+}
+
+struct stat InodeCache::stat_of(const InodeCache::Inode& inode) const {
+    auto lock = std::scoped_lock{cache_lock};
+    return inode.second.stat;
+}
+
+void InodeCache::wrote(fuse_ino_t ino, off_t end) {
+    auto lock = std::scoped_lock{cache_lock};
+    if (!inos.contains(ino)) [[unlikely]] {
+        return;
+    }
+    auto& stat = inode_from_ino(ino).second.stat;
+    stat.st_size = std::max(stat.st_size, end);
+    clock_gettime(CLOCK_REALTIME, &stat.st_mtim);
+    stat.st_ctim = stat.st_mtim;
+}
+
+InodeCache::Inode& InodeCache::add(std::string path, const struct stat& stat) {
+    {
+        auto lock = std::scoped_lock{cache_lock};
+        if (auto found = cache.find(path); found != cache.end()) {
+            auto ino = found->second.stat.st_ino;
+            found->second.stat = stat;
+            found->second.stat.st_ino = ino;
+            return *found;
+        }
+    }
+
+    return create_inode(std::move(path), stat);
+}
+
+void InodeCache::remove(const std::string& path) {
+    auto lock = std::scoped_lock{cache_lock};
+    forget(path);
+}
+
+void InodeCache::rename(std::string path, std::string new_path) {
+    // Paths are full, each one below the directory has to be renamed as well.
+    auto prefix = path + '/';
+    auto below = std::vector<std::string>{};
+    auto lock = std::scoped_lock{cache_lock};
+    for (const auto& [other, _] : cache) {
+        if (other.starts_with(prefix)) {
+            below.push_back(other);
+        }
+    }
+
+    move(path, new_path);
+    for (const auto& other : below) {
+        move(other, new_path + other.substr(path.size()));
     }
 }
 
-void InodeCache::close(InodeCache::Inode& inode) {
-    inode.second.close();
+void InodeCache::forget(const std::string& path) {
+    auto found = cache.find(path);
+    if (found == cache.end() || &*found == &root) {
+        return;
+    }
+    auto node = cache.extract(found);
+    if (node.mapped().is_open()) {
+        unlinked.push_back(std::move(node));
+        return;
+    }
+    inos.erase(node.mapped().stat.st_ino);
+}
+
+void InodeCache::move(const std::string& path, const std::string& new_path) {
+    auto node = cache.extract(path);
+    if (node.empty()) {
+        return;
+    }
+    // Replaced, like renameat does.
+    forget(new_path);
+    node.key() = new_path;
+    cache.insert(std::move(node));
+}
+
+std::optional<struct stat> InodeCache::update(fuse_ino_t ino, struct stat stat) {
+    auto lock = std::scoped_lock{cache_lock};
+    if (ino != 1 && !inos.contains(ino)) [[unlikely]] {
+        return std::nullopt;
+    }
+    stat.st_ino = ino;
+    inode_from_ino(ino).second.stat = stat;
+    return stat;
 }
 
 InodeCache::InodeValue::InodeValue(const struct stat& s)
     : stat{s},
-      _handle{unassigned} {}
+      _handle{unassigned},
+      _write_handle{unassigned} {}
 
 InodeCache::InodeValue::~InodeValue() noexcept {
     if (_handle != unassigned) {
         ::close(_handle);
     }
+    if (_write_handle != unassigned) {
+        ::close(_write_handle);
+    }
     _handle = unassigned;
+    _write_handle = unassigned;
 }
 
 void InodeCache::InodeValue::open(std::string_view path) {
-    assert(_handle == unassigned);
-    if ((_handle = ::open(path.data(), O_RDONLY)) == -1) [[unlikely]] {
-        throw std::system_error(errno, std::generic_category(), "Opening file");
+    if (_handle == unassigned) {
+        if ((_handle = ::open(path.data(), O_RDONLY)) == -1) [[unlikely]] {
+            throw std::system_error(errno, std::generic_category(), "Opening file");
+        }
     }
+    _openers++;
 }
 
-void InodeCache::InodeValue::close() {
-    if (_handle != unassigned) return;
-    if (::close(_handle)) [[unlikely]] {
-        throw std::system_error(errno, std::generic_category(), "Closing file");
+void InodeCache::InodeValue::open_writable(std::string_view path) {
+    if (_write_handle == unassigned) {
+        if ((_write_handle = ::open(path.data(), O_WRONLY)) == -1) [[unlikely]] {
+            throw std::system_error(errno, std::generic_category(), "Opening file for writing");
+        }
+    }
+    _writers++;
+}
+
+void InodeCache::InodeValue::set_write_handle(FileDescriptor handle) {
+    _writers++;
+    if (_write_handle != unassigned) {
+        ::close(handle);
+        return;
+    }
+    _write_handle = handle;
+}
+
+void InodeCache::InodeValue::close(bool writable) {
+    if (writable && _writers > 0 && --_writers == 0) {
+        ::close(_write_handle);
+        _write_handle = unassigned;
+    }
+    if (_handle == unassigned || --_openers > 0) {
+        return;
     }
+    auto handle = _handle;
     _handle = unassigned;
+    if (::close(handle)) [[unlikely]] {
+        throw std::system_error(errno, std::generic_category(), "Closing file");
+    }
 }
 
 bool InodeCache::InodeValue::is_open() const {
     return _handle != unassigned;
 }
 
+bool InodeCache::InodeValue::is_writable() const {
+    return _write_handle != unassigned;
+}
+
+InodeCache::InodeValue::FileDescriptor InodeCache::InodeValue::write_handle() const {
+    assert(is_writable());
+    return _write_handle;
+}
+
 InodeCache::InodeValue::FileDescriptor InodeCache::InodeValue::handle() const {
     assert(is_open());
     return _handle;
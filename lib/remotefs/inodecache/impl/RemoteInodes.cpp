@@ -0,0 +1,101 @@
+#include "remotefs/inodecache/RemoteInodes.h"
+
+#include <vector>
+
+namespace remotefs {
+RemoteInodes::fuse_ino_t RemoteInodes::add(fuse_ino_t parent, std::string_view name, fuse_ino_t server_ino) {
+    auto key = std::pair{parent, std::string{name}};
+    auto guard = std::scoped_lock{lock};
+    if (auto found = by_name.find(key); found != by_name.end()) {
+        inodes.at(found->second).server_ino = server_ino;
+        return found->second;
+    }
+
+    auto ino = next_ino++;
+    inodes.emplace(ino, Inode{.parent = parent, .name = key.second, .server_ino = server_ino});
+    by_name.emplace(std::move(key), ino);
+    return ino;
+}
+
+RemoteInodes::fuse_ino_t RemoteInodes::find(fuse_ino_t parent, std::string_view name) const {
+    auto key = std::pair{parent, std::string{name}};
+    auto guard = std::scoped_lock{lock};
+    auto found = by_name.find(key);
+    return found != by_name.end() ? found->second : unresolved;
+}
+
+RemoteInodes::fuse_ino_t RemoteInodes::server_ino(fuse_ino_t ino) const {
+    if (ino == root) {
+        return root;
+    }
+
+    auto guard = std::scoped_lock{lock};
+    auto found = inodes.find(ino);
+    return found != inodes.end() ? found->second.server_ino : unresolved;
+}
+
+void RemoteInodes::resolved(fuse_ino_t ino, fuse_ino_t server_ino) {
+    auto guard = std::scoped_lock{lock};
+    if (auto found = inodes.find(ino); found != inodes.end()) {
+        found->second.server_ino = server_ino;
+    }
+}
+
+void RemoteInodes::invalidate(fuse_ino_t ino) {
+    resolved(ino, unresolved);
+}
+
+void RemoteInodes::remove(fuse_ino_t parent, std::string_view name) {
+    auto key = std::pair{parent, std::string{name}};
+    auto guard = std::scoped_lock{lock};
+    forget(key);
+}
+
+void RemoteInodes::rename(fuse_ino_t parent, std::string_view name, fuse_ino_t new_parent, std::string_view new_name) {
+    auto key = std::pair{parent, std::string{name}};
+    auto new_key = std::pair{new_parent, std::string{new_name}};
+    auto guard = std::scoped_lock{lock};
+    auto node = by_name.extract(key);
+    if (node.empty()) {
+        return;
+    }
+
+    forget(new_key);
+    auto& inode = inodes.at(node.mapped());
+    inode.parent = new_parent;
+    inode.name = new_key.second;
+    node.key() = std::move(new_key);
+    by_name.insert(std::move(node));
+}
+
+void RemoteInodes::forget(const std::pair<fuse_ino_t, std::string>& key) {
+    if (auto found = by_name.find(key); found != by_name.end()) {
+        // Its path doesn't lead anywhere anymore.
+        inodes.at(found->second).parent = unresolved;
+        by_name.erase(found);
+    }
+}
+
+std::optional<std::string> RemoteInodes::path(fuse_ino_t ino) const {
+    auto names = std::vector<const std::string*>{};
+    auto guard = std::scoped_lock{lock};
+    while (ino != root) {
+        auto found = inodes.find(ino);
+        if (found == inodes.end()) {
+            return std::nullopt;
+        }
+        names.push_back(&found->second.name);
+        ino = found->second.parent;
+    }
+
+    auto path = std::string{};
+    for (auto name = names.rbegin(); name != names.rend(); name++) {
+        if (!path.empty()) {
+            path += '/';
+        }
+        path += **name;
+    }
+    return path;
+}
+
+}  // namespace remotefs
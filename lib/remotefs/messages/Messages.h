@@ -5,19 +5,120 @@
 #ifndef REMOTE_FS_MESSAGES_H
 #define REMOTE_FS_MESSAGES_H
 
+#include <fuse3/fuse_kernel.h>
 #include <fuse_lowlevel.h>
 
 #include <algorithm>
 #include <array>
 #include <cassert>
 #include <climits>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <optional>
 #include <span>
+#include <string_view>
+#include <system_error>
 
 #include "remotefs/tools/Bytes.h"
 #include "remotefs/tools/Casts.h"
+#include "remotefs/tools/Varint.h"
 
 namespace remotefs::messages {
+// Bumped whenever the layout of a message changes. Clients announce it with Hello, servers refuse other versions.
+inline constexpr std::uint8_t protocol_version = 10;
+
+// Identifies a request among those in flight on the client, and the replies to it. Servers echo it without looking at
+// it.
+using RequestId = std::uint32_t;
+
+// Attributes are sent as varints, and only the fields FUSE passes on to the kernel (see convert_stat in libfuse). Most
+// of them are small numbers.
+inline constexpr std::size_t max_attributes_size = 15 * max_varint_size;
+
+// out must have room for max_attributes_size bytes. Returns the number of bytes written.
+inline std::size_t encode_attributes(const struct stat& stat, std::byte* out) {
+    auto written = 0ul;
+    for (auto field : {
+             std::uint64_t{stat.st_ino}, std::uint64_t{stat.st_mode}, std::uint64_t{stat.st_nlink},
+             std::uint64_t{stat.st_uid}, std::uint64_t{stat.st_gid}, std::uint64_t{stat.st_rdev},
+             zigzag_encode(stat.st_size), zigzag_encode(stat.st_blocks), zigzag_encode(stat.st_blksize),
+             zigzag_encode(stat.st_atim.tv_sec), zigzag_encode(stat.st_mtim.tv_sec), zigzag_encode(stat.st_ctim.tv_sec),
+             static_cast<std::uint64_t>(stat.st_atim.tv_nsec), static_cast<std::uint64_t>(stat.st_mtim.tv_nsec),
+             static_cast<std::uint64_t>(stat.st_ctim.tv_nsec)}) {
+        written += write_varint(out + written, field);
+    }
+    return written;
+}
+
+// Consumes the attributes at the start of in. Empty if they are truncated.
+inline std::optional<struct stat> decode_attributes(std::span<const std::byte>& in) {
+    auto fields = std::array<std::uint64_t, 15>{};
+    for (auto& field : fields) {
+        auto value = read_varint(in);
+        if (!value) {
+            return std::nullopt;
+        }
+        field = *value;
+    }
+
+    struct stat stat {};
+    stat.st_ino = fields[0];
+    stat.st_mode = static_cast<mode_t>(fields[1]);
+    stat.st_nlink = narrow_cast<nlink_t>(fields[2]);
+    stat.st_uid = static_cast<uid_t>(fields[3]);
+    stat.st_gid = static_cast<gid_t>(fields[4]);
+    stat.st_rdev = narrow_cast<dev_t>(fields[5]);
+    stat.st_size = narrow_cast<off_t>(zigzag_decode(fields[6]));
+    stat.st_blocks = narrow_cast<blkcnt_t>(zigzag_decode(fields[7]));
+    stat.st_blksize = narrow_cast<blksize_t>(zigzag_decode(fields[8]));
+    stat.st_atim = {zigzag_decode(fields[9]), static_cast<long>(fields[12])};
+    stat.st_mtim = {zigzag_decode(fields[10]), static_cast<long>(fields[13])};
+    stat.st_ctim = {zigzag_decode(fields[11]), static_cast<long>(fields[14])};
+    return stat;
+}
+
+inline constexpr std::size_t max_entry_size = 3 * max_varint_size + max_attributes_size;
+
+// Same as above, for entries, with their timeouts in milliseconds.
+inline std::size_t encode_entry(const fuse_entry_param& entry, std::byte* out) {
+    auto written = write_varint(out, entry.generation);
+    written += write_varint(out + written, static_cast<std::uint64_t>(entry.attr_timeout * 1000));
+    written += write_varint(out + written, static_cast<std::uint64_t>(entry.entry_timeout * 1000));
+    return written + encode_attributes(entry.attr, out + written);
+}
+
+inline std::optional<fuse_entry_param> decode_entry(std::span<const std::byte>& in) {
+    auto generation = read_varint(in);
+    auto attr_timeout = read_varint(in);
+    auto entry_timeout = read_varint(in);
+    auto attr = decode_attributes(in);
+    if (!generation || !attr_timeout || !entry_timeout || !attr) {
+        return std::nullopt;
+    }
+
+    return fuse_entry_param{
+        .ino = attr->st_ino,
+        .generation = *generation,
+        .attr = *attr,
+        .attr_timeout = static_cast<double>(*attr_timeout) / 1000,
+        .entry_timeout = static_cast<double>(*entry_timeout) / 1000};
+}
+
+// Tells whether the pages the kernel cached for a file are still those of its content: they are as long as its size and
+// modification time didn't change.
+struct ContentVersion {
+    std::int64_t size = -1;  // Unknown, nothing is cached.
+    std::int64_t mtime_sec = 0;
+    std::int64_t mtime_nsec = 0;
+
+    static ContentVersion of(const struct stat& stat) {
+        return {.size = stat.st_size, .mtime_sec = stat.st_mtim.tv_sec, .mtime_nsec = stat.st_mtim.tv_nsec};
+    }
+
+    bool operator==(const ContentVersion&) const = default;
+};
+
 namespace both {
 
 template <auto PingSize>
@@ -55,104 +156,303 @@ class Ping {
 }  // namespace both
 
 namespace requests {
+// The part of message up to the null terminating path, its last member, which is all there is to send of it.
+template <typename Message>
+std::span<std::byte> view_through(Message& message, std::span<char> path) {
+    auto end = std::ranges::find(path, '\0');
+    assert(end != path.end());
+    return std::span{reinterpret_cast<std::byte*>(&message), reinterpret_cast<std::byte*>(&*end + 1)};
+}
+
+// The kernel keeps its cached pages, with keep_cache, if the content is still the cached one.
 struct Open {
     [[maybe_unused]] const std::byte tag = std::byte{1};
-    fuse_req_t req;
+    RequestId id;
     fuse_ino_t ino;
     fuse_file_info file_info;
+    ContentVersion cached;
+    fuse_ino_t client_ino = 0;  // Echoed by the FusePush following the reply, 0 if the client doesn't take them.
 };
 
+// Only the path up to its terminating null is sent, see view().
 struct Lookup {
     [[maybe_unused]] std::byte tag = std::byte{2};
-    fuse_req_t req;
+    RequestId id;
     fuse_ino_t ino;
     std::array<char, PATH_MAX + 1> path;
 
     std::span<std::byte> view() {
-        auto end = std::ranges::find(path, '\0');
-        assert(end != path.end());
-        return std::span{reinterpret_cast<std::byte*>(this), reinterpret_cast<std::byte*>(std::next(end))};
+        return view_through(*this, path);
     }
 };
 
 struct GetAttr {
     [[maybe_unused]] const std::byte tag = std::byte{3};
-    fuse_req_t req;
+    RequestId id;
     fuse_ino_t ino;
 };
 
 struct ReadDir {
     [[maybe_unused]] const std::byte tag = std::byte{4};
-    fuse_req_t req;
+    RequestId id;
     fuse_ino_t ino;
     size_t size;
     off_t offset;
 };
 
 struct Read {
+    // The client can decompress the reply, see FuseReplyCompressed.
+    static constexpr std::uint8_t accept_compressed = 1;
+
     [[maybe_unused]] const std::byte tag = std::byte{5};
-    fuse_req_t req;
+    std::uint8_t flags = 0;
+    RequestId id;
     fuse_ino_t ino;
     size_t size;
     off_t offset;
 };
 
+// Not replied to, so it has no id.
 struct Release {
     [[maybe_unused]] const std::byte tag = std::byte{6};
-    fuse_req_t req;
+    bool writable = false;  // The file was opened for writes.
+    fuse_ino_t ino;
+};
+
+// First message of a connection.
+struct Hello {
+    [[maybe_unused]] const std::byte tag = std::byte{8};
+    std::uint8_t version = protocol_version;
+};
+
+// A request of the kernel forwarded as it was read from /dev/fuse, in tunnel mode, except for its node ids which are
+// the ones of the server. Only the request itself is sent, see view().
+struct Fuse {
+    [[maybe_unused]] const std::byte tag = std::byte{9};
+    std::uint8_t flags = 0;  // Read::accept_compressed, for reads.
+    RequestId id;
+    alignas(fuse_in_header) std::array<std::byte, sizeof(fuse_in_header) + PATH_MAX + 1> request;
+
+    fuse_in_header& header() {
+        return *reinterpret_cast<fuse_in_header*>(request.data());
+    }
+
+    std::span<std::byte> view() {
+        assert(header().len <= request.size());
+        return singular_bytes(*this).subspan(0, offsetof(Fuse, request) + header().len);
+    }
+};
+
+// The data to write follows the request, only its size is sent, see view(). The server writes it from the buffer it was
+// received in.
+template <size_t WriteSize>
+struct Write {
+    // Write has no default constructor to get its tag from, unlike the other messages.
+    static constexpr auto message_tag = std::byte{10};
+
+    Write(RequestId i, fuse_ino_t n, off_t o, std::span<const std::byte> data)
+        : size{narrow_cast<std::uint32_t>(data.size())},
+          id{i},
+          ino{n},
+          offset{o} {
+        static_assert(sizeof(Write) <= WriteSize);
+        assert(data.size() <= max_payload_size());
+        std::ranges::copy(data, payload);
+    }
+
+    union {
+        struct {
+            [[maybe_unused]] const std::byte tag = message_tag;
+            std::uint32_t size;  // Of payload.
+            RequestId id;
+            fuse_ino_t ino;
+            off_t offset;
+            std::byte payload[];
+        };
+
+        std::array<std::byte, mask_out(WriteSize, 0b1111)> _padding;
+    };
+
+    std::span<std::byte> data() {
+        return {payload, size};
+    }
+
+    std::span<std::byte> view() {
+        return singular_bytes(*this).subspan(0, offsetof(Write, payload) + size);
+    }
+
+    static constexpr size_t max_payload_size() {
+        return sizeof(Write) - offsetof(Write, payload);
+    }
+};
+
+// Creates and opens a file, only the path up to its terminating null is sent, see view().
+struct Create {
+    [[maybe_unused]] const std::byte tag = std::byte{11};
+    RequestId id;
+    fuse_ino_t ino;  // Of the parent.
+    std::uint32_t flags;
+    std::uint32_t mode;
+    std::array<char, PATH_MAX + 1> path;
+
+    std::span<std::byte> view() {
+        return view_through(*this, path);
+    }
+};
+
+// Changes the attributes given in arguments.valid, replied to with the new attributes.
+struct SetAttr {
+    [[maybe_unused]] const std::byte tag = std::byte{12};
+    RequestId id;
+    fuse_ino_t ino;
+    fuse_setattr_in arguments;
+};
+
+// Replied to with an error, 0 on success.
+struct Fsync {
+    [[maybe_unused]] const std::byte tag = std::byte{13};
+    bool datasync = false;
+    RequestId id;
+    fuse_ino_t ino;
+};
+
+// Replied to with an entry, see Lookup for what is sent.
+struct Mkdir {
+    [[maybe_unused]] const std::byte tag = std::byte{14};
+    RequestId id;
+    fuse_ino_t ino;  // Of the parent.
+    std::uint32_t mode;
+    std::array<char, PATH_MAX + 1> path;
+
+    std::span<std::byte> view() {
+        return view_through(*this, path);
+    }
+};
+
+// Removes a file, or an empty directory. Replied to with an error, 0 on success.
+struct Unlink {
+    [[maybe_unused]] const std::byte tag = std::byte{15};
+    bool directory = false;
+    RequestId id;
+    fuse_ino_t ino;  // Of the parent.
+    std::array<char, PATH_MAX + 1> path;
+
+    std::span<std::byte> view() {
+        return view_through(*this, path);
+    }
+};
+
+// Moves the first of names in ino to the second in new_ino, each is terminated by a null. Replied to with an error, 0
+// on success.
+struct Rename {
+    [[maybe_unused]] const std::byte tag = std::byte{16};
+    std::uint32_t flags;  // Of renameat2.
+    RequestId id;
     fuse_ino_t ino;
+    fuse_ino_t new_ino;
+    std::array<char, 2 * (PATH_MAX + 1)> names;
+
+    // Returns false if they don't fit.
+    bool set_names(std::string_view name, std::string_view new_name) {
+        if (name.size() + new_name.size() + 2 > names.size()) {
+            return false;
+        }
+        *std::ranges::copy(name, names.begin()).out = '\0';
+        *std::ranges::copy(new_name, names.begin() + name.size() + 1).out = '\0';
+        return true;
+    }
+
+    [[nodiscard]] const char* name() const {
+        return names.data();
+    }
+
+    [[nodiscard]] const char* new_name() const {
+        return names.data() + std::strlen(names.data()) + 1;
+    }
+
+    std::span<std::byte> view() {
+        return view_through(*this, std::span{names}.subspan(std::strlen(names.data()) + 1));
+    }
 };
 }  // namespace requests
 
 namespace responses {
 struct FuseReplyEntry {
-    explicit FuseReplyEntry(fuse_req_t r)
-        : req{r} {}
-
-    explicit FuseReplyEntry(fuse_req_t r, fuse_entry_param f)
-        : req{r},
-          attr{f} {}
+    FuseReplyEntry(RequestId i, const fuse_entry_param& entry)
+        : id{i} {
+        size = narrow_cast<std::uint8_t>(encode_entry(entry, encoded.data()));
+    }
 
     [[maybe_unused]] const std::byte tag = std::byte{1};
-    fuse_req_t req;
-    fuse_entry_param attr;
+    std::uint8_t size;  // Of encoded.
+    RequestId id;
+    std::array<std::byte, max_entry_size> encoded;
+
+    [[nodiscard]] std::span<const std::byte> view() const {
+        return singular_bytes(*this).subspan(0, offsetof(FuseReplyEntry, encoded) + size);
+    }
+
+    // Empty if the reply is malformed.
+    [[nodiscard]] std::optional<fuse_entry_param> entry() const {
+        auto in = std::span{encoded}.first(std::min<std::size_t>(size, encoded.size()));
+        return decode_entry(in);
+    }
 };
 
 struct FuseReplyAttr {
-    FuseReplyAttr(auto r, auto a)
-        : req{r},
-          attr{a} {}
+    FuseReplyAttr(RequestId i, const struct stat& attr)
+        : id{i} {
+        size = narrow_cast<std::uint8_t>(encode_attributes(attr, encoded.data()));
+    }
 
     [[maybe_unused]] const std::byte tag = std::byte{2};
-    fuse_req_t req;
-    struct stat attr;
+    std::uint8_t size;  // Of encoded.
+    RequestId id;
+    std::array<std::byte, max_attributes_size> encoded;
+
+    [[nodiscard]] std::span<const std::byte> view() const {
+        return singular_bytes(*this).subspan(0, offsetof(FuseReplyAttr, encoded) + size);
+    }
+
+    // Empty if the reply is malformed.
+    [[nodiscard]] std::optional<struct stat> attr() const {
+        auto in = std::span{encoded}.first(std::min<std::size_t>(size, encoded.size()));
+        return decode_attributes(in);
+    }
 };
 
 struct FuseReplyOpen {
-    FuseReplyOpen(auto r, auto f)
-        : req{r},
-          file_info(f) {}
+    FuseReplyOpen(RequestId i, const fuse_file_info& f, const ContentVersion& v = {}, std::uint64_t p = 0)
+        : id{i},
+          file_info(f),
+          version{v},
+          pushed{p} {}
 
     [[maybe_unused]] const std::byte tag = std::byte{3};
-    fuse_req_t req;
+    RequestId id;
     fuse_file_info file_info;
+    ContentVersion version;  // Of the file as it was opened.
+    std::uint64_t pushed;  // Bytes of the file sent next in FusePush, from its start.
+
+    [[nodiscard]] std::span<const std::byte> view() const {
+        return singular_bytes(*this);
+    }
 };
 
 template <size_t FuseReplyBufSize>
 struct FuseReplyBuf {
-    explicit FuseReplyBuf(auto r, size_t size = max_payload_size())
-        : free_space{narrow_cast<decltype(free_space)>(size)},
-          req{r} {
+    explicit FuseReplyBuf(RequestId i)
+        : id{i} {
         static_assert(sizeof(FuseReplyBuf) <= FuseReplyBufSize);
-        assert(free_space <= narrow_cast<long>(max_payload_size()));
     }
 
     union {
         struct {
             [[maybe_unused]] const std::byte tag = std::byte{4};
             int payload_size = 0;
-            int free_space;  // TODO: Do not transfer over the network.
-            fuse_req_t req;
+            RequestId id;
+            // Makes room for the client to write the header of its reply to the kernel in place, before the payload.
+            [[maybe_unused]] std::uint32_t reserved = 0;
             std::byte payload[];
         };
 
@@ -161,31 +461,34 @@ struct FuseReplyBuf {
 
     void set_size(int size) {
         payload_size = size;
-        free_space = 0;
     }
 
     std::span<char> read_view() {
         return {reinterpret_cast<char*>(payload), narrow_cast<size_t>(payload_size)};
     }
 
-    std::span<std::byte> write_view() {
-        return {reinterpret_cast<std::byte*>(payload + payload_size), narrow_cast<size_t>(free_space)};
+    // The room left for a reply of at most capacity bytes, the size the request asked for.
+    std::span<std::byte> write_view(size_t capacity) {
+        assert(capacity <= max_payload_size());
+        assert(narrow_cast<size_t>(payload_size) <= capacity);
+        return {payload + payload_size, capacity - payload_size};
     }
 
     std::span<std::byte> outer_view() {
         return singular_bytes(*this).subspan(0, offsetof(FuseReplyBuf, payload) + payload_size);
     }
 
-    bool add_directory_entry(const std::filesystem::path& path, const struct stat& stats, off_t offset) {
-        auto view = write_view();
+    bool add_directory_entry(
+        const std::filesystem::path& path, const struct stat& stats, off_t offset, size_t capacity
+    ) {
+        auto view = write_view(capacity);
 
         // fuse_req_t is ignored (1st parameter)
         auto entry_size = fuse_add_direntry(
             nullptr, reinterpret_cast<char*>(view.data()), view.size(), path.filename().c_str(), &stats, offset
         );
-        if (entry_size <= narrow_cast<size_t>(free_space)) {
-            payload_size += entry_size;
-            free_space -= entry_size;
+        if (entry_size <= view.size()) {
+            payload_size += narrow_cast<int>(entry_size);
             return true;
         }
 
@@ -197,14 +500,301 @@ struct FuseReplyBuf {
     }
 };
 
+// Read reply whose payload is compressed with LZ4, only sent to clients that accept it.
+template <size_t FuseReplyCompressedSize>
+struct FuseReplyCompressed {
+    FuseReplyCompressed(RequestId i, size_t original)
+        : original_size{narrow_cast<decltype(original_size)>(original)},
+          id{i} {
+        static_assert(sizeof(FuseReplyCompressed) <= FuseReplyCompressedSize);
+    }
+
+    union {
+        struct {
+            [[maybe_unused]] const std::byte tag = std::byte{9};
+            int payload_size = 0;
+            int original_size;  // Once decompressed.
+            RequestId id;
+            std::byte payload[];
+        };
+
+        std::array<std::byte, mask_out(FuseReplyCompressedSize, 0b1111)> _padding;
+    };
+
+    void set_size(int size) {
+        payload_size = size;
+    }
+
+    std::span<const std::byte> read_view() const {
+        return {payload, narrow_cast<size_t>(payload_size)};
+    }
+
+    std::span<std::byte> write_view() {
+        return {payload, max_payload_size()};
+    }
+
+    std::span<std::byte> outer_view() {
+        return singular_bytes(*this).subspan(0, offsetof(FuseReplyCompressed, payload) + payload_size);
+    }
+
+    static constexpr size_t max_payload_size() {
+        return sizeof(FuseReplyCompressed) - offsetof(FuseReplyCompressed, payload);
+    }
+};
+
+// Part of a read reply, for reads split so that the disk and the network work in parallel. Parts may arrive in any
+// order, the client puts them back together using their offset.
+template <size_t FuseReplyChunkSize>
+struct FuseReplyChunk {
+    FuseReplyChunk(RequestId i, size_t total, size_t chunk_offset, size_t size)
+        : requested{narrow_cast<decltype(requested)>(size)},
+          id{i},
+          total_size{total},
+          offset{chunk_offset} {
+        static_assert(sizeof(FuseReplyChunk) <= FuseReplyChunkSize);
+        assert(size <= max_payload_size());
+        assert(chunk_offset + size <= total);
+    }
+
+    union {
+        struct {
+            [[maybe_unused]] const std::byte tag = std::byte{6};
+            int result = 0;  // Bytes read, fewer than requested at the end of the file, or a negative errno.
+            int requested;
+            RequestId id;
+            size_t total_size;  // Of the whole reply.
+            size_t offset;      // Of this part in the whole reply.
+            std::byte payload[];
+        };
+
+        std::array<std::byte, mask_out(FuseReplyChunkSize, 0b1111)> _padding;
+    };
+
+    std::span<const char> read_view() const {
+        return {reinterpret_cast<const char*>(payload), narrow_cast<size_t>(std::max(result, 0))};
+    }
+
+    std::span<std::byte> write_view() {
+        return {payload, narrow_cast<size_t>(requested)};
+    }
+
+    std::span<std::byte> outer_view() {
+        return singular_bytes(*this).subspan(0, offsetof(FuseReplyChunk, payload) + read_view().size());
+    }
+
+    static constexpr size_t max_payload_size() {
+        return sizeof(FuseReplyChunk) - offsetof(FuseReplyChunk, payload);
+    }
+};
+
+// Part of a file sent after its open without being asked for, see FuseReplyOpen::pushed. The client stores it in the
+// page cache of the kernel. Parts may arrive in any order.
+template <size_t FusePushSize>
+struct FusePush {
+    FusePush(fuse_ino_t i, std::uint64_t push_offset, size_t size)
+        : requested{narrow_cast<decltype(requested)>(size)},
+          ino{i},
+          offset{push_offset} {
+        static_assert(sizeof(FusePush) <= FusePushSize);
+        assert(size <= max_payload_size());
+    }
+
+    union {
+        struct {
+            [[maybe_unused]] const std::byte tag = std::byte{13};
+            int result = 0;  // Bytes read, or a negative errno.
+            int requested;
+            fuse_ino_t ino;  // Of the client, see requests::Open::client_ino.
+            std::uint64_t offset;
+            std::byte payload[];
+        };
+
+        std::array<std::byte, mask_out(FusePushSize, 0b1111)> _padding;
+    };
+
+    std::span<const char> read_view() const {
+        return {reinterpret_cast<const char*>(payload), narrow_cast<size_t>(std::max(result, 0))};
+    }
+
+    std::span<std::byte> write_view() {
+        return {payload, narrow_cast<size_t>(requested)};
+    }
+
+    std::span<std::byte> outer_view() {
+        return singular_bytes(*this).subspan(0, offsetof(FusePush, payload) + read_view().size());
+    }
+
+    static constexpr size_t max_payload_size() {
+        return sizeof(FusePush) - offsetof(FusePush, payload);
+    }
+};
+
+struct FuseReplyWrite {
+    FuseReplyWrite(RequestId i, std::uint32_t s)
+        : id{i},
+          size{s} {}
+
+    [[maybe_unused]] const std::byte tag = std::byte{11};
+    RequestId id;
+    std::uint32_t size;  // Written.
+
+    [[nodiscard]] std::span<const std::byte> view() const {
+        return singular_bytes(*this);
+    }
+};
+
+struct FuseReplyCreate {
+    FuseReplyCreate(RequestId i, const fuse_entry_param& entry, const fuse_file_info& f)
+        : id{i},
+          file_info(f) {
+        size = narrow_cast<std::uint8_t>(encode_entry(entry, encoded.data()));
+    }
+
+    [[maybe_unused]] const std::byte tag = std::byte{12};
+    std::uint8_t size;  // Of encoded.
+    RequestId id;
+    fuse_file_info file_info;
+    std::array<std::byte, max_entry_size> encoded;
+
+    [[nodiscard]] std::span<const std::byte> view() const {
+        return singular_bytes(*this).subspan(0, offsetof(FuseReplyCreate, encoded) + size);
+    }
+
+    // Empty if the reply is malformed.
+    [[nodiscard]] std::optional<fuse_entry_param> entry() const {
+        auto in = std::span{encoded}.first(std::min<std::size_t>(size, encoded.size()));
+        return decode_entry(in);
+    }
+};
+
+// Also acknowledges requests without a reply of their own, with error_code 0.
 struct FuseReplyErr {
-    FuseReplyErr(fuse_req_t r, int e)
-        : req(r),
+    FuseReplyErr(RequestId i, int e)
+        : id(i),
           error_code(e) {}
 
     [[maybe_unused]] const std::byte tag = std::byte{5};
-    fuse_req_t req;
+    RequestId id;
     int error_code;
+
+    [[nodiscard]] std::span<const std::byte> view() const {
+        return singular_bytes(*this);
+    }
+};
+
+// The reply to a Fuse request, written to the kernel as is from header on. The client only rewrites the node ids it
+// holds. Replies with more than a fuse_entry_out of payload, like reads, are sent as FuseReplyBuf.
+struct FuseReplyRaw {
+    FuseReplyRaw(RequestId i, std::uint64_t unique, int error, std::span<const std::byte> payload = {})
+        : id{i},
+          header{.len = narrow_cast<std::uint32_t>(sizeof(fuse_out_header) + payload.size()),
+                 .error = -error,
+                 .unique = unique} {
+        assert(payload.size() <= this->payload.size());
+        std::ranges::copy(payload, this->payload.begin());
+    }
+
+    [[maybe_unused]] const std::byte tag = std::byte{10};
+    RequestId id;
+    fuse_out_header header;
+    std::array<std::byte, sizeof(fuse_entry_out)> payload;
+
+    [[nodiscard]] std::span<const std::byte> view() const {
+        return singular_bytes(*this).subspan(0, offsetof(FuseReplyRaw, header) + header.len);
+    }
+
+    // What is written to the kernel.
+    [[nodiscard]] std::span<const std::byte> fuse_view() const {
+        return singular_bytes(*this).subspan(offsetof(FuseReplyRaw, header), header.len);
+    }
+
+    // Null if the payload is too short.
+    template <typename Payload>
+    Payload* get() {
+        return header.len >= sizeof(fuse_out_header) + sizeof(Payload) ? reinterpret_cast<Payload*>(payload.data())
+                                                                        : nullptr;
+    }
+};
+
+// Small replies sent together as a single message. Each one is preceded by its size and starts aligned, so that it can
+// be used in place.
+template <size_t BatchSize>
+struct Batch {
+    Batch() {
+        static_assert(sizeof(Batch) <= BatchSize);
+    }
+
+    union {
+        struct {
+            [[maybe_unused]] const std::byte tag = std::byte{8};
+            std::uint32_t count = 0;
+            std::uint32_t size = 0;  // Of the payload.
+            alignas(std::uint64_t) std::byte payload[];
+        };
+
+        std::array<std::byte, mask_out(BatchSize, 0b1111)> _padding;
+    };
+
+    // Returns false when the batch is full.
+    bool add(std::span<const std::byte> reply) {
+        auto record = record_size(reply.size());
+        if (size + record > max_payload_size()) {
+            return false;
+        }
+
+        auto length = std::uint64_t{reply.size()};
+        std::memcpy(payload + size, &length, sizeof(length));
+        std::memcpy(payload + size + sizeof(length), reply.data(), reply.size());
+        size += narrow_cast<std::uint32_t>(record);
+        count++;
+        return true;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return count == 0;
+    }
+
+    std::span<std::byte> outer_view() {
+        return singular_bytes(*this).subspan(0, offsetof(Batch, payload) + size);
+    }
+
+    // Calls handler with each reply of a received batch, whatever the size it was built with. Throws
+    // std::system_error if the batch is truncated or malformed, the replies before are handled anyway.
+    template <typename Handler>
+    static void for_each(std::span<const std::byte> batch, Handler&& handler) {
+        if (batch.size() < offsetof(Batch, payload)) {
+            throw std::system_error(EPROTO, std::generic_category(), "Truncated Batch");
+        }
+        auto payload_size = std::uint32_t{};
+        std::memcpy(&payload_size, batch.data() + offsetof(Batch, size), sizeof(payload_size));
+        if (payload_size > batch.size() - offsetof(Batch, payload)) {
+            throw std::system_error(EPROTO, std::generic_category(), "Truncated Batch");
+        }
+
+        auto records = batch.subspan(offsetof(Batch, payload), payload_size);
+        while (!records.empty()) {
+            auto length = std::uint64_t{};
+            if (records.size() < sizeof(length)) {
+                throw std::system_error(EPROTO, std::generic_category(), "Malformed Batch");
+            }
+            std::memcpy(&length, records.data(), sizeof(length));
+            if (length == 0 || length > records.size() - sizeof(length)) {
+                throw std::system_error(EPROTO, std::generic_category(), "Malformed Batch");
+            }
+            handler(records.subspan(sizeof(length), length));
+            records = records.subspan(std::min(record_size(length), records.size()));
+        }
+    }
+
+    static constexpr size_t max_payload_size() {
+        return sizeof(Batch) - offsetof(Batch, payload);
+    }
+
+   private:
+    static constexpr size_t record_size(size_t reply_size) {
+        constexpr auto alignment = alignof(std::uint64_t);
+        return (sizeof(std::uint64_t) + reply_size + alignment - 1) / alignment * alignment;
+    }
 };
 }  // namespace responses
 }  // namespace remotefs::messages
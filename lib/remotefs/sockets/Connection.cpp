@@ -0,0 +1,674 @@
+#include "Connection.h"
+
+#include <netinet/sctp.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace remotefs {
+
+// Sends as many queued messages as possible with a single sendmsg. Each message is preceded by its size.
+class Connection::FramedSend final : public CallbackErased {
+   public:
+    static constexpr auto max_messages = 64;
+
+    explicit FramedSend(std::shared_ptr<Connection> connection)
+        : connection{std::move(connection)} {}
+
+    // Returns false when the message must wait for the next sendmsg.
+    bool add(PendingSend& pending) {
+        if (count == max_messages || (count > 0 && pending.zero_copy != zero_copy)) {
+            return false;
+        }
+
+        zero_copy = pending.zero_copy;
+        headers[count] = narrow_cast<Header>(pending.source.size());
+        iov[2 * count] = {.iov_base = &headers[count], .iov_len = sizeof(Header)};
+        iov[2 * count + 1] = {
+            .iov_base = const_cast<std::byte*>(pending.source.data()), .iov_len = pending.source.size()};
+        callbacks[count] = std::move(pending.callback);
+        total += sizeof(Header) + pending.source.size();
+        count++;
+        return true;
+    }
+
+    const msghdr* prepare() {
+        assert(count > 0);
+        header = msghdr{.msg_iov = iov.data(), .msg_iovlen = narrow_cast<size_t>(2 * count)};
+        return &header;
+    }
+
+    [[nodiscard]] bool is_zero_copy() const {
+        return zero_copy;
+    }
+
+   private:
+    // Zero copy sends: the messages must stay alive until the notification, which frees this object.
+    void operator()(int res) final {
+        complete(res, false);
+    }
+
+    void operator()(int res, std::unique_ptr<CallbackErased>) final {
+        complete(res, true);
+    }
+
+    void complete(int res, bool last) {
+        if (res >= 0 && narrow_cast<size_t>(res) != total) {
+            // With MSG_WAITALL, the kernel retries short sends by itself. A short send means the connection failed
+            // midway, the peer would not find the messages boundaries anymore.
+            ::shutdown(connection->socket, SHUT_RDWR);
+            res = -EPIPE;
+        }
+
+        for (auto i = 0; i < count; i++) {
+            auto result = res < 0 ? res : narrow_cast<int>(iov[2 * i + 1].iov_len);
+            if (last) {
+                auto* callback = callbacks[i].release();
+                (*callback)(result, std::unique_ptr<CallbackErased>{callback});
+            } else {
+                (*callbacks[i])(result);
+            }
+        }
+
+        connection->sending = false;
+        connection->send_next();
+    }
+
+    std::shared_ptr<Connection> connection;
+    std::array<Header, max_messages> headers;
+    std::array<iovec, 2 * max_messages> iov;
+    std::array<std::unique_ptr<CallbackErased>, max_messages> callbacks;
+    msghdr header{};
+    std::size_t total = 0;
+    int count = 0;
+    bool zero_copy = false;
+};
+
+// Sends a single message on a given SCTP stream. The stream is given in an ancillary SCTP_SNDINFO, which must stay
+// alive until completion with the rest of the msghdr.
+class Connection::StreamSend final : public CallbackErased {
+   public:
+    StreamSend(
+        std::span<const std::byte> source, std::unique_ptr<CallbackErased> callback, std::uint16_t stream,
+        std::uint16_t flags
+    )
+        : callback{std::move(callback)},
+          iov{.iov_base = const_cast<std::byte*>(source.data()), .iov_len = source.size()} {
+        header = msghdr{
+            .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.data(), .msg_controllen = control.size()};
+        auto* cmsg = CMSG_FIRSTHDR(&header);
+        cmsg->cmsg_level = IPPROTO_SCTP;
+        cmsg->cmsg_type = SCTP_SNDINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(sctp_sndinfo));
+        auto info = sctp_sndinfo{.snd_sid = stream, .snd_flags = flags};
+        std::memcpy(CMSG_DATA(cmsg), &info, sizeof(info));
+    }
+
+    const msghdr* get_header() const {
+        return &header;
+    }
+
+   private:
+    void operator()(int res) final {
+        (*callback)(res);
+    }
+
+    void operator()(int res, std::unique_ptr<CallbackErased>) final {
+        auto* released = callback.release();
+        (*released)(res, std::unique_ptr<CallbackErased>{released});
+    }
+
+    std::unique_ptr<CallbackErased> callback;
+    iovec iov;
+    alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(sctp_sndinfo))> control{};
+    msghdr header{};
+};
+
+// Receives a part of a message, or a whole one, along with the stream it belongs to. The stream is given in an
+// ancillary SCTP_RCVINFO, and MSG_EOR is set on the last part of a message.
+class Connection::StreamReceive final : public CallbackErased {
+   public:
+    StreamReceive(std::shared_ptr<Connection> connection, Handler handler, Message message)
+        : connection{std::move(connection)},
+          handler{std::move(handler)},
+          message{std::move(message)} {
+        auto storage = std::span{this->message->get_storage()};
+        iov = iovec{.iov_base = storage.data(), .iov_len = storage.size()};
+        header = msghdr{
+            .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.data(), .msg_controllen = control.size()};
+    }
+
+    msghdr* get_header() {
+        return &header;
+    }
+
+   private:
+    void operator()(int res) final {
+        complete(res);
+    }
+
+    void operator()(int res, std::unique_ptr<CallbackErased>) final {
+        complete(res);
+    }
+
+    void complete(int res) {
+        auto stream = std::uint16_t{0};
+        for (auto* cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_SCTP && cmsg->cmsg_type == SCTP_RCVINFO) {
+                auto info = sctp_rcvinfo{};
+                std::memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                stream = info.rcv_sid;
+            }
+        }
+        auto last = (header.msg_flags & MSG_EOR) != 0;
+        connection->received_part(res, stream, last, std::move(message), std::move(handler));
+    }
+
+    std::shared_ptr<Connection> connection;
+    Handler handler;
+    Message message;
+    iovec iov{};
+    alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(sctp_rcvinfo))> control{};
+    msghdr header{};
+};
+
+std::shared_ptr<Connection> Connection::create(IoUring& uring, Socket&& socket) {
+    auto connection = std::shared_ptr<Connection>{new Connection{uring, std::move(socket)}};
+    if (connection->shared_memory) {
+        connection->watch_peer();
+    }
+    return connection;
+}
+
+void Connection::create(IoUring& uring, Socket&& socket, Created created) {
+    if (socket.transport() != Transport::shm) {
+        auto connection = std::shared_ptr<Connection>{};
+        try {
+            connection = create(uring, std::move(socket));
+        } catch (const std::system_error& error) {
+            created(error.code().value(), nullptr);
+            return;
+        }
+        created(0, std::move(connection));
+        return;
+    }
+
+    struct PendingHandshake {
+        Socket socket;
+        std::unique_ptr<SharedMemoryChannel> channel;
+        SharedMemoryChannel::Handshake received;
+        Created created;
+    };
+
+    auto handshake = std::make_unique<PendingHandshake>(std::move(socket), nullptr);
+    try {
+        // Our half is sent right away, a fresh unix socket has room for it.
+        handshake->channel = std::make_unique<SharedMemoryChannel>(handshake->socket, std::nullopt);
+    } catch (const std::system_error& error) {
+        created(error.code().value(), nullptr);
+        return;
+    }
+    handshake->created = std::move(created);
+
+    auto fd = static_cast<int>(handshake->socket);
+    auto* message = handshake->received.message();
+    uring.recvmsg(
+        fd, message, MSG_CMSG_CLOEXEC,
+        uring.get_callback([&uring, handshake = std::move(handshake)](int ret) {
+            auto connection = std::shared_ptr<Connection>{};
+            try {
+                handshake->channel->complete(handshake->received, ret);
+                connection = std::shared_ptr<Connection>{
+                    new Connection{uring, std::move(handshake->socket), std::move(handshake->channel)}};
+            } catch (const std::system_error& error) {
+                handshake->created(error.code().value(), nullptr);
+                return;
+            }
+            connection->watch_peer();
+            handshake->created(0, std::move(connection));
+        })
+    );
+}
+
+Connection::Connection(IoUring& uring, Socket&& s, std::unique_ptr<SharedMemoryChannel> channel)
+    : uring{uring},
+      socket{std::move(s)},
+      shared_memory{std::move(channel)} {
+    auto kind = socket.transport();
+    framed = kind == Transport::tcp;
+    if (kind == Transport::shm && !shared_memory) {
+        shared_memory = std::make_unique<SharedMemoryChannel>(socket);
+    }
+
+    if (kind == Transport::sctp) {
+        auto status = sctp_status{};
+        socklen_t status_size = sizeof(status);
+        if (getsockopt(socket, IPPROTO_SCTP, SCTP_STATUS, &status, &status_size) != 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to get SCTP status");
+        }
+        streams = std::max<std::uint16_t>(status.sstat_outstrms, 1);
+
+        auto defaults = sctp_sndinfo{};
+        socklen_t defaults_size = sizeof(defaults);
+        if (getsockopt(socket, IPPROTO_SCTP, SCTP_DEFAULT_SNDINFO, &defaults, &defaults_size) != 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to get default SCTP options");
+        }
+        stream_flags = defaults.snd_flags;
+
+        auto interleave_level = 0;
+        socklen_t interleave_level_size = sizeof(interleave_level);
+        if (getsockopt(
+                socket, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &interleave_level, &interleave_level_size
+            ) != 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to get SCTP fragment interleave level");
+        }
+        interleaved = interleave_level == 2;
+    }
+}
+
+void Connection::queue_send(
+    std::span<const std::byte> source, std::unique_ptr<CallbackErased> callback, bool zero_copy
+) {
+    assert(source.size() <= sizeof(Buffer));
+    send_queue.push_back({std::move(callback), source, zero_copy});
+    if (shared_memory) {
+        flush_shared();
+    } else {
+        send_next();
+    }
+}
+
+void Connection::send_on_stream(
+    std::span<const std::byte> source, std::unique_ptr<CallbackErased> callback, std::uint16_t stream
+) {
+    assert(!dynamic_cast<details::CallbackNop*>(callback.get()));
+    auto* ptr = IoUring::get_allocator<StreamSend>().new_object<StreamSend>(
+        source, std::move(callback), stream, stream_flags
+    );
+    uring.sendmsg(socket, ptr->get_header(), 0, std::unique_ptr<CallbackErased>{ptr});
+}
+
+void Connection::send_next() {
+    if (sending || send_queue.empty()) {
+        return;
+    }
+
+    auto* ptr = IoUring::get_allocator<FramedSend>().new_object<FramedSend>(shared_from_this());
+    auto framed_send = std::unique_ptr<CallbackErased>{ptr};
+    while (!send_queue.empty() && ptr->add(send_queue.front())) {
+        send_queue.pop_front();
+    }
+
+    sending = true;
+    if (ptr->is_zero_copy()) {
+        uring.sendmsg_zc(socket, ptr->prepare(), MSG_WAITALL, std::move(framed_send));
+    } else {
+        uring.sendmsg(socket, ptr->prepare(), MSG_WAITALL, std::move(framed_send));
+    }
+}
+
+void Connection::receive(Handler handler) {
+    if (interleaved) {
+        auto* ptr = IoUring::get_allocator<StreamReceive>().new_object<StreamReceive>(
+            shared_from_this(), std::move(handler), uring.get_callback<Buffer>([](int) {})
+        );
+        uring.recvmsg(socket, ptr->get_header(), 0, std::unique_ptr<CallbackErased>{ptr});
+        return;
+    }
+
+    if (!framed && !shared_memory) {
+        auto received = [self = shared_from_this(), handler = std::move(handler)](int ret, Message message) mutable {
+            handler(ret, ret > 0 ? std::move(message) : nullptr);
+        };
+        static_assert(sizeof(received) <= sizeof(ReceiveCallable));
+        auto callback = uring.get_callback<Buffer>(std::move(received));
+        auto view = std::span{callback->get_storage()};
+        uring.read_fixed(socket, view, 0, std::move(callback));
+        return;
+    }
+
+    handlers.push_back(std::move(handler));
+    dispatch();
+}
+
+void Connection::dispatch() {
+    // Handlers may ask for the next message, the loop below takes care of it.
+    if (dispatching) {
+        return;
+    }
+    dispatching = true;
+
+    if (shared_memory) {
+        dispatch_shared();
+        dispatching = false;
+        return;
+    }
+
+    while (!handlers.empty() && !receiving) {
+        if (!reassembly) {
+            reassembly = uring.get_callback<Buffer>([](int) {});
+        }
+
+        auto available = std::span{reassembly->get_storage()}.subspan(
+            reassembly_begin, reassembly_end - reassembly_begin
+        );
+        auto size = Header{};
+        if (available.size() >= sizeof(Header)) {
+            std::memcpy(&size, available.data(), sizeof(size));
+        }
+        auto payload = available.subspan(std::min(sizeof(Header), available.size()));
+        auto complete = available.size() >= sizeof(Header) && payload.size() >= size;
+
+        if (!complete && closed) {
+            auto handler = std::move(handlers.front());
+            handlers.pop_front();
+            handler(0, nullptr);
+            continue;
+        }
+
+        if (size > sizeof(Buffer)) {
+            fail(-EMSGSIZE);
+            continue;
+        }
+
+        if (available.size() < sizeof(Header)) {
+            read_more();
+            break;
+        }
+
+        if (complete) {
+            auto message = uring.get_callback<Buffer>([](int) {});
+            std::ranges::copy(payload.subspan(0, size), message->get_storage().begin());
+            reassembly_begin += sizeof(Header) + size;
+            auto handler = std::move(handlers.front());
+            handlers.pop_front();
+            handler(narrow_cast<int>(size), std::move(message));
+            continue;
+        }
+
+        if (size > copy_threshold) {
+            auto pipe = splicer ? splicer(payload, size) : -1;
+            auto message = uring.get_callback<Buffer>([](int) {});
+            std::ranges::copy(payload, message->get_storage().begin());
+            large_size = size;
+            large_filled = payload.size();
+            reassembly_begin = reassembly_end = 0;
+            if (pipe >= 0) {
+                spliced_prefix = payload.size();
+                splice_large(pipe, std::move(message));
+            } else {
+                read_large(std::move(message));
+            }
+            break;
+        }
+
+        read_more();
+        break;
+    }
+
+    dispatching = false;
+}
+
+void Connection::read_more() {
+    assert(reassembly);
+    assert(!receiving);
+
+    // Move what is left of a partial message to the front, so that the rest of it fits.
+    auto storage = std::span{reassembly->get_storage()};
+    if (reassembly_begin > 0) {
+        std::ranges::copy(storage.subspan(reassembly_begin, reassembly_end - reassembly_begin), storage.begin());
+        reassembly_end -= reassembly_begin;
+        reassembly_begin = 0;
+    }
+
+    receiving = true;
+    auto target = storage.subspan(reassembly_end);
+    auto callback = uring.get_callback(
+        [self = shared_from_this()](int ret, Message buffer) { self->received(ret, std::move(buffer)); },
+        std::move(reassembly)
+    );
+    uring.read_fixed(socket, target, 0, std::move(callback));
+}
+
+void Connection::read_large(Message message) {
+    assert(!receiving);
+    receiving = true;
+    auto target = std::span{message->get_storage()}.subspan(large_filled, large_size - large_filled);
+    auto callback = uring.get_callback(
+        [self = shared_from_this()](int ret, Message message) { self->received_large(ret, std::move(message)); },
+        std::move(message)
+    );
+    uring.read_fixed(socket, target, 0, std::move(callback));
+}
+
+void Connection::set_splicer(Splicer s) {
+    if (framed) {
+        splicer = std::move(s);
+    }
+}
+
+void Connection::splice_large(int pipe, Message message) {
+    assert(!receiving);
+    receiving = true;
+    auto callback = uring.get_callback(
+        [self = shared_from_this(), pipe](int ret, Message message) {
+            self->received_spliced(ret, pipe, std::move(message));
+        },
+        std::move(message)
+    );
+    uring.splice(socket, pipe, large_size - large_filled, std::move(callback));
+}
+
+void Connection::received_part(int ret, std::uint16_t stream, bool last, Message message, Handler handler) {
+    if (ret <= 0) {
+        handler(ret, nullptr);
+        return;
+    }
+
+    auto size = narrow_cast<std::size_t>(ret);
+    auto partial = partial_messages.find(stream);
+    if (partial == partial_messages.end()) {
+        if (last) {
+            handler(ret, std::move(message));
+            return;
+        }
+        // The first part is already where it belongs.
+        partial = partial_messages.emplace(stream, PartialMessage{std::move(message), size}).first;
+    } else {
+        auto& whole = partial->second;
+        if (whole.size + size > sizeof(Buffer)) {
+            // The rest of the message would be taken for new messages.
+            partial_messages.erase(partial);
+            ::shutdown(socket, SHUT_RDWR);
+            handler(-EMSGSIZE, nullptr);
+            return;
+        }
+        std::ranges::copy(
+            std::span{message->get_storage()}.subspan(0, size),
+            std::span{whole.message->get_storage()}.subspan(whole.size).begin()
+        );
+        whole.size += size;
+    }
+
+    if (!last) {
+        // The handler waits for a whole message, which may be the next part of this one or another one.
+        receive(std::move(handler));
+        return;
+    }
+
+    auto whole = std::move(partial->second);
+    partial_messages.erase(partial);
+    handler(narrow_cast<int>(whole.size), std::move(whole.message));
+}
+
+void Connection::received(int ret, Message buffer) {
+    receiving = false;
+    reassembly = std::move(buffer);
+
+    if (ret < 0) {
+        // Nothing was consumed, the next read can be retried.
+        auto handler = std::move(handlers.front());
+        handlers.pop_front();
+        handler(ret, nullptr);
+    } else if (ret == 0) {
+        closed = true;
+    } else {
+        reassembly_end += ret;
+    }
+
+    dispatch();
+}
+
+void Connection::received_large(int ret, Message message) {
+    receiving = false;
+
+    if (ret <= 0) {
+        // The message was partially consumed, the stream can't be resynchronized.
+        fail(ret);
+    } else if (large_filled += ret; large_filled < large_size) {
+        read_large(std::move(message));
+        return;
+    } else {
+        auto handler = std::move(handlers.front());
+        handlers.pop_front();
+        handler(narrow_cast<int>(large_size), std::move(message));
+    }
+
+    dispatch();
+}
+
+void Connection::received_spliced(int ret, int pipe, Message message) {
+    receiving = false;
+
+    if (ret <= 0) {
+        // Like received_large, the stream can't be resynchronized.
+        fail(ret);
+    } else if (large_filled += ret; large_filled < large_size) {
+        splice_large(pipe, std::move(message));
+        return;
+    } else {
+        auto handler = std::move(handlers.front());
+        handlers.pop_front();
+        handler(narrow_cast<int>(spliced_prefix), std::move(message));
+    }
+
+    dispatch();
+}
+
+void Connection::fail(int error) {
+    ::shutdown(socket, SHUT_RDWR);
+    closed = true;
+    reassembly_begin = reassembly_end = 0;
+    if (error < 0 && !handlers.empty()) {
+        auto handler = std::move(handlers.front());
+        handlers.pop_front();
+        handler(error, nullptr);
+    }
+}
+
+void Connection::flush_shared() {
+    auto& ring = shared_memory->outgoing();
+    while (!send_queue.empty()) {
+        auto& pending = send_queue.front();
+        auto result = narrow_cast<int>(pending.source.size());
+        if (closed) {
+            result = -EPIPE;
+        } else if (!ring.try_write(pending.source)) {
+            // The peer wakes this side up once it made room. It may have done so before seeing the flag.
+            ring.set_producer_waiting();
+            if (!ring.try_write(pending.source)) {
+                wait_wakeup();
+                return;
+            }
+        }
+
+        if (result > 0 && ring.take_consumer_waiting()) {
+            shared_memory->notify_peer();
+        }
+
+        // Popped first, the callback may send again.
+        auto* callback = pending.callback.release();
+        send_queue.pop_front();
+        (*callback)(result, std::unique_ptr<CallbackErased>{callback});
+    }
+}
+
+void Connection::dispatch_shared() {
+    auto& ring = shared_memory->incoming();
+    while (!handlers.empty()) {
+        auto message = std::span<const std::byte>{};
+        try {
+            message = ring.front();
+            if (message.empty() && !closed) {
+                // The peer wakes this side up on its next message. It may have sent it before seeing the flag.
+                ring.set_consumer_waiting();
+                message = ring.front();
+                if (message.empty()) {
+                    wait_wakeup();
+                    return;
+                }
+            }
+        } catch (const std::system_error& error) {
+            // Nothing the peer sends can be trusted anymore.
+            fail(-error.code().value());
+            continue;
+        }
+
+        auto handler = std::move(handlers.front());
+        handlers.pop_front();
+
+        // Messages sent before the peer went away are still delivered.
+        if (message.empty()) {
+            handler(0, nullptr);
+            continue;
+        }
+
+        if (message.size() > sizeof(Buffer)) {
+            closed = true;
+            handler(-EMSGSIZE, nullptr);
+            continue;
+        }
+
+        auto size = narrow_cast<int>(message.size());
+        auto buffer = uring.get_callback<Buffer>([](int) {});
+        std::ranges::copy(message, buffer->get_storage().begin());
+        ring.pop();
+        if (ring.take_producer_waiting()) {
+            shared_memory->notify_peer();
+        }
+        handler(size, std::move(buffer));
+    }
+}
+
+void Connection::wait_wakeup() {
+    if (waiting_wakeup) {
+        return;
+    }
+
+    waiting_wakeup = true;
+    auto callback = uring.get_callback([self = shared_from_this()](int ret) { self->woken_up(ret); });
+    uring.read(shared_memory->wakeup_fd(), singular_bytes(wakeup_value), 0, std::move(callback));
+}
+
+void Connection::woken_up(int ret) {
+    waiting_wakeup = false;
+    if (ret < 0) {
+        closed = true;
+    }
+
+    flush_shared();
+    dispatch();
+}
+
+void Connection::watch_peer() {
+    // Nothing is sent on the socket after the handshake, this read only completes once the peer closed it. Until then,
+    // it keeps the connection alive.
+    auto callback = uring.get_callback([self = shared_from_this()](int) {
+        self->closed = true;
+        self->shared_memory->notify_self();
+    });
+    uring.read(socket, singular_bytes(peer_value), 0, std::move(callback));
+}
+
+}  // namespace remotefs
@@ -0,0 +1,203 @@
+#ifndef REMOTE_FS_CONNECTION_H
+#define REMOTE_FS_CONNECTION_H
+
+#include <sys/socket.h>
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <span>
+#include <unordered_map>
+
+#include "SharedMemory.h"
+#include "Socket.h"
+#include "remotefs/tools/Bytes.h"
+#include "remotefs/uring/IoUring.h"
+
+namespace remotefs {
+
+// Exchanges whole messages with a peer, whatever the transport.
+// SCTP keeps message boundaries: a message is sent or received with a single operation.
+// TCP doesn't, so each message is prefixed with its length. Sends are serialized and coalesced into a single sendmsg.
+// Receives go through a reassembly buffer.
+// Shared memory connections exchange messages through rings mapped by both processes. The unix socket is only used to
+// set them up and to notice when the peer goes away. A side sleeps on its eventfd when it waits for messages or free
+// space, the other side only signals it when it asked to.
+// Connections are always owned by a shared_ptr, which the operations in flight keep alive.
+class Connection : public std::enable_shared_from_this<Connection> {
+    // Same size as the biggest callable stored along with a message, the one of receive, which keeps the connection
+    // and the handler alive.
+    struct ReceiveCallable {
+        std::shared_ptr<Connection> self;
+        std::move_only_function<void(int)> handler;
+
+        void operator()(int) {}
+    };
+
+   public:
+    // Leaves room in the registered buffer for the callback owning it.
+    using Buffer = std::array<std::byte, IoUring::MaxPayloadForCallback<ReceiveCallable>()>;
+    using Message = std::unique_ptr<CallbackWithStorageAbstract<Buffer>>;
+    // Called with the size of the message, which starts at the beginning of the buffer. On failure, called with a
+    // negative errno, or 0 once the peer closed the connection, and no buffer.
+    using Handler = std::move_only_function<void(int, Message)>;
+    // Called with the beginning of a large message, which is not entirely received yet, and the size of the message.
+    // Returns a pipe to splice the rest of the message to, or -1 to receive it in a buffer as usual.
+    using Splicer = std::move_only_function<int(std::span<const std::byte>, std::size_t)>;
+
+    // Messages bigger than this are read directly in their own buffer instead of being copied out of the reassembly
+    // buffer.
+    static constexpr auto copy_threshold = 65536;
+
+    // SCTP streams. Messages on different streams don't wait for each other, small metadata replies go on their own
+    // stream so that they overtake bulk data. Streams beyond what was negotiated wrap around, other transports ignore
+    // them.
+    static constexpr std::uint16_t bulk_stream = 0;
+    static constexpr std::uint16_t metadata_stream = 1;
+
+    // Called with the new connection, or with a positive errno and no connection when it couldn't be set up.
+    using Created = std::move_only_function<void(int, std::shared_ptr<Connection>)>;
+
+    // Blocks until the shared memory handshake is done, for shared memory connections.
+    static std::shared_ptr<Connection> create(IoUring& uring, Socket&& socket);
+    // Same as above, but the shared memory handshake completes through the ring, so that a peer that never finishes it
+    // doesn't block the caller. created may be called before this returns.
+    static void create(IoUring& uring, Socket&& socket, Created created);
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Handlers are called in the order they were given, one message each.
+    void receive(Handler handler);
+
+    // Only framed connections splice, the transport must support it. Once the rest of a message was spliced, its
+    // handler is called with the part received before only.
+    void set_splicer(Splicer splicer);
+
+    // source must be in the callback's storage, which must remain untouched until the callback is executed.
+    // Zero copy sends are only supported by TCP. With shared memory, the message is copied to the ring right away, and
+    // the callback executed before this returns unless the ring is full.
+    template <typename Storage>
+    void send(
+        std::span<std::byte> source, std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback,
+        bool zero_copy = false, std::uint16_t stream = bulk_stream
+    );
+
+    template <typename Storage>
+    void send(std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback, std::uint16_t stream = bulk_stream);
+
+    [[nodiscard]] Transport transport() const {
+        return shared_memory ? Transport::shm : framed ? Transport::tcp : Transport::sctp;
+    }
+
+    inline operator int() const {  // NOLINT(google-explicit-constructor)
+        return socket;
+    }
+
+   private:
+    class FramedSend;
+    class StreamSend;
+    class StreamReceive;
+
+    // A message of which SCTP only delivered the first parts.
+    struct PartialMessage {
+        Message message;
+        std::size_t size = 0;
+    };
+
+    struct PendingSend {
+        std::unique_ptr<CallbackErased> callback;
+        std::span<const std::byte> source;
+        bool zero_copy;
+    };
+
+    using Header = std::uint32_t;
+
+    Connection(IoUring& uring, Socket&& socket, std::unique_ptr<SharedMemoryChannel> channel = nullptr);
+
+    void queue_send(std::span<const std::byte> source, std::unique_ptr<CallbackErased> callback, bool zero_copy);
+    void send_on_stream(
+        std::span<const std::byte> source, std::unique_ptr<CallbackErased> callback, std::uint16_t stream
+    );
+    void send_next();
+    void dispatch();
+    void read_more();
+    void read_large(Message message);
+    void splice_large(int pipe, Message message);
+    void received_part(int ret, std::uint16_t stream, bool last, Message message, Handler handler);
+    void received(int ret, Message buffer);
+    void received_large(int ret, Message message);
+    void received_spliced(int ret, int pipe, Message message);
+    void fail(int error);
+    void flush_shared();
+    void dispatch_shared();
+    void wait_wakeup();
+    void woken_up(int ret);
+    void watch_peer();
+
+    IoUring& uring;
+    Socket socket;
+    bool framed = false;
+    // Negotiated with the peer, only SCTP has more than one.
+    std::uint16_t streams = 1;
+    // SCTP default send flags, which are replaced when a message is sent on another stream.
+    std::uint16_t stream_flags = 0;
+    // SCTP may deliver large messages in parts, and parts of messages on other streams in between. Each receive then
+    // gets a part, which is put together with the others of its stream in partial_messages.
+    bool interleaved = false;
+    std::unordered_map<std::uint16_t, PartialMessage> partial_messages;
+
+    std::unique_ptr<SharedMemoryChannel> shared_memory;
+
+    // Everything below is only used by framed and shared memory connections.
+    std::deque<PendingSend> send_queue;
+    bool sending = false;
+
+    std::deque<Handler> handlers;
+    // Owned by the read in flight, if any.
+    Message reassembly;
+    std::size_t reassembly_begin = 0;
+    std::size_t reassembly_end = 0;
+    std::size_t large_size = 0;
+    std::size_t large_filled = 0;
+    Splicer splicer;
+    std::size_t spliced_prefix = 0;  // Part of the message spliced, received before splicing.
+    bool receiving = false;
+    bool dispatching = false;
+    bool closed = false;
+
+    // Only used by shared memory connections, targets of the reads in flight.
+    std::uint64_t wakeup_value = 0;
+    std::byte peer_value{};
+    bool waiting_wakeup = false;
+};
+
+template <typename Storage>
+void Connection::send(
+    std::span<std::byte> source, std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback, bool zero_copy,
+    std::uint16_t stream
+) {
+    assert(callback);
+    if (shared_memory) {
+        queue_send(source, std::move(callback), false);
+    } else if (framed) {
+        queue_send(source, std::move(callback), zero_copy);
+    } else if (zero_copy) {
+        uring.send_zc_fixed(socket, source, std::move(callback));
+    } else if (stream % streams != bulk_stream) {
+        send_on_stream(source, std::move(callback), stream % streams);
+    } else {
+        uring.write_fixed(socket, source, std::move(callback));
+    }
+}
+
+template <typename Storage>
+void Connection::send(std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback, std::uint16_t stream) {
+    auto view = singular_bytes(callback->get_storage());
+    send(view, std::move(callback), false, stream);
+}
+
+}  // namespace remotefs
+
+#endif  // REMOTE_FS_CONNECTION_H
@@ -0,0 +1,247 @@
+#include "SharedMemory.h"
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <system_error>
+
+namespace remotefs {
+
+SharedRing SharedRing::create(std::span<std::byte> region) {
+    assert(region.size() > sizeof(Header));
+    new (region.data()) Header{};
+    return SharedRing{region};
+}
+
+SharedRing::SharedRing(std::span<std::byte> region)
+    : header{std::launder(reinterpret_cast<Header*>(region.data()))},
+      data{region.subspan(sizeof(Header), (region.size() - sizeof(Header)) / alignment * alignment)} {
+    assert(reinterpret_cast<std::uintptr_t>(region.data()) % alignof(Header) == 0);
+}
+
+std::size_t SharedRing::record_size(std::size_t message_size) {
+    return (sizeof(Size) + message_size + alignment - 1) / alignment * alignment;
+}
+
+std::size_t SharedRing::max_message_size() const {
+    // A record that would not fit before the end of the region is written after a wrap marker. When the ring is empty,
+    // the marker and the record together fit if the record is not bigger than half the region.
+    return data.size() / 2 - sizeof(Size);
+}
+
+bool SharedRing::try_write(std::span<const std::byte> message) {
+    assert(!message.empty());
+    assert(message.size() <= max_message_size());
+
+    auto record = record_size(message.size());
+    auto head = header->head.load(std::memory_order_relaxed);
+    auto tail = header->tail.load();
+    auto position = head % data.size();
+    auto contiguous = data.size() - position;
+    auto padding = contiguous < record ? contiguous : 0;
+
+    if (head + padding + record - tail > data.size()) {
+        return false;
+    }
+
+    if (padding > 0) {
+        std::memcpy(&data[position], &wrap_marker, sizeof(Size));
+        head += padding;
+        position = 0;
+    }
+
+    auto size = static_cast<Size>(message.size());
+    std::memcpy(&data[position], &size, sizeof(size));
+    std::memcpy(&data[position + sizeof(Size)], message.data(), message.size());
+    header->head.store(head + record);
+    return true;
+}
+
+std::span<const std::byte> SharedRing::front() {
+    auto tail = header->tail.load(std::memory_order_relaxed);
+    auto head = header->head.load();
+
+    // The peer writes head and the records, it may not be trusted to keep them within the ring.
+    if (head - tail > data.size()) [[unlikely]] {
+        throw std::system_error(EPROTO, std::generic_category(), "Corrupted shared ring");
+    }
+
+    while (tail != head) {
+        auto position = tail % data.size();
+        auto size = Size{};
+        std::memcpy(&size, &data[position], sizeof(size));
+        if (size != wrap_marker) {
+            auto past_end = size > data.size() - position - sizeof(Size) || record_size(size) > head - tail;
+            if (size == 0 || past_end) [[unlikely]] {
+                throw std::system_error(EPROTO, std::generic_category(), "Corrupted shared ring");
+            }
+            return std::span{data}.subspan(position + sizeof(Size), size);
+        }
+
+        tail += data.size() - position;
+        header->tail.store(tail);
+    }
+
+    return {};
+}
+
+void SharedRing::pop() {
+    auto message = front();
+    assert(!message.empty());
+    header->tail.store(header->tail.load(std::memory_order_relaxed) + record_size(message.size()));
+}
+
+// Sequentially consistent, so that either the waiting side sees the new message or free space when it checks again
+// after setting its flag, or the other side sees the flag.
+void SharedRing::set_consumer_waiting() {
+    header->consumer_waiting.store(1);
+}
+
+bool SharedRing::take_consumer_waiting() {
+    return header->consumer_waiting.load() != 0 && header->consumer_waiting.exchange(0) != 0;
+}
+
+void SharedRing::set_producer_waiting() {
+    header->producer_waiting.store(1);
+}
+
+bool SharedRing::take_producer_waiting() {
+    return header->producer_waiting.load() != 0 && header->producer_waiting.exchange(0) != 0;
+}
+
+namespace {
+void send_fds(int socket, std::array<int, 2> fds) {
+    auto payload = std::byte{};
+    auto iov = iovec{.iov_base = &payload, .iov_len = sizeof(payload)};
+    alignas(cmsghdr) auto control = std::array<char, CMSG_SPACE(sizeof(fds))>{};
+    auto message = msghdr{.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.data(),
+                          .msg_controllen = control.size()};
+    auto* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(fds));
+
+    if (::sendmsg(socket, &message, MSG_NOSIGNAL) < 0) {
+        throw std::system_error(errno, std::system_category(), "Failed to send shared memory descriptors");
+    }
+}
+
+// Closes the descriptors only used during the handshake.
+struct FdCloser {
+    int fd;
+
+    ~FdCloser() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+};
+}  // namespace
+
+SharedMemoryChannel::Handshake::Handshake()
+    : iov{.iov_base = &payload, .iov_len = sizeof(payload)},
+      header{.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.data(), .msg_controllen = control.size()} {}
+
+SharedMemoryChannel::SharedMemoryChannel(int socket, std::size_t ring_size)
+    : SharedMemoryChannel{socket, std::nullopt, ring_size} {
+    auto handshake = Handshake{};
+    auto ret = ::recvmsg(socket, handshake.message(), MSG_CMSG_CLOEXEC);
+    // Once the delegated constructor returned, the destructor releases everything if this throws.
+    complete(handshake, ret < 0 ? -errno : ret);
+}
+
+SharedMemoryChannel::SharedMemoryChannel(int socket, std::nullopt_t, std::size_t ring_size) {
+    try {
+        own_eventfd = ::eventfd(0, EFD_CLOEXEC);
+        if (own_eventfd < 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to create eventfd");
+        }
+
+        auto memory = FdCloser{::memfd_create("remotefs", MFD_CLOEXEC)};
+        if (memory.fd < 0 || ::ftruncate(memory.fd, static_cast<off_t>(ring_size)) < 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to create shared memory");
+        }
+        outgoing_region = map(memory.fd, ring_size);
+        outgoing_ring = SharedRing::create(outgoing_region);
+        send_fds(socket, {memory.fd, own_eventfd});
+    } catch (...) {
+        release();
+        throw;
+    }
+}
+
+void SharedMemoryChannel::complete(const Handshake& handshake, long received) {
+    if (received < 0) {
+        throw std::system_error(
+            static_cast<int>(-received), std::system_category(), "Failed to receive shared memory descriptors"
+        );
+    } else if (received == 0) {
+        throw std::system_error(ECONNRESET, std::system_category(), "Peer closed before sharing memory");
+    }
+
+    const auto* cmsg = CMSG_FIRSTHDR(&handshake.header);
+    auto fds = std::array<int, 2>{};
+    if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        throw std::system_error(EPROTO, std::system_category(), "Unexpected shared memory handshake");
+    }
+    std::memcpy(fds.data(), CMSG_DATA(cmsg), sizeof(fds));
+
+    auto memory = FdCloser{fds[0]};
+    peer_eventfd = fds[1];
+    struct stat status {};
+    if (::fstat(memory.fd, &status) < 0) {
+        throw std::system_error(errno, std::system_category(), "Failed to get shared memory size");
+    }
+    if (static_cast<std::size_t>(status.st_size) <= sizeof(SharedRing::Header)) {
+        throw std::system_error(EPROTO, std::system_category(), "Shared memory too small");
+    }
+    incoming_region = map(memory.fd, static_cast<std::size_t>(status.st_size));
+    incoming_ring = SharedRing{incoming_region};
+}
+
+SharedMemoryChannel::~SharedMemoryChannel() {
+    release();
+}
+
+void SharedMemoryChannel::release() {
+    if (!outgoing_region.empty()) {
+        ::munmap(outgoing_region.data(), outgoing_region.size());
+    }
+    if (!incoming_region.empty()) {
+        ::munmap(incoming_region.data(), incoming_region.size());
+    }
+    if (own_eventfd >= 0) {
+        ::close(own_eventfd);
+    }
+    if (peer_eventfd >= 0) {
+        ::close(peer_eventfd);
+    }
+}
+
+std::span<std::byte> SharedMemoryChannel::map(int fd, std::size_t size) {
+    auto* address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (address == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(), "Failed to map shared memory");
+    }
+    return {static_cast<std::byte*>(address), size};
+}
+
+void SharedMemoryChannel::notify_peer() const {
+    ::eventfd_write(peer_eventfd, 1);
+}
+
+void SharedMemoryChannel::notify_self() const {
+    ::eventfd_write(own_eventfd, 1);
+}
+
+}  // namespace remotefs
@@ -0,0 +1,133 @@
+#ifndef REMOTE_FS_SHAREDMEMORY_H
+#define REMOTE_FS_SHAREDMEMORY_H
+
+#include <sys/socket.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+
+namespace remotefs {
+
+// Single producer, single consumer queue of messages, in a memory region that may be shared between processes.
+// Messages are never split. One that doesn't fit before the end of the region is preceded by a wrap marker and written
+// at the beginning instead.
+class SharedRing {
+   public:
+    struct Header {
+        alignas(64) std::atomic<std::uint64_t> head;  // Bytes ever written, only modified by the producer.
+        alignas(64) std::atomic<std::uint64_t> tail;  // Bytes ever consumed, only modified by the consumer.
+        // Set by a side before it goes to sleep, the other side wakes it up when it finds it set.
+        alignas(64) std::atomic<std::uint32_t> consumer_waiting;
+        std::atomic<std::uint32_t> producer_waiting;
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+    static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+    // Constructs an empty ring over region. Only one side must do it, before sharing the region.
+    static SharedRing create(std::span<std::byte> region);
+    SharedRing() = default;
+    // Attaches to a ring created by the other side.
+    explicit SharedRing(std::span<std::byte> region);
+
+    // Returns false when the ring is full.
+    [[nodiscard]] bool try_write(std::span<const std::byte> message);
+
+    // The oldest message, or an empty span. It stays valid until pop. Throws std::system_error if the producer wrote
+    // past the ring.
+    [[nodiscard]] std::span<const std::byte> front();
+    void pop();
+
+    void set_consumer_waiting();
+    [[nodiscard]] bool take_consumer_waiting();
+    void set_producer_waiting();
+    [[nodiscard]] bool take_producer_waiting();
+
+    // Any message up to this size eventually fits, once the consumer caught up.
+    [[nodiscard]] std::size_t max_message_size() const;
+
+   private:
+    using Size = std::uint32_t;
+    static constexpr auto wrap_marker = std::numeric_limits<Size>::max();
+    static constexpr auto alignment = 8ul;
+
+    static std::size_t record_size(std::size_t message_size);
+
+    Header* header = nullptr;
+    std::span<std::byte> data;
+};
+
+// Two rings, one per direction, and an eventfd per side to wake it up. Each side creates the ring it writes to and its
+// eventfd, and passes them to the other side over a unix socket.
+class SharedMemoryChannel {
+   public:
+    static constexpr std::size_t ring_size_default = 32 * 1024 * 1024;
+
+    // Receives the ring and the eventfd of the peer. Must stay in place while the message is being received.
+    class Handshake {
+       public:
+        Handshake();
+        Handshake(const Handshake&) = delete;
+        Handshake& operator=(const Handshake&) = delete;
+
+        msghdr* message() {
+            return &header;
+        }
+
+       private:
+        friend class SharedMemoryChannel;
+
+        std::byte payload{};
+        iovec iov{};
+        alignas(cmsghdr) std::array<char, CMSG_SPACE(2 * sizeof(int))> control{};
+        msghdr header{};
+    };
+
+    // Blocks until the peer did the same.
+    explicit SharedMemoryChannel(int socket, std::size_t ring_size = ring_size_default);
+    // Only sends this side's ring and eventfd. The channel is usable once complete is called with the peer's, received
+    // with Handshake::message.
+    SharedMemoryChannel(int socket, std::nullopt_t, std::size_t ring_size = ring_size_default);
+    SharedMemoryChannel(const SharedMemoryChannel&) = delete;
+    SharedMemoryChannel& operator=(const SharedMemoryChannel&) = delete;
+    ~SharedMemoryChannel();
+
+    SharedRing& outgoing() {
+        return outgoing_ring;
+    }
+
+    SharedRing& incoming() {
+        return incoming_ring;
+    }
+
+    // Readable once the peer called notify_peer.
+    [[nodiscard]] int wakeup_fd() const {
+        return own_eventfd;
+    }
+
+    void notify_peer() const;
+    void notify_self() const;
+
+    // received is the result of the recvmsg of the handshake. Throws when it failed or didn't carry the peer's half.
+    void complete(const Handshake& handshake, long received);
+
+   private:
+    static std::span<std::byte> map(int fd, std::size_t size);
+    void release();
+
+    int own_eventfd = -1;
+    int peer_eventfd = -1;
+    std::span<std::byte> outgoing_region;
+    std::span<std::byte> incoming_region;
+    SharedRing outgoing_ring;
+    SharedRing incoming_ring;
+};
+
+}  // namespace remotefs
+
+#endif  // REMOTE_FS_SHAREDMEMORY_H
@@ -2,19 +2,22 @@
 
 #include <netdb.h>
 #include <netinet/sctp.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <memory>
+#include <stdexcept>
 #include <system_error>
 #include <ztd/out_ptr/out_ptr.hpp>
 
 namespace {
-auto getaddrinfo(const char* address, int port, bool passive) {
+auto getaddrinfo(const char* address, int port, bool passive, remotefs::Transport transport) {
     auto results = std::unique_ptr<addrinfo, decltype(&freeaddrinfo)>{nullptr, &freeaddrinfo};
     auto hosthints = addrinfo{.ai_flags = passive ? AI_PASSIVE : 0,
                               .ai_family = AF_INET,
                               .ai_socktype = SOCK_STREAM,
-                              .ai_protocol = IPPROTO_SCTP};
+                              .ai_protocol = transport == remotefs::Transport::tcp ? IPPROTO_TCP : IPPROTO_SCTP};
     auto port_string = std::to_string(port);
 
     class GetAddrInfoErrorCategory : public std::error_category {
@@ -32,9 +35,35 @@ auto getaddrinfo(const char* address, int port, bool passive) {
 
     return results;
 }
+
+constexpr auto ipc_prefix = std::string_view{"ipc://"};
+
+auto unix_address(std::string_view address) {
+    auto path = address.substr(ipc_prefix.size());
+    auto result = sockaddr_un{.sun_family = AF_UNIX};
+    if (path.empty() || path.size() >= sizeof(result.sun_path)) {
+        throw std::invalid_argument("Invalid ipc path: " + std::string{path});
+    }
+    path.copy(result.sun_path, path.size());
+    return result;
+}
 }  // namespace
 
 namespace remotefs {
+Transport transport_from_string(std::string_view name) {
+    if (name == "sctp") {
+        return Transport::sctp;
+    }
+    if (name == "tcp") {
+        return Transport::tcp;
+    }
+    throw std::invalid_argument("Unknown transport: " + std::string{name});
+}
+
+bool is_ipc_address(std::string_view address) {
+    return address.starts_with(ipc_prefix);
+}
+
 Socket::Socket(int s)
     : socket{s} {}
 
@@ -56,8 +85,55 @@ Socket::~Socket() {
     socket = -1;
 }
 
+Transport Socket::transport() const {
+    auto domain = 0;
+    socklen_t domain_size = sizeof(domain);
+    if (getsockopt(socket, SOL_SOCKET, SO_DOMAIN, &domain, &domain_size) != 0) {
+        throw std::system_error(errno, std::system_category(), "Failed to get socket domain");
+    }
+    if (domain == AF_UNIX) {
+        return Transport::shm;
+    }
+
+    auto protocol = 0;
+    socklen_t protocol_size = sizeof(protocol);
+    if (getsockopt(socket, SOL_SOCKET, SO_PROTOCOL, &protocol, &protocol_size) != 0) {
+        throw std::system_error(errno, std::system_category(), "Failed to get socket protocol");
+    }
+
+    switch (protocol) {
+        case IPPROTO_SCTP:
+            return Transport::sctp;
+        case IPPROTO_TCP:
+            return Transport::tcp;
+        default:
+            throw std::logic_error("Unsupported socket protocol");
+    }
+}
+
+bool Socket::supports_zero_copy() const {
+    return transport() == Transport::tcp;
+}
+
+Socket Socket::unix_socket() {
+    auto socket = Socket{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (socket < 0) {
+        throw std::system_error(errno, std::system_category(), "Failed to configure socket");
+    }
+    return socket;
+}
+
 Socket Socket::connect(const std::string& address, int port, const Options& options) {
-    auto hostinfo = getaddrinfo(address.c_str(), port, false);
+    if (is_ipc_address(address)) {
+        auto socket = unix_socket();
+        auto unix = unix_address(address);
+        if (::connect(socket, reinterpret_cast<sockaddr*>(&unix), sizeof(unix)) < 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to connect socket");
+        }
+        return socket;
+    }
+
+    auto hostinfo = getaddrinfo(address.c_str(), port, false, options.transport);
 
     auto socket = Socket{::socket(hostinfo->ai_family, hostinfo->ai_socktype, hostinfo->ai_protocol)};
     if (socket < 0) {
@@ -74,7 +150,21 @@ Socket Socket::connect(const std::string& address, int port, const Options& opti
 }
 
 Socket Socket::listen(const std::string& address, int port, const Options& options) {
-    auto hostinfo = getaddrinfo(address.c_str(), port, true);
+    if (is_ipc_address(address)) {
+        auto socket = unix_socket();
+        auto unix = unix_address(address);
+        // Left behind by a previous server, binding would fail otherwise.
+        ::unlink(unix.sun_path);
+        if (::bind(socket, reinterpret_cast<sockaddr*>(&unix), sizeof(unix)) < 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to bind socket");
+        }
+        if (::listen(socket, 10) < 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to listen to socket");
+        }
+        return socket;
+    }
+
+    auto hostinfo = getaddrinfo(address.c_str(), port, true, options.transport);
     auto socket = Socket{::socket(hostinfo->ai_family, hostinfo->ai_socktype, hostinfo->ai_protocol)};
     if (socket < 0) {
         throw std::system_error(errno, std::system_category(), "Failed to configure socket");
@@ -102,6 +192,28 @@ Socket Socket::listen(const std::string& address, int port, const Options& optio
 }
 
 void Socket::configure(const Options& options) {
+    if (options.rx_buffer_size) {
+        if (setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &options.rx_buffer_size.value(),
+                       sizeof(options.rx_buffer_size))) {
+            throw std::system_error(errno, std::system_category(), "Failed to set receive buffer size");
+        }
+    }
+    if (options.tx_buffer_size) {
+        if (setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &options.tx_buffer_size.value(),
+                       sizeof(options.tx_buffer_size))) {
+            throw std::system_error(errno, std::system_category(), "Failed to set transmit buffer size");
+        }
+    }
+
+    if (options.transport == Transport::tcp) {
+        // Message boundaries, streams, delivery point and fragmentation are SCTP concepts.
+        int nodelay_int = options.nodelay ? 1 : 0;
+        if (setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &nodelay_int, (socklen_t)sizeof(nodelay_int)) != 0) {
+            throw std::system_error(errno, std::system_category(), "Failed to disable nagle's algorithm");
+        }
+        return;
+    }
+
     struct sctp_initmsg initmsg {
         .sinit_num_ostreams = options.max_streams, .sinit_max_instreams = options.max_streams,
     };
@@ -109,6 +221,44 @@ void Socket::configure(const Options& options) {
         throw std::system_error(errno, std::system_category(), "Failed to configure sctp init message");
     }
 
+    if (options.max_streams > 1) {
+        // By default, the streams are served in order. Serve them in turn instead, so that a small message doesn't
+        // wait behind all the large ones queued on another stream.
+        auto scheduler = sctp_assoc_value{.assoc_id = 0, .assoc_value = SCTP_SS_RR};
+        if (setsockopt(socket, IPPROTO_SCTP, SCTP_STREAM_SCHEDULER, &scheduler, sizeof(scheduler))) {
+            throw std::system_error(errno, std::system_category(), "Failed to set stream scheduler");
+        }
+    }
+
+    if (options.max_streams > 1 && options.interleave) {
+        // A message is still sent whole before the next one starts. Chunks of different messages can only be
+        // interleaved with I-DATA (RFC 8260), which requires the fragment interleave level 2. Messages are then
+        // received in parts, see Connection.
+        int interleave_level = 2;
+        if (setsockopt(socket, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &interleave_level, sizeof(interleave_level))) {
+            throw std::system_error(errno, std::system_category(), "Failed to set fragment interleave level");
+        }
+        auto interleaving = sctp_assoc_value{.assoc_id = 0, .assoc_value = 1};
+        if (setsockopt(socket, IPPROTO_SCTP, SCTP_INTERLEAVING_SUPPORTED, &interleaving, sizeof(interleaving))) {
+            // EPERM unless net.sctp.intl_enable=1, ENOPROTOOPT on kernels older than 4.17.
+            if (errno != EPERM && errno != ENOPROTOOPT) {
+                throw std::system_error(errno, std::system_category(), "Failed to enable message interleaving");
+            }
+            interleave_level = 0;
+            if (setsockopt(
+                    socket, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &interleave_level, sizeof(interleave_level)
+                )) {
+                throw std::system_error(errno, std::system_category(), "Failed to reset fragment interleave level");
+            }
+        } else {
+            // The stream of each part tells which message it belongs to.
+            int receive_info = 1;
+            if (setsockopt(socket, IPPROTO_SCTP, SCTP_RECVRCVINFO, &receive_info, sizeof(receive_info))) {
+                throw std::system_error(errno, std::system_category(), "Failed to enable SCTP receive information");
+            }
+        }
+    }
+
     auto sctp_flags = sctp_sndrcvinfo{};
     socklen_t sctp_flags_size = sizeof(sctp_flags);
     if (getsockopt(socket, IPPROTO_SCTP, SCTP_DEFAULT_SEND_PARAM, &sctp_flags, &sctp_flags_size) != 0) {
@@ -139,19 +289,6 @@ void Socket::configure(const Options& options) {
     if (setsockopt(socket, IPPROTO_SCTP, SCTP_MAXSEG, &fragment_size_kernel, sizeof(fragment_size_kernel))) {
         throw std::system_error(errno, std::system_category(), "Failed to set fragment size");
     }
-
-    if (options.rx_buffer_size) {
-        if (setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &options.rx_buffer_size.value(),
-                       sizeof(options.rx_buffer_size))) {
-            throw std::system_error(errno, std::system_category(), "Failed to set receive buffer size");
-        }
-    }
-    if (options.tx_buffer_size) {
-        if (setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &options.tx_buffer_size.value(),
-                       sizeof(options.tx_buffer_size))) {
-            throw std::system_error(errno, std::system_category(), "Failed to set transmit buffer size");
-        }
-    }
     if (setsockopt(socket, IPPROTO_SCTP, SCTP_PARTIAL_DELIVERY_POINT, &options.delivery_point,
                    sizeof(options.delivery_point))) {
         throw std::system_error(errno, std::system_category(), "Failed to set delivery point");
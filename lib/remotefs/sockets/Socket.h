@@ -5,8 +5,21 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
 
 namespace remotefs {
+enum class Transport {
+    sctp,
+    tcp,
+    shm,  // Same host only, selected by an ipc:// address.
+};
+
+// Accepts "sctp" and "tcp".
+Transport transport_from_string(std::string_view name);
+
+// ipc://path addresses designate a unix socket, over which a shared memory connection is set up. The port is ignored.
+bool is_ipc_address(std::string_view address);
+
 namespace detail {
 struct Options {
     std::optional<long> rx_buffer_size = {};
@@ -17,6 +30,10 @@ struct Options {
     bool ordered = false;
     bool nodelay = true;
     bool nofragment = true;
+    Transport transport = Transport::sctp;
+    // Interleave the parts of large SCTP messages with the messages of other streams, with I-DATA. Needs
+    // net.sctp.intl_enable=1 on both sides, it is silently left off otherwise.
+    bool interleave = false;
 };
 }  // namespace detail
 
@@ -34,11 +51,18 @@ class Socket {
     static Socket connect(const std::string& address, int port, const Options& options = {});
     static Socket listen(const std::string& address, int port, const Options& options = {});
 
+    [[nodiscard]] Transport transport() const;
+
+    // Whether MSG_ZEROCOPY and IORING_OP_SEND_ZC are supported. SCTP doesn't implement them, shared memory doesn't need
+    // them.
+    [[nodiscard]] bool supports_zero_copy() const;
+
     inline operator int() const {  // NOLINT(google-explicit-constructor)
         return socket;
     }
 
    private:
+    static Socket unix_socket();
     void configure(const Options& options);
     int socket = -1;
 };
@@ -0,0 +1,111 @@
+#ifndef REMOTE_FS_REQUESTTABLE_H
+#define REMOTE_FS_REQUESTTABLE_H
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace remotefs {
+
+// Maps the compact ids sent over the network to the requests in flight. An id is the index of a slot in its low bits
+// and the slot's generation in its high bits: a reply to a request already answered, or to an older occupant of the
+// slot, doesn't match anything.
+template <typename Request>
+class RequestTable {
+   public:
+    using Id = std::uint32_t;
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr auto index_bits = 20;
+    static constexpr Id max_in_flight = Id{1} << index_bits;
+
+    struct Entry {
+        Request request;
+        Clock::time_point issued;
+    };
+
+    // Throws std::length_error if max_in_flight requests are already in flight.
+    Id insert(Request request, Clock::time_point issued = Clock::now()) {
+        auto index = Id{};
+        if (!free_slots.empty()) {
+            index = free_slots.back();
+            free_slots.pop_back();
+        } else if (slots.size() < max_in_flight) {
+            index = static_cast<Id>(slots.size());
+            slots.emplace_back();
+        } else {
+            throw std::length_error("Too many requests in flight");
+        }
+
+        auto& slot = slots[index];
+        assert(!slot.entry);
+        slot.entry = Entry{std::move(request), issued};
+        in_flight++;
+        return slot.generation << index_bits | index;
+    }
+
+    // Null if id is not in flight.
+    Entry* find(Id id) {
+        auto* slot = slot_of(id);
+        return slot != nullptr ? &*slot->entry : nullptr;
+    }
+
+    // Removes the request, its slot is reused with the next generation. Empty if id is not in flight.
+    std::optional<Entry> take(Id id) {
+        auto* slot = slot_of(id);
+        if (slot == nullptr) {
+            return std::nullopt;
+        }
+
+        auto entry = std::move(slot->entry);
+        slot->entry.reset();
+        slot->generation = (slot->generation + 1) & generation_mask;
+        free_slots.push_back(id & index_mask);
+        in_flight--;
+        return entry;
+    }
+
+    // Calls handler with the id and the entry of each request in flight. handler must not insert or take requests.
+    template <typename Handler>
+    void for_each(Handler&& handler) {
+        for (auto index = Id{}; index < slots.size(); index++) {
+            if (auto& slot = slots[index]; slot.entry) {
+                handler(slot.generation << index_bits | index, *slot.entry);
+            }
+        }
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return in_flight;
+    }
+
+   private:
+    static constexpr Id index_mask = max_in_flight - 1;
+    static constexpr Id generation_mask = (Id{1} << (32 - index_bits)) - 1;
+
+    struct Slot {
+        Id generation = 0;
+        std::optional<Entry> entry;
+    };
+
+    Slot* slot_of(Id id) {
+        auto index = id & index_mask;
+        if (index >= slots.size()) {
+            return nullptr;
+        }
+
+        auto& slot = slots[index];
+        return slot.entry && slot.generation == id >> index_bits ? &slot : nullptr;
+    }
+
+    std::vector<Slot> slots;
+    std::vector<Id> free_slots;
+    std::size_t in_flight = 0;
+};
+
+}  // namespace remotefs
+
+#endif  // REMOTE_FS_REQUESTTABLE_H
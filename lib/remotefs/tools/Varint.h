@@ -0,0 +1,53 @@
+#ifndef REMOTE_FS_VARINT_H
+#define REMOTE_FS_VARINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace remotefs {
+
+// LEB128: seven bits per byte, least significant first, the high bit set on every byte but the last.
+inline constexpr std::size_t max_varint_size = 10;
+
+// out must have room for max_varint_size bytes. Returns the number of bytes written.
+constexpr std::size_t write_varint(std::byte* out, std::uint64_t value) {
+    auto written = 0ul;
+    while (value >= 0x80) {
+        out[written++] = static_cast<std::byte>(value | 0x80);
+        value >>= 7;
+    }
+    out[written++] = static_cast<std::byte>(value);
+    return written;
+}
+
+// Consumes the varint at the start of in. Empty if in ends before it does, or if it doesn't fit in 64 bits.
+constexpr std::optional<std::uint64_t> read_varint(std::span<const std::byte>& in) {
+    auto value = std::uint64_t{};
+    for (auto i = 0ul; i < in.size() && i < max_varint_size; i++) {
+        auto byte = std::to_integer<std::uint64_t>(in[i]);
+        if (i == max_varint_size - 1 && byte > 1) {
+            return std::nullopt;
+        }
+        value |= (byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            in = in.subspan(i + 1);
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+// Maps signed values to unsigned ones so that small negative values stay short: 0, -1, 1, -2... become 0, 1, 2, 3...
+constexpr std::uint64_t zigzag_encode(std::int64_t value) {
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+constexpr std::int64_t zigzag_decode(std::uint64_t value) {
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+}  // namespace remotefs
+
+#endif  // REMOTE_FS_VARINT_H
@@ -0,0 +1,39 @@
+#include "remotefs/uring/AdaptiveBatching.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace remotefs {
+namespace {
+// Weight of the last iteration in the smoothed arrival rate.
+constexpr auto smoothing = 0.125;
+}  // namespace
+
+AdaptiveBatching::AdaptiveBatching(
+    std::chrono::nanoseconds latency_budget, std::chrono::nanoseconds idle_timeout, int max_batch_size
+)
+    : latency_budget{latency_budget},
+      idle_timeout{idle_timeout},
+      max_batch_size{max_batch_size} {
+    assert(latency_budget.count() > 0);
+    assert(idle_timeout >= latency_budget);
+    assert(max_batch_size > 0);
+}
+
+void AdaptiveBatching::update(unsigned completed, std::chrono::nanoseconds elapsed) {
+    auto period = static_cast<double>(std::max(elapsed, std::chrono::nanoseconds{1}).count());
+    arrival_rate += (completed / period - arrival_rate) * smoothing;
+
+    auto expected = arrival_rate * static_cast<double>(latency_budget.count());
+    auto target = static_cast<int>(std::clamp(expected, 1.0, static_cast<double>(max_batch_size)));
+
+    if (completed < static_cast<unsigned>(current_batch_size)) {
+        // The wait timed out. The load dropped faster than the average follows, stop waiting for completions that
+        // are not coming.
+        target = std::min(target, std::max(1, static_cast<int>(completed)));
+    }
+
+    current_batch_size = target;
+}
+
+}  // namespace remotefs
@@ -0,0 +1,43 @@
+#ifndef REMOTE_FS_ADAPTIVEBATCHING_H
+#define REMOTE_FS_ADAPTIVEBATCHING_H
+
+#include <chrono>
+
+namespace remotefs {
+
+// Tunes how many completions IoUring::queue_wait waits for, and for how long, from the completion rate observed in the
+// previous iterations. An idle ring wakes up on the first completion, a busy one batches as many completions as are
+// expected to arrive within the latency budget.
+class AdaptiveBatching {
+   public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr auto latency_budget_default = std::chrono::microseconds{50};
+    static constexpr auto idle_timeout_default = std::chrono::seconds{1};
+    static constexpr auto max_batch_size_default = 256;
+
+    explicit AdaptiveBatching(
+        std::chrono::nanoseconds latency_budget = latency_budget_default,
+        std::chrono::nanoseconds idle_timeout = idle_timeout_default, int max_batch_size = max_batch_size_default
+    );
+
+    [[nodiscard]] int batch_size() const {
+        return current_batch_size;
+    }
+
+    [[nodiscard]] std::chrono::nanoseconds timeout() const {
+        return current_batch_size > 1 ? latency_budget : idle_timeout;
+    }
+
+    void update(unsigned completed, std::chrono::nanoseconds elapsed);
+
+   private:
+    std::chrono::nanoseconds latency_budget;
+    std::chrono::nanoseconds idle_timeout;
+    int max_batch_size;
+    double arrival_rate = 0;  // Completions per nanosecond, exponentially smoothed.
+    int current_batch_size = 1;
+};
+
+}  // namespace remotefs
+
+#endif  // REMOTE_FS_ADAPTIVEBATCHING_H
@@ -1,6 +1,8 @@
 #ifndef REMOTE_FS_CALLBACKS_H
 #define REMOTE_FS_CALLBACKS_H
 
+#include <liburing.h>
+
 #include <iostream>
 #include <memory>
 
@@ -8,6 +10,7 @@
 
 namespace remotefs {
 class IoUring;
+class Connection;
 
 static constexpr auto buffers_alignment = 8;
 static constexpr auto buffers_size = 2097152;
@@ -27,8 +30,13 @@ class CallbackErased {
 
    private:
     friend IoUring;
+    friend Connection;
     virtual void operator()(int res) = 0;
     virtual void operator()(int res, std::unique_ptr<CallbackErased>) = 0;
+
+    // Used by IoUring to stage the operation when the submission queue is full.
+    io_uring_sqe pending_sqe;
+    CallbackErased* pending_next = nullptr;
 };
 
 template <typename Storage>
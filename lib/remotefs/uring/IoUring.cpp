@@ -1,15 +1,19 @@
 #include "remotefs/uring/IoUring.h"
 
+#include <fcntl.h>
+
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <utility>
 
 thread_local remotefs::CachedRegisteredBuffersResource<remotefs::buffers_size> pool_per_thread{};
 
 namespace remotefs {
 
-IoUring::IoUring(int queue_depth, int registered_buffers)
+IoUring::IoUring(int queue_depth, int registered_buffers, unsigned setup_flags)
     : registered_buffers{registered_buffers} {
-    if (auto ret = io_uring_queue_init(queue_depth, &ring, 0); ret < 0) {
+    if (auto ret = io_uring_queue_init(queue_depth, &ring, setup_flags); ret < 0) {
         throw std::system_error(-ret, std::generic_category(), "Queue initialization");
     }
 
@@ -27,6 +31,7 @@ void IoUring::start() {
 }
 
 IoUring::~IoUring() {
+    free_pending();
     if (ring.ring_fd != 0) {
         io_uring_queue_exit(&ring);
     }
@@ -37,27 +42,43 @@ IoUring::IoUring(IoUring&& source) noexcept {
     ring = source.ring;
     source.ring = {};
     to_clean_on_submit = std::move(source.to_clean_on_submit);
+    pending_head = std::exchange(source.pending_head, nullptr);
+    pending_tail = std::exchange(source.pending_tail, nullptr);
+    pending_count = std::exchange(source.pending_count, 0);
+    overload_stats = std::exchange(source.overload_stats, {});
     registered_buffers = source.registered_buffers;
 }
 
 IoUring& IoUring::operator=(IoUring&& source) noexcept {
     assert(this != &source);
+    free_pending();
+    if (ring.ring_fd != 0) {
+        io_uring_queue_exit(&ring);
+    }
     ring = source.ring;
     source.ring = {};
     to_clean_on_submit = std::move(source.to_clean_on_submit);
+    pending_head = std::exchange(source.pending_head, nullptr);
+    pending_tail = std::exchange(source.pending_tail, nullptr);
+    pending_count = std::exchange(source.pending_count, 0);
+    overload_stats = std::exchange(source.overload_stats, {});
     registered_buffers = source.registered_buffers;
     return *this;
 }
 
 unsigned IoUring::queue_wait(int min_batch_size, std::chrono::nanoseconds wait_timeout) {
-    assert(min_batch_size <= max_wait_min_batch_size);
-    auto cqes = std::array<io_uring_cqe*, max_wait_min_batch_size>{};
+    assert(min_batch_size > 0);
+    flush_pending();
+
+    // Only the first completion is returned through this pointer, the others are reaped by the loop below.
+    io_uring_cqe* first_cqe = nullptr;
     auto seconds = floor<std::chrono::seconds>(wait_timeout);
     auto timeout = __kernel_timespec{seconds.count(), (wait_timeout - seconds).count()};
-    if (int ret = io_uring_submit_and_wait_timeout(&ring, cqes.data(), min_batch_size, &timeout, nullptr);
-        ret == -ETIME || ret == -EINTR) [[unlikely]] {
+    // On -ETIME, fewer than min_batch_size completions are ready. They are still reaped.
+    if (int ret = io_uring_submit_and_wait_timeout(&ring, &first_cqe, min_batch_size, &timeout, nullptr);
+        ret == -EINTR) [[unlikely]] {
         return 0;
-    } else if (ret < 0) [[unlikely]] {
+    } else if (ret < 0 && ret != -ETIME) [[unlikely]] {
         throw std::system_error(-ret, std::generic_category(), "io_uring_submit_and_wait_timeout failed");
     }
 
@@ -72,12 +93,13 @@ unsigned IoUring::queue_wait(int min_batch_size, std::chrono::nanoseconds wait_t
         ++completed;
         auto callback = static_cast<CallbackErased*>(io_uring_cqe_get_data(cqe));
 
-        // IORING_CQE_F_NOTIF is used by zero copy requests to indicate the buffer can now be freed. See io_uring_enter.
-        // For these requests, the initial callback shouldn't destroy or modify the buffer.
-        // Zero copy is not compatible with SCTP and is therefore not used for the moment.
-        assert(!(cqe->flags & IORING_CQE_F_NOTIF));
+        // Zero copy sends complete in two steps. The first CQE carries the result and IORING_CQE_F_MORE, the callback
+        // is executed but must leave the buffer alone. IORING_CQE_F_NOTIF then indicates the buffer can be freed.
+        // See io_uring_enter.
         if (callback != nullptr) {
-            if (cqe->flags & IORING_CQE_F_MORE) {
+            if (cqe->flags & IORING_CQE_F_NOTIF) {
+                std::unique_ptr<CallbackErased>{callback};
+            } else if (cqe->flags & IORING_CQE_F_MORE) {
                 // There will be more data associated to this SQE, the callback should not be freed.
                 (*callback)(cqe->res);
             } else {
@@ -91,6 +113,48 @@ unsigned IoUring::queue_wait(int min_batch_size, std::chrono::nanoseconds wait_t
     return completed;
 }
 
+unsigned IoUring::queue_wait(AdaptiveBatching& batching) {
+    auto start = AdaptiveBatching::Clock::now();
+    auto completed = queue_wait(batching.batch_size(), batching.timeout());
+    batching.update(completed, AdaptiveBatching::Clock::now() - start);
+    return completed;
+}
+
+IoUring::OverloadStats IoUring::take_overload_stats() {
+    return std::exchange(overload_stats, {});
+}
+
+void IoUring::flush_pending() {
+    while (pending_head != nullptr) {
+        auto* sqe = io_uring_get_sqe(&ring);
+        if (sqe == nullptr) {
+            // Submitting fails while the completion queue is overflowing. Completions are reaped first in that case,
+            // the rest is retried on the next call.
+            if (io_uring_submit(&ring) <= 0) {
+                return;
+            }
+            continue;
+        }
+
+        auto* callback = std::exchange(pending_head, pending_head->pending_next);
+        callback->pending_next = nullptr;
+        pending_count--;
+        *sqe = callback->pending_sqe;
+        if (sqe->user_data == 0) {
+            to_clean_on_submit.push_front(std::unique_ptr<CallbackErased>{callback});
+        }
+    }
+    pending_tail = nullptr;
+}
+
+void IoUring::free_pending() {
+    while (pending_head != nullptr) {
+        std::unique_ptr<CallbackErased>{std::exchange(pending_head, pending_head->pending_next)};
+    }
+    pending_tail = nullptr;
+    pending_count = 0;
+}
+
 void IoUring::register_ring() {
     if (auto ret = io_uring_register_ring_fd(&ring); ret < 0) {
         throw std::system_error(-ret, std::generic_category(), "Failed to register queue fd");
@@ -133,31 +197,40 @@ io_uring_sqe* IoUring::get_sqe(std::unique_ptr<CallbackErased> callable) {
 
     auto callable_ptr = callable.release();
 
-    if (auto* sqe = io_uring_get_sqe(&ring); sqe != nullptr) [[likely]] {
-        if (dynamic_cast<details::CallbackNop*>(callable_ptr)) {
-            to_clean_on_submit.push_front(std::unique_ptr<CallbackErased>{callable_ptr});
-            // Explicitly setting nullptr is not necessary
-            io_uring_sqe_set_data(sqe, nullptr);
-        } else {
-            io_uring_sqe_set_data(sqe, callable_ptr);
-        }
-        return sqe;
+    // Never bypass operations already waiting, that would reorder them.
+    auto* sqe = pending_head == nullptr ? io_uring_get_sqe(&ring) : nullptr;
+    if (sqe == nullptr && pending_head == nullptr) [[unlikely]] {
+        overload_stats.forced_submits++;
+        io_uring_submit(&ring);
+        sqe = io_uring_get_sqe(&ring);
     }
 
-    // TODO: Metric/log
-    io_uring_submit(&ring);
-
-    if (auto* sqe = io_uring_get_sqe(&ring); sqe != nullptr) [[likely]] {
-        if (dynamic_cast<details::CallbackNop*>(callable_ptr)) {
-            to_clean_on_submit.push_front(std::unique_ptr<CallbackErased>{callable_ptr});
-            io_uring_sqe_set_data(sqe, nullptr);
+    if (sqe == nullptr) [[unlikely]] {
+        // Still full, stage the operation in the callback itself. It is copied to the ring by flush_pending.
+        overload_stats.deferred_sqes++;
+        sqe = &callable_ptr->pending_sqe;
+        *sqe = {};
+        if (pending_tail != nullptr) {
+            pending_tail->pending_next = callable_ptr;
         } else {
-            io_uring_sqe_set_data(sqe, callable_ptr);
+            pending_head = callable_ptr;
         }
+        pending_tail = callable_ptr;
+        pending_count++;
+
+        // Staged no-op callbacks are owned by the pending queue until they are flushed.
+        io_uring_sqe_set_data(sqe, dynamic_cast<details::CallbackNop*>(callable_ptr) ? nullptr : callable_ptr);
         return sqe;
     }
 
-    throw std::runtime_error("Failed to get an SQE from the ring");
+    if (dynamic_cast<details::CallbackNop*>(callable_ptr)) {
+        to_clean_on_submit.push_front(std::unique_ptr<CallbackErased>{callable_ptr});
+        // Explicitly setting nullptr is not necessary
+        io_uring_sqe_set_data(sqe, nullptr);
+    } else {
+        io_uring_sqe_set_data(sqe, callable_ptr);
+    }
+    return sqe;
 }
 
 void IoUring::queue_statx(
@@ -176,6 +249,40 @@ void IoUring::queue_statx(
     queue_statx(dir_fd, path, result, std::move(callback));
 }
 
+void IoUring::openat(
+    int dir_fd, std::string_view path, int flags, mode_t mode, std::unique_ptr<CallbackErased> callback
+) {
+    assert(dir_fd >= 0 || dir_fd == AT_FDCWD);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_openat(sqe, dir_fd, path.data(), flags, mode);
+}
+
+void IoUring::mkdirat(int dir_fd, std::string_view path, mode_t mode, std::unique_ptr<CallbackErased> callback) {
+    assert(dir_fd >= 0 || dir_fd == AT_FDCWD);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_mkdirat(sqe, dir_fd, path.data(), mode);
+}
+
+void IoUring::unlinkat(int dir_fd, std::string_view path, int flags, std::unique_ptr<CallbackErased> callback) {
+    assert(dir_fd >= 0 || dir_fd == AT_FDCWD);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_unlinkat(sqe, dir_fd, path.data(), flags);
+}
+
+void IoUring::renameat(
+    int dir_fd, std::string_view path, int new_dir_fd, std::string_view new_path, unsigned flags,
+    std::unique_ptr<CallbackErased> callback
+) {
+    assert(dir_fd >= 0 || dir_fd == AT_FDCWD);
+    assert(new_dir_fd >= 0 || new_dir_fd == AT_FDCWD);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_renameat(sqe, dir_fd, path.data(), new_dir_fd, new_path.data(), flags);
+}
+
 // CallbackUniquePtr<Callable> when no result (because the lambda is already there to store something)
 void IoUring::add_fd(int fd, std::unique_ptr<CallbackErased> callback) {
     assert(fd >= 0);
@@ -206,6 +313,38 @@ void IoUring::read(int fd, std::span<std::byte> target, size_t offset, std::uniq
     io_uring_prep_read(sqe, fd, target.data(), target.size(), offset);
 }
 
+void IoUring::splice(int fd_in, int fd_out, size_t size, std::unique_ptr<CallbackErased> callback) {
+    assert(fd_in >= 0);
+    assert(fd_out >= 0);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_splice(sqe, fd_in, -1, fd_out, -1, narrow_cast<unsigned>(size), SPLICE_F_MOVE);
+}
+
+void IoUring::uring_cmd(
+    int fd, std::uint32_t cmd_op, std::span<const std::byte> cmd, std::span<const iovec> buffers,
+    std::unique_ptr<CallbackErased> callback
+) {
+    assert(fd >= 0);
+    assert(callback);
+    assert(cmd.size() <= 80);
+
+    // The SQE staged in callbacks when the ring is full is too short for commands, room is made for them instead.
+    flush_pending();
+    while (pending_head != nullptr || io_uring_sq_space_left(&ring) == 0) {
+        overload_stats.forced_submits++;
+        if (auto ret = io_uring_submit(&ring); ret < 0) {
+            throw std::system_error(-ret, std::generic_category(), "Failed to make room for a command");
+        }
+        flush_pending();
+    }
+
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, buffers.data(), narrow_cast<unsigned>(buffers.size()), 0);
+    sqe->cmd_op = cmd_op;
+    std::memcpy(sqe->cmd, cmd.data(), cmd.size());
+}
+
 void IoUring::write(int fd, std::span<std::byte> source, std::unique_ptr<CallbackErased> callback) {
     assert(fd >= 0);
     assert(callback);
@@ -213,4 +352,40 @@ void IoUring::write(int fd, std::span<std::byte> source, std::unique_ptr<Callbac
     io_uring_prep_write(sqe, fd, source.data(), source.size(), 0);
 }
 
+void IoUring::fsync(int fd, bool datasync, std::unique_ptr<CallbackErased> callback) {
+    assert(fd >= 0);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_fsync(sqe, fd, datasync ? IORING_FSYNC_DATASYNC : 0);
+}
+
+void IoUring::ftruncate(int fd, off_t length, std::unique_ptr<CallbackErased> callback) {
+    assert(fd >= 0);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_ftruncate(sqe, fd, length);
+}
+
+void IoUring::sendmsg(int fd, const msghdr* message, int flags, std::unique_ptr<CallbackErased> callback) {
+    assert(fd >= 0);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_sendmsg(sqe, fd, message, flags);
+}
+
+void IoUring::recvmsg(int fd, msghdr* message, int flags, std::unique_ptr<CallbackErased> callback) {
+    assert(fd >= 0);
+    assert(callback);
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_recvmsg(sqe, fd, message, flags);
+}
+
+void IoUring::sendmsg_zc(int fd, const msghdr* message, int flags, std::unique_ptr<CallbackErased> callback) {
+    assert(fd >= 0);
+    assert(callback);
+    assert(!dynamic_cast<details::CallbackNop*>(callback.get()));
+    auto* sqe = get_sqe(std::move(callback));
+    io_uring_prep_sendmsg_zc(sqe, fd, message, flags);
+}
+
 }  // namespace remotefs
@@ -17,6 +17,7 @@
 #include <span>
 #include <type_traits>
 
+#include "AdaptiveBatching.h"
 #include "Callbacks.h"
 #include "CallbacksImpl.h"
 #include "RegisteredBufferCache.h"
@@ -27,11 +28,15 @@ namespace remotefs {
 
 class IoUring {
    public:
+    struct OverloadStats {
+        long deferred_sqes = 0;   // Operations staged because the submission queue was full.
+        long forced_submits = 0;  // Submissions forced outside of queue_wait to make room in the submission queue.
+    };
+
     static constexpr auto queue_depth_default = 64;
     static constexpr auto wait_min_batch_size_default = 1;
     static constexpr auto wait_timeout_default = std::chrono::seconds{1};
     static constexpr auto buffers_count_default = 64;
-    static constexpr auto max_wait_min_batch_size = 16;  // Compile time limit
 
     template <typename Callable>
     static inline constexpr size_t MaxPayloadForCallback() {
@@ -49,7 +54,10 @@ class IoUring {
         return std::pmr::polymorphic_allocator<T>{&get_pool()};
     }
 
-    explicit IoUring(int queue_depth = queue_depth_default, int registered_buffers = buffers_count_default);
+    // setup_flags are IORING_SETUP_* flags, like IORING_SETUP_SQE128 for uring_cmd.
+    explicit IoUring(
+        int queue_depth = queue_depth_default, int registered_buffers = buffers_count_default, unsigned setup_flags = 0
+    );
     IoUring(IoUring&& source) noexcept;
     IoUring& operator=(IoUring&& source) noexcept;
     IoUring(const IoUring& source) = delete;
@@ -66,6 +74,15 @@ class IoUring {
         int dir_fd, std::string_view path, std::unique_ptr<CallbackWithStorageAbstract<struct statx>> callback
     );
 
+    // Same as above, for the operations on paths below.
+    void openat(int dir_fd, std::string_view path, int flags, mode_t mode, std::unique_ptr<CallbackErased> callback);
+    void mkdirat(int dir_fd, std::string_view path, mode_t mode, std::unique_ptr<CallbackErased> callback);
+    void unlinkat(int dir_fd, std::string_view path, int flags, std::unique_ptr<CallbackErased> callback);
+    void renameat(
+        int dir_fd, std::string_view path, int new_dir_fd, std::string_view new_path, unsigned flags,
+        std::unique_ptr<CallbackErased> callback
+    );
+
     void add_fd(int fd, std::unique_ptr<CallbackErased> callback);
 
     void accept(int socket, std::unique_ptr<CallbackErased> callback);
@@ -85,15 +102,51 @@ class IoUring {
 
     void write(int fd, std::span<std::byte> source, std::unique_ptr<CallbackErased> callback);
 
+    // Moves up to size bytes from fd_in to fd_out, one of which must be a pipe, without copying them to user space.
+    void splice(int fd_in, int fd_out, size_t size, std::unique_ptr<CallbackErased> callback);
+
+    // Passes command cmd_op to the driver of fd, with cmd as its payload. Up to 16 bytes fit in an SQE, up to 80 with
+    // IORING_SETUP_SQE128. buffers must stay alive until the command completes.
+    void uring_cmd(
+        int fd, std::uint32_t cmd_op, std::span<const std::byte> cmd, std::span<const iovec> buffers,
+        std::unique_ptr<CallbackErased> callback
+    );
+
     // For registered buffer: source must be in callback
     template <typename Storage>
     void write_fixed(
         int fd, std::span<std::byte> source, std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback
     );
 
+    // Same as above, at offset in fd, for files.
+    template <typename Storage>
+    void write_fixed(
+        int fd, std::span<std::byte> source, size_t offset,
+        std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback
+    );
+
     template <typename Storage>
     void write_fixed(int fd, std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback);
 
+    void fsync(int fd, bool datasync, std::unique_ptr<CallbackErased> callback);
+    void ftruncate(int fd, off_t length, std::unique_ptr<CallbackErased> callback);
+
+    // Zero copy send from a registered buffer. The callback is executed when the send completes, but is only freed,
+    // along with its buffer, once the kernel notifies it doesn't reference the buffer anymore.
+    template <typename Storage>
+    void send_zc_fixed(
+        int fd, std::span<std::byte> source, std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback
+    );
+
+    // Careful, message and what it points to must remain alive until the operation completes.
+    void sendmsg(int fd, const msghdr* message, int flags, std::unique_ptr<CallbackErased> callback);
+
+    // Careful, message and what it points to must remain alive until the operation completes.
+    void recvmsg(int fd, msghdr* message, int flags, std::unique_ptr<CallbackErased> callback);
+
+    // Same as sendmsg, with the lifecycle of send_zc_fixed.
+    void sendmsg_zc(int fd, const msghdr* message, int flags, std::unique_ptr<CallbackErased> callback);
+
     template <size_t size>
     void write_vector(int fd, std::span<const iovec, size> sources, std::unique_ptr<CallbackErased> callback);
 
@@ -101,6 +154,18 @@ class IoUring {
         int min_batch_size = wait_min_batch_size_default, std::chrono::nanoseconds wait_timeout = wait_timeout_default
     );
 
+    // Same as above, but the batch size and the timeout are picked by the controller, which is then fed back with the
+    // outcome of the iteration.
+    unsigned queue_wait(AdaptiveBatching& batching);
+
+    // Operations waiting for room in the submission queue. They are submitted by the next queue_wait.
+    [[nodiscard]] long pending() const {
+        return pending_count;
+    }
+
+    // Returns the counters accumulated since the last call, and resets them.
+    OverloadStats take_overload_stats();
+
     void register_ring();
     void register_sparse_files(int count);
     void register_sparse_buffers(int count);
@@ -119,6 +184,18 @@ class IoUring {
         return std::unique_ptr<CallbackWithStorageAbstract<Storage>>{ptr};
     }
 
+    // Same as above, but allocated on the heap instead of taking one of the registered buffers. For long-lived
+    // callbacks with a big storage, which can't be used with fixed operations.
+    template <typename Storage, typename Callable, typename... Ts>
+    [[nodiscard]] std::unique_ptr<CallbackWithStorageAbstract<Storage>> get_unregistered_callback(
+        Callable&& callable, Ts&&... storage_args
+    ) {
+        using Callback = details::CallbackWithStorage<Callable, Storage>;
+        auto* ptr = new (get_pool().allocate_unregistered(sizeof(Callback)))
+            Callback(std::forward<Callable>(callable), std::forward<Ts>(storage_args)...);
+        return std::unique_ptr<CallbackWithStorageAbstract<Storage>>{ptr};
+    }
+
     template <typename Callable>
     [[nodiscard]] std::unique_ptr<CallbackErased> get_callback(Callable&& callable) {
         auto* ptr =
@@ -162,6 +239,8 @@ class IoUring {
 
    private:
     io_uring_sqe* get_sqe(std::unique_ptr<CallbackErased> callable);
+    void flush_pending();
+    void free_pending();
 
     template <typename Storage>
     static short get_index(const CallbackWithStorageAbstract<Storage>& callback) {
@@ -170,6 +249,12 @@ class IoUring {
 
     io_uring ring{};
     std::forward_list<std::unique_ptr<CallbackErased>> to_clean_on_submit;
+    // Intrusive FIFO, linked through CallbackErased::pending_next. Order is kept so that operations on a same fd are
+    // submitted in the order they were queued.
+    CallbackErased* pending_head = nullptr;
+    CallbackErased* pending_tail = nullptr;
+    long pending_count = 0;
+    OverloadStats overload_stats;
     int registered_buffers;
 };
 
@@ -180,13 +265,18 @@ void IoUring::read_fixed(
     assert(fd >= 0);
     assert(callback);
 
-    // For registered buffers: target must be in callback
+    // For registered buffers: target must be in callback. Callbacks allocated once the registered buffers ran out are
+    // read without them.
     [[maybe_unused]] auto storage = singular_bytes(callback->get_storage());
     assert(std::ranges::search(storage, target).begin() != storage.end());
 
     auto index = callback->get_index();
     auto* sqe = get_sqe(std::move(callback));
-    io_uring_prep_read_fixed(sqe, fd, target.data(), target.size(), offset, index);
+    if (index < 0) [[unlikely]] {
+        io_uring_prep_read(sqe, fd, target.data(), target.size(), offset);
+    } else {
+        io_uring_prep_read_fixed(sqe, fd, target.data(), target.size(), offset, index);
+    }
 }
 
 template <typename Callable>
@@ -197,13 +287,24 @@ void IoUring::read_fixed(int fd, size_t offset, Callable&& callable) {
     auto index = callback->get_index();
     auto view = singular_bytes(callback->get_storage());
     auto* sqe = get_sqe(std::move(callback));
-    io_uring_prep_read_fixed(sqe, fd, view.data(), view.size(), offset, index);
+    if (index < 0) [[unlikely]] {
+        io_uring_prep_read(sqe, fd, view.data(), view.size(), offset);
+    } else {
+        io_uring_prep_read_fixed(sqe, fd, view.data(), view.size(), offset, index);
+    }
 }
 
 // For registered buffer: source must be in callback
 template <typename Storage>
 void IoUring::write_fixed(
     int fd, std::span<std::byte> source, std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback
+) {
+    write_fixed(fd, source, 0, std::move(callback));
+}
+
+template <typename Storage>
+void IoUring::write_fixed(
+    int fd, std::span<std::byte> source, size_t offset, std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback
 ) {
     assert(fd >= 0);
     assert(callback);
@@ -213,7 +314,11 @@ void IoUring::write_fixed(
 
     auto index = callback->get_index();
     auto* sqe = get_sqe(std::move(callback));
-    io_uring_prep_write_fixed(sqe, fd, source.data(), source.size(), 0, index);
+    if (index < 0) [[unlikely]] {
+        io_uring_prep_write(sqe, fd, source.data(), source.size(), offset);
+    } else {
+        io_uring_prep_write_fixed(sqe, fd, source.data(), source.size(), offset, index);
+    }
 }
 
 template <typename Storage>
@@ -223,7 +328,32 @@ void IoUring::write_fixed(int fd, std::unique_ptr<CallbackWithStorageAbstract<St
     auto view = singular_bytes(callback->get_storage());
     auto index = callback->get_index();
     auto* sqe = get_sqe(std::move(callback));
-    io_uring_prep_write_fixed(sqe, fd, view.data(), view.size(), 0, index);
+    if (index < 0) [[unlikely]] {
+        io_uring_prep_write(sqe, fd, view.data(), view.size(), 0);
+    } else {
+        io_uring_prep_write_fixed(sqe, fd, view.data(), view.size(), 0, index);
+    }
+}
+
+template <typename Storage>
+void IoUring::send_zc_fixed(
+    int fd, std::span<std::byte> source, std::unique_ptr<CallbackWithStorageAbstract<Storage>> callback
+) {
+    assert(fd >= 0);
+    assert(callback);
+    // No-op callbacks are freed on submit, way before the notification.
+    assert(!dynamic_cast<details::CallbackNop*>(callback.get()));
+
+    [[maybe_unused]] auto storage = singular_bytes(callback->get_storage());
+    assert(std::ranges::search(storage, source).begin() != storage.end());
+
+    auto index = callback->get_index();
+    auto* sqe = get_sqe(std::move(callback));
+    if (index < 0) [[unlikely]] {
+        io_uring_prep_send_zc(sqe, fd, source.data(), source.size(), MSG_WAITALL, 0);
+    } else {
+        io_uring_prep_send_zc_fixed(sqe, fd, source.data(), source.size(), MSG_WAITALL, 0, index);
+    }
 }
 
 template <size_t size>
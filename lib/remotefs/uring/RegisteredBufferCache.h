@@ -2,7 +2,9 @@
 #define REMOTE_FS_REGISTEREDBUFFERCACHE_H
 
 #include <algorithm>
+#include <bit>
 #include <cassert>
+#include <functional>
 #include <memory_resource>
 #include <ranges>
 
@@ -33,12 +35,30 @@ class CachedRegisteredBuffersResource final : public std::pmr::memory_resource {
         }));
     }
 
+    // Index of the registered buffer at ptr, or -1 for memory allocated on the heap, see do_allocate.
     short get_index(const void* ptr) const {
-        assert(ptr >= &buffers_cache.front().data.front());
-        assert(ptr < &buffers_cache.back().data.back());
+        if (!is_registered(ptr)) {
+            return -1;
+        }
         return static_cast<const Buffer*>(ptr)->index;
     }
 
+    // Number of buffers that can still be allocated.
+    [[nodiscard]] int available() const {
+        return std::popcount(active_registered_buffers);
+    }
+
+    // For callbacks never used with fixed operations, which then don't take one of the few registered buffers. Released
+    // with deallocate, like the registered buffers.
+    static void* allocate_unregistered(size_t bytes) {
+        return ::operator new(bytes);
+    }
+
+    [[nodiscard]] bool is_registered(const void* ptr) const {
+        return std::less_equal<>{}(buffers_cache.data(), ptr) &&
+               std::less<>{}(ptr, buffers_cache.data() + buffers_cache.size());
+    }
+
     auto view() const {
         // Many ranges functions are broken on clang < 16... LLVM issue #44178.
         return buffers_cache | std::views::transform([](const Buffer& buffer) {
@@ -51,8 +71,10 @@ class CachedRegisteredBuffersResource final : public std::pmr::memory_resource {
         auto index = std::countr_zero(active_registered_buffers);  // 0-indexed
 
         if (index >= std::numeric_limits<decltype(active_registered_buffers)>::digits) {
-            assert(index == std::ssize(buffers_cache));
-            throw std::bad_alloc();  // No more index available
+            // No more index available. Fall back to the heap rather than failing the operation, fixed operations
+            // then use their unregistered variant.
+            assert(alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+            return allocate_unregistered(bytes);
         }
 
         assert(active_registered_buffers & (0b1ull << index));
@@ -68,6 +90,11 @@ class CachedRegisteredBuffersResource final : public std::pmr::memory_resource {
     }
 
     void do_deallocate(void* pointer, size_t, size_t) final {
+        if (!is_registered(pointer)) {
+            ::operator delete(pointer);
+            return;
+        }
+
         auto index = reinterpret_cast<Buffer*>(pointer)->index;
         assert(index >= 0);
         assert(index < std::ssize(buffers_cache));
@@ -1,28 +1,104 @@
 #include "Client.h"
 
+#include <fcntl.h>
 #include <fuse3/fuse_kernel.h>
 #include <netdb.h>
 #include <quill/Quill.h>
 #include <sys/ioctl.h>
+#include <sys/sysinfo.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <memory>
+#include <thread>
 
 #include "Config.h"
 #include "FuseCmdlineOptsWrapper.h"
+#include "remotefs/compression/Compression.h"
 
 namespace remotefs {
+namespace {
+struct ClientOptions {
+    char *transport = nullptr;
+    int sctp_interleave = 0;
+    int port = 6512;
+    unsigned connections = 1;
+    int compression = 0;
+    unsigned threads = 1;
+    int pin = 0;
+    unsigned fuse_reads = 4;
+    int splice = 0;
+    int tunnel = 0;
+    int fuse_uring = 0;
+    int writeback_cache = 0;
+    double attr_timeout = 1.0;
+    double stale_timeout = 0.0;
+    unsigned read_stripe = 0;
+    unsigned readahead = 0;
+};
+
+const struct fuse_opt client_options_spec[] = {
+    {"--transport=%s", offsetof(ClientOptions, transport), 1},
+    {"--sctp-interleave", offsetof(ClientOptions, sctp_interleave), 1},
+    {"--port=%d", offsetof(ClientOptions, port), 1},
+    {"--connections=%u", offsetof(ClientOptions, connections), 1},
+    {"--compression", offsetof(ClientOptions, compression), 1},
+    {"-j %u", offsetof(ClientOptions, threads), 1},
+    {"--threads=%u", offsetof(ClientOptions, threads), 1},
+    {"--pin", offsetof(ClientOptions, pin), 1},
+    {"--fuse-reads=%u", offsetof(ClientOptions, fuse_reads), 1},
+    {"--splice", offsetof(ClientOptions, splice), 1},
+    {"--tunnel", offsetof(ClientOptions, tunnel), 1},
+    {"--fuse-uring", offsetof(ClientOptions, fuse_uring), 1},
+    {"--writeback-cache", offsetof(ClientOptions, writeback_cache), 1},
+    {"--attr-timeout=%lf", offsetof(ClientOptions, attr_timeout), 1},
+    {"--stale-timeout=%lf", offsetof(ClientOptions, stale_timeout), 1},
+    {"--read-stripe=%u", offsetof(ClientOptions, read_stripe), 1},
+    {"--readahead=%u", offsetof(ClientOptions, readahead), 1},
+    FUSE_OPT_END,
+};
+}  // namespace
+
 thread_local Client *Client::self;
 std::atomic_flag Client::common_init_done;
 fuse_session *Client::static_fuse_session = nullptr;
+Transport Client::static_transport = Transport::sctp;
+bool Client::static_sctp_interleave = false;
+int Client::static_port = 6512;
+unsigned Client::static_connections = 1;
+bool Client::static_compression = false;
+unsigned Client::static_threads = 1;
+bool Client::static_pin = false;
+unsigned Client::static_fuse_reads = 4;
+bool Client::static_splice = false;
+bool Client::static_tunnel = false;
+bool Client::static_fuse_uring = false;
+bool Client::static_writeback_cache = false;
+std::uint32_t Client::static_read_stripe = 0;
+unsigned Client::static_readahead = 0;
+std::atomic_flag Client::fuse_uring_negotiated;
+std::mutex Client::fuse_session_lock;
+RemoteInodes Client::inodes;
+std::unique_ptr<AttributeCache> Client::attributes;
+std::unordered_map<fuse_ino_t, messages::ContentVersion> Client::contents;
+std::unordered_map<fuse_ino_t, std::uint64_t> Client::changes;
+std::mutex Client::contents_lock;
 
-Client::Client(int argc, char *argv[])
+Client::Client(int argc, char *argv[], unsigned index)
     : logger(quill::get_logger()),
+      thread_index{index},
       fuse_fd{0} {
     assert(self == nullptr);
     self = this;
     static std::once_flag flag;
     std::call_once(flag, &Client::common_init, this, argc, argv);
     common_init_done.wait(false);
+    if (static_pin) {
+        pin(index);
+    }
     fuse_session = static_fuse_session;
     if (fuse_fd == 0) {
         if (fuse_fd = open("/dev/fuse", O_RDWR | O_CLOEXEC); fuse_fd == -1) {
@@ -35,151 +111,1596 @@ Client::Client(int argc, char *argv[])
         }
         LOG_INFO(logger, "Initialized with fd={}, master={}", fuse_fd, master_fd);
     }
-    fuse_channel = {
-        .ctr = std::numeric_limits<decltype(fuse_chan::ctr)>::max(),
-        .fd = fuse_fd,
-    };
-    pthread_mutex_init(&fuse_channel.lock, nullptr);
 
+    if (static_fuse_uring) {
+        // The commands to the fuse ring don't fit in regular SQEs.
+        io_uring = IoUring{IoUring::queue_depth_default, IoUring::buffers_count_default, IORING_SETUP_SQE128};
+    }
     io_uring.register_ring();
     io_uring.register_sparse_files(64);
+    // Read replies are written to the kernel straight from the registered buffers they were received in.
+    io_uring.start();
     //    io_uring.assign_file((fuse_uring_idx = 0), fuse_fd);
 
     assert(sysconf(_SC_PAGESIZE) == PAGE_SIZE);
 }
 
-template <auto BufferSize>
-void Client::fuse_reply_data(
-    std::unique_ptr<CallbackWithStorageAbstract<std::array<std::byte, BufferSize>>> old_callback
-) {
-    auto &msg = *reinterpret_cast<FuseReplyBuf *>(old_callback->get_storage().data());
+unsigned Client::threads() {
+    common_init_done.wait(false);
+    return static_threads;
+}
 
-    LOG_DEBUG(logger, "Received FuseReplyBuf, req={}, size={}", static_cast<void *>(msg.req), msg.payload_size);
-    [[maybe_unused]] auto ret = fuse_reply_buf(msg.req, msg.read_view().data(), msg.read_view().size());
-    assert(ret == 0);
+void Client::pin(unsigned index) {
+    auto cpu = index % std::max(std::thread::hardware_concurrency(), 1u);
+    auto cpus = cpu_set_t{};
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (auto ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus); ret != 0) {
+        LOG_WARNING(logger, "Failed to pin thread {} to cpu {}: {}", index, cpu, std::strerror(ret));
+        return;
+    }
+    LOG_INFO(logger, "Pinned thread {} to cpu {}", index, cpu);
 }
 
-template <auto BufferSize>
-void Client::read_callback(
-    int syscall_ret, std::unique_ptr<CallbackWithStorageAbstract<std::array<std::byte, BufferSize>>> old_callback
-) {
-    auto callable = [this](int32_t syscall_ret, auto callback) { read_callback(syscall_ret, std::move(callback)); };
+namespace {
+auto reply_written(quill::Logger *logger, std::uint64_t unique) {
+    return [logger, unique](int syscall_ret) {
+        // ENOENT: the request was interrupted in the meantime, the kernel doesn't wait for its reply anymore.
+        if (syscall_ret == -ENOENT) {
+            LOG_DEBUG(logger, "Dropped the reply to interrupted request {}", unique);
+        } else if (syscall_ret < 0) {
+            LOG_ERROR(logger, "Failed to reply to request {}: {}", unique, std::strerror(-syscall_ret));
+        }
+    };
+}
 
-    if (syscall_ret < 0) {
-        LOG_ERROR(logger, "Read failed: {}", std::strerror(-syscall_ret));
-        io_uring.read_fixed(socket, 0, std::move(callable));
+double seconds(AttributeCache::Clock::duration duration) {
+    return std::chrono::duration<double>{duration}.count();
+}
+
+// The reply isn't part of a batch, and was received in a registered buffer.
+bool can_reply_in_place(std::span<const std::byte> reply, const Connection::Message *owner) {
+    return owner != nullptr && reply.data() == owner->get()->get_storage().data() &&
+           get_pool().is_registered(owner->get());
+}
+}  // namespace
+
+void Client::reply(std::uint64_t unique, int error, std::span<const std::byte> payload) {
+    if (auto ring = ring_requests.extract(unique)) {
+        auto sent = error == 0 ? payload : std::span<const std::byte>{};
+        commit(*ring.mapped(), fuse::out_header(unique, error, sent.size()), sent);
+        return;
+    }
+
+    auto copy = std::unique_ptr<std::byte[]>{};
+    if (error == 0 && !payload.empty()) {
+        copy = std::make_unique_for_overwrite<std::byte[]>(payload.size());
+        std::ranges::copy(payload, copy.get());
+    }
+
+    auto callback = io_uring.get_unregistered_callback<Reply>(reply_written(logger, unique));
+    auto &reply = callback->get_storage();
+    reply.header = fuse::out_header(unique, error, copy ? payload.size() : 0);
+    reply.payload = std::move(copy);
+    reply.iov = {
+        iovec{.iov_base = &reply.header, .iov_len = sizeof(reply.header)},
+        iovec{.iov_base = reply.payload.get(), .iov_len = reply.header.len - sizeof(reply.header)}};
+    auto iov = std::span<const iovec, 2>{reply.iov};
+    io_uring.write_vector(fuse_fd, iov, std::move(callback));
+}
+
+void Client::reply(std::uint64_t unique, std::unique_ptr<std::byte[]> payload, std::size_t size) {
+    if (auto ring = ring_requests.extract(unique)) {
+        commit(*ring.mapped(), fuse::out_header(unique, 0, size), std::span{payload.get(), size});
+        return;
+    }
+
+    auto callback = io_uring.get_unregistered_callback<Reply>(reply_written(logger, unique));
+    auto &reply = callback->get_storage();
+    reply.header = fuse::out_header(unique, 0, size);
+    reply.payload = std::move(payload);
+    reply.iov = {
+        iovec{.iov_base = &reply.header, .iov_len = sizeof(reply.header)},
+        iovec{.iov_base = reply.payload.get(), .iov_len = size}};
+    auto iov = std::span<const iovec, 2>{reply.iov};
+    io_uring.write_vector(fuse_fd, iov, std::move(callback));
+}
+
+void Client::reply_in_place(std::uint64_t unique, Connection::Message message, std::span<const std::byte> payload) {
+    if (auto ring = ring_requests.extract(unique)) {
+        commit(*ring.mapped(), fuse::out_header(unique, 0, payload.size()), payload);
+        return;
+    }
+
+    auto storage = std::span{message->get_storage()};
+    auto offset = static_cast<std::size_t>(payload.data() - storage.data());
+    assert(offset >= sizeof(fuse_out_header) && offset + payload.size() <= storage.size());
+
+    auto header = fuse::out_header(unique, 0, payload.size());
+    auto source = storage.subspan(offset - sizeof(header), sizeof(header) + payload.size());
+    std::memcpy(source.data(), &header, sizeof(header));
+    io_uring.write_fixed(fuse_fd, source, io_uring.get_callback(reply_written(logger, unique), std::move(message)));
+}
+
+void Client::fuse_reply_data(std::span<const std::byte> reply, Connection::Message *owner) {
+    auto &msg = *reinterpret_cast<FuseReplyBuf *>(const_cast<std::byte *>(reply.data()));
+
+    LOG_DEBUG(logger, "Received FuseReplyBuf, id={}, size={}", msg.id, msg.payload_size);
+    if (auto spliced = spliced_replies.extract(msg.id)) {
+        fuse_reply_spliced(msg.id, *spliced.mapped(), msg.payload_size);
+        return;
+    }
+    auto pending = complete(msg.id);
+    if (!pending) {
+        return;
+    }
+
+    auto payload = std::as_bytes(msg.read_view());
+    if (pending->read_into) {
+        pending->read_into(0, payload);
+    } else if (can_reply_in_place(reply, owner)) {
+        reply_in_place(pending->unique, std::move(*owner), payload);
+    } else {
+        this->reply(pending->unique, 0, payload);
+    }
+}
+
+Client::SplicePipe::SplicePipe() {
+    auto fds = std::array<int, 2>{};
+    if (pipe2(fds.data(), O_CLOEXEC) < 0) {
+        throw std::system_error(errno, std::generic_category(), "Failed to create splice pipe");
+    }
+    read_end = fds[0];
+    write_end = fds[1];
+
+    // Bigger pipes let bigger replies through, unprivileged processes are limited by /proc/sys/fs/pipe-max-size.
+    for (auto size : {4 << 20, 1 << 20}) {
+        if (fcntl(write_end, F_SETPIPE_SZ, size) >= 0) {
+            break;
+        }
+    }
+    capacity = narrow_cast<std::size_t>(fcntl(write_end, F_GETPIPE_SZ));
+}
+
+Client::SplicePipe::~SplicePipe() {
+    close(read_end);
+    close(write_end);
+}
+
+void Client::SplicePipe::reset() {
+    auto fresh = SplicePipe{};
+    std::swap(read_end, fresh.read_end);
+    std::swap(write_end, fresh.write_end);
+    std::swap(capacity, fresh.capacity);
+}
+
+void Client::enable_splice(std::size_t index) {
+    auto &pooled = connections[index];
+    if (pooled.connection->transport() != Transport::tcp) {
+        LOG_WARNING(logger, "Only TCP connections splice replies, ignoring --splice");
+        return;
+    }
+
+    if (!pooled.pipe) {
+        pooled.pipe = std::make_unique<SplicePipe>();
+    }
+    pooled.connection->set_splicer([this, index](std::span<const std::byte> received, std::size_t size) {
+        return splice_reply(index, received, size);
+    });
+}
+
+int Client::splice_reply(std::size_t index, std::span<const std::byte> received, std::size_t size) {
+    static constexpr auto header_size = offsetof(FuseReplyBuf, payload);
+    if (received.size() < header_size || received[0] != std::byte{4}) {
+        return -1;
+    }
+
+    auto &msg = *reinterpret_cast<const FuseReplyBuf *>(received.data());
+    auto *pending = requests.find(msg.id);
+    auto &pipe = *connections[index].pipe;
+    auto reply_size = sizeof(fuse_out_header) + msg.payload_size;
+    // The pipe must hold the whole reply before it is spliced to the fuse fd. Each of its slots holds at most a page,
+    // often less as the socket splices its packets as they are: leave plenty of room.
+    // Requests received from a ring are replied to in their ring entry.
+    if (pipe.busy || pending == nullptr || pending->request.unique == 0 ||
+        ring_requests.contains(pending->request.unique) || msg.payload_size < 0 ||
+        header_size + msg.payload_size != size || reply_size > pipe.capacity / 4) {
+        return -1;
+    }
+
+    auto header = fuse_out_header{
+        .len = narrow_cast<std::uint32_t>(reply_size), .error = 0, .unique = pending->request.unique};
+    auto payload = received.subspan(header_size);
+    auto iov = std::array{
+        iovec{.iov_base = &header, .iov_len = sizeof(header)},
+        iovec{.iov_base = const_cast<std::byte *>(payload.data()), .iov_len = payload.size()}};
+    if (writev(pipe.write_end, iov.data(), iov.size()) != narrow_cast<ssize_t>(sizeof(header) + payload.size())) {
+        LOG_WARNING(logger, "Failed to write to the splice pipe: {}", std::strerror(errno));
+        pipe.reset();
+        return -1;
+    }
+
+    LOG_TRACE_L2(logger, "Splicing {} bytes of the reply to request {}", size - received.size(), msg.id);
+    spliced_replies.emplace(msg.id, &pipe);
+    return pipe.write_end;
+}
+
+void Client::fuse_reply_spliced(messages::RequestId id, SplicePipe &pipe, std::size_t payload_size) {
+    auto pending = complete(id);
+    if (!pending) {
+        pipe.reset();
+        return;
+    }
+
+    // The pipe holds the reply until the splice completes, the next ones are received without it meanwhile.
+    auto size = sizeof(fuse_out_header) + payload_size;
+    pipe.busy = true;
+    io_uring.splice(pipe.read_end, fuse_fd, size, io_uring.get_callback([this, id, &pipe, size](int ret) {
+        pipe.busy = false;
+        if (ret != narrow_cast<int>(size)) {
+            // The kernel doesn't accept partial replies, most likely the request was interrupted.
+            LOG_WARNING(
+                logger, "Failed to splice the reply to request {}: {}", id, ret < 0 ? std::strerror(-ret) : "short"
+            );
+            pipe.reset();
+        }
+    }));
+}
+
+void Client::submit(PendingRequest request) {
+    send_request(requests.insert(std::move(request)));
+}
+
+void Client::send_request(messages::RequestId id) {
+    auto &pending = requests.find(id)->request;
+    auto server_ino = inodes.server_ino(pending.ino);
+    if (server_ino == RemoteInodes::unresolved) {
+        auto &waiting = waiting_resolution[pending.ino];
+        waiting.push_back(id);
+        if (waiting.size() == 1) {
+            resolve(pending.ino);
+        }
         return;
     }
 
-    if (syscall_ret == 0) {
-        LOG_INFO(logger, "Read NULL message");
-        io_uring.read_fixed(socket, 0, std::move(callable));
+    pending.connection = next_connection();
+    if (!pending.connection) {
+        waiting_connection.push_back(id);
         return;
     }
+    pending.send(*connections[*pending.connection].connection, id, server_ino);
+}
 
-    switch (old_callback->get_storage()[0]) {
+Client::Sender Client::lookup_sender(std::string name) {
+    return [this, name = std::move(name)](Connection &connection, messages::RequestId id, fuse_ino_t parent) {
+        auto callback = io_uring.get_callback<messages::requests::Lookup>([](int) {});
+        callback->get_storage().id = id;
+        callback->get_storage().ino = parent;
+        strcpy(callback->get_storage().path.data(), name.c_str());
+        auto view = callback->get_storage().view();
+        connection.send(view, std::move(callback));
+    };
+}
+
+Client::Sender Client::getattr_sender() {
+    return [this](Connection &connection, messages::RequestId id, fuse_ino_t server_ino) {
+        auto callback = io_uring.get_callback<messages::requests::GetAttr>([](int) {});
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_ino;
+        connection.send(std::move(callback));
+    };
+}
+
+Client::Sender Client::read_sender(std::uint64_t offset, std::uint32_t size) {
+    return [this, offset, size](Connection &connection, messages::RequestId id, fuse_ino_t server_ino) {
+        auto callback = io_uring.get_callback<messages::requests::Read>([](int) {});
+        if (static_compression) {
+            callback->get_storage().flags = messages::requests::Read::accept_compressed;
+        }
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_ino;
+        callback->get_storage().size = size;
+        callback->get_storage().offset = narrow_cast<off_t>(offset);
+        connection.send(std::move(callback));
+    };
+}
+
+Client::Sender Client::tunnel_sender(const fuse::InRequest &request) {
+    auto raw = std::vector<std::byte>(
+        reinterpret_cast<const std::byte *>(request.header), request.arguments.data() + request.arguments.size()
+    );
+    return [this, raw = std::move(raw)](Connection &connection, messages::RequestId id, fuse_ino_t server_ino) {
+        auto callback = io_uring.get_callback<messages::requests::Fuse>([](int) {});
+        auto &message = callback->get_storage();
+        message.id = id;
+        if (static_compression) {
+            message.flags = messages::requests::Read::accept_compressed;
+        }
+        std::ranges::copy(raw, message.request.begin());
+        message.header().nodeid = server_ino;
+        auto view = message.view();
+        connection.send(view, std::move(callback));
+    };
+}
+
+void Client::resolve(fuse_ino_t ino) {
+    auto path = inodes.path(ino);
+    if (!path || path->size() > PATH_MAX) {
+        for (auto id : std::exchange(waiting_resolution[ino], {})) {
+            fail(id, ESTALE);
+        }
+        waiting_resolution.erase(ino);
+        return;
+    }
+
+    LOG_INFO(logger, "Resolving inode {} again from its path {}", ino, *path);
+    submit({.unique = 0,
+            .ino = RemoteInodes::root,
+            .send = lookup_sender(*path),
+            .replayable = true,
+            .resolving = ino});
+}
+
+void Client::resolved(fuse_ino_t ino, fuse_ino_t server_ino) {
+    inodes.resolved(ino, server_ino);
+    auto waiting = std::exchange(waiting_resolution[ino], {});
+    waiting_resolution.erase(ino);
+    for (auto id : waiting) {
+        if (server_ino != RemoteInodes::unresolved) {
+            send_request(id);
+        } else {
+            fail(id, ESTALE);
+        }
+    }
+}
+
+void Client::fail(messages::RequestId id, int error) {
+    auto pending = complete(id);
+    if (!pending) {
+        return;
+    }
+
+    if (pending->resolving != RemoteInodes::unresolved) {
+        // The waiting requests fail with the error of the lookup, like they would have without reconnecting.
+        auto waiting = std::exchange(waiting_resolution[pending->resolving], {});
+        waiting_resolution.erase(pending->resolving);
+        for (auto waiting_id : waiting) {
+            fail(waiting_id, error);
+        }
+    } else if (pending->refreshing != RemoteInodes::unresolved) {
+        // The kernel was already answered, the next request asks the server.
+        attributes->invalidate(pending->refreshing);
+    } else if (pending->read_into) {
+        pending->read_into(error, {});
+    } else {
+        if (error == 0 && pending->acknowledged) {
+            pending->acknowledged();
+        }
+        reply(pending->unique, error);
+    }
+}
+
+std::optional<Client::PendingRequest> Client::complete(messages::RequestId id) {
+    auto entry = requests.take(id);
+    if (!entry) {
+        LOG_WARNING(logger, "Dropping a reply to request {}, which is not in flight", id);
+        return std::nullopt;
+    }
+
+    LOG_TRACE_L2(
+        logger, "Request {} answered in {}us", id,
+        std::chrono::duration_cast<std::chrono::microseconds>(Requests::Clock::now() - entry->issued).count()
+    );
+    return std::move(entry->request);
+}
+
+std::optional<std::size_t> Client::next_connection(bool expects_reply) {
+    auto best = std::optional<std::size_t>{};
+    for (auto i = 1ul; i <= connections.size(); i++) {
+        auto candidate = (last_connection + i) % connections.size();
+        if (connections[candidate].connection &&
+            (!best || connections[candidate].in_flight < connections[*best].in_flight)) {
+            best = candidate;
+        }
+    }
+    if (!best) {
+        return std::nullopt;
+    }
+
+    last_connection = *best;
+    if (expects_reply) {
+        connections[*best].in_flight++;
+    }
+    return best;
+}
+
+std::shared_ptr<Connection> Client::connect() {
+    auto connection = Connection::create(
+        io_uring, remotefs::Socket::connect(
+                      address, static_port,
+                      {.rx_buffer_size = 10 * settings::MAX_MESSAGE_SIZE,
+                       .tx_buffer_size = 10 * settings::MAX_MESSAGE_SIZE,
+                       .delivery_point = settings::MAX_MESSAGE_SIZE,
+                       .transport = static_transport,
+                       .interleave = static_sctp_interleave}
+                  )
+    );
+    connection->send(io_uring.get_callback<messages::requests::Hello>([](int) {}));
+    return connection;
+}
+
+void Client::receive(std::size_t index) {
+    auto *connection = connections[index].connection.get();
+    connection->receive([this, index, connection](int32_t syscall_ret, auto callback) {
+        // A receive still pending on a connection that was since replaced.
+        if (connections[index].connection.get() != connection) {
+            return;
+        }
+        read_callback(index, syscall_ret, std::move(callback));
+    });
+}
+
+void Client::disconnected(std::size_t index) {
+    LOG_WARNING(logger, "Lost connection {} to the server, reconnecting", index);
+    connections[index].connection.reset();
+    connections[index].in_flight = 0;
+    if (std::ranges::count(connections, nullptr, &PooledConnection::connection) == 1) {
+        // The first one lost is reconnected right away, the next attempts back off.
+        next_reconnect = std::chrono::steady_clock::now();
+    }
+
+    auto lost = std::vector<messages::RequestId>{};
+    requests.for_each([index, &lost](messages::RequestId id, Requests::Entry &entry) {
+        if (entry.request.connection == index) {
+            lost.push_back(id);
+        }
+    });
+    if (connections[index].pipe) {
+        connections[index].pipe->reset();
+    }
+    // The kernel keeps the pages of the files whose push didn't complete, which may be outdated.
+    std::erase_if(pending_pushes, [this, index](const auto &push) {
+        if (push.second.connection != index) {
+            return false;
+        }
+        notify_inval(push.first);
+        return true;
+    });
+    for (auto id : lost) {
+        // Parts of a reply already received are received again.
+        pending_reads.erase(id);
+        spliced_replies.erase(id);
+        auto &pending = requests.find(id)->request;
+        pending.connection.reset();
+        if (pending.replayable) {
+            send_request(id);
+        } else {
+            fail(id, EIO);
+        }
+    }
+}
+
+void Client::reconnect() {
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_reconnect) {
+        return;
+    }
+
+    for (auto i = 0ul; i < connections.size(); i++) {
+        if (connections[i].connection) {
+            continue;
+        }
+
+        try {
+            connections[i].connection = connect();
+        } catch (const std::system_error &error) {
+            LOG_WARNING(logger, "Failed to reconnect: {}, retrying in {}ms", error.what(), reconnect_backoff.count());
+            next_reconnect = now + reconnect_backoff;
+            reconnect_backoff = std::min<std::chrono::milliseconds>(reconnect_backoff * 2, reconnect_backoff_max);
+            break;
+        }
+        LOG_INFO(logger, "Reconnected connection {}", i);
+        if (static_splice) {
+            enable_splice(i);
+        }
+        receive(i);
+    }
+
+    if (std::ranges::all_of(connections, [](const auto &pooled) { return pooled.connection != nullptr; })) {
+        reconnect_backoff = reconnect_backoff_min;
+    }
+    for (auto id : std::exchange(waiting_connection, {})) {
+        if (requests.find(id) != nullptr) {
+            send_request(id);
+        }
+    }
+}
+
+bool Client::fuse_reply_chunk(std::span<const std::byte> reply) {
+    auto &msg = *reinterpret_cast<const FuseReplyChunk *>(reply.data());
+    LOG_DEBUG(
+        logger, "Received FuseReplyChunk, id={}, offset={}, result={}", msg.id, msg.offset, msg.result
+    );
+    if (requests.find(msg.id) == nullptr) {
+        LOG_WARNING(logger, "Dropping a part of a reply to request {}, which is not in flight", msg.id);
+        return false;
+    }
+
+    auto header_size = offsetof(FuseReplyChunk, payload);
+    if (reply.size() < header_size || msg.requested < 0 || msg.result > msg.requested || msg.total_size > max_read ||
+        msg.offset > msg.total_size || static_cast<std::size_t>(msg.requested) > msg.total_size - msg.offset ||
+        static_cast<std::size_t>(std::max(msg.result, 0)) > reply.size() - header_size) {
+        throw std::system_error(EPROTO, std::generic_category(), "Malformed FuseReplyChunk");
+    }
+
+    auto [it, inserted] = pending_reads.try_emplace(msg.id);
+    auto &pending = it->second;
+    if (inserted) {
+        pending.data = std::make_unique_for_overwrite<std::byte[]>(msg.total_size);
+        pending.size = msg.total_size;
+        pending.total_size = msg.total_size;
+    } else if (pending.total_size != msg.total_size) {
+        throw std::system_error(EPROTO, std::generic_category(), "Malformed FuseReplyChunk");
+    }
+
+    if (msg.result < 0) {
+        pending.error = -msg.result;
+    } else {
+        std::ranges::copy(std::as_bytes(msg.read_view()), &pending.data[msg.offset]);
+        if (msg.result < msg.requested) {
+            pending.size = std::min(pending.size, msg.offset + msg.result);
+        }
+    }
+
+    pending.received += msg.requested;
+    if (pending.received < msg.total_size) {
+        return false;
+    }
+
+    auto request = complete(msg.id);
+    if (request->read_into) {
+        request->read_into(pending.error, std::span{pending.data.get(), pending.error == 0 ? pending.size : 0});
+    } else if (pending.error != 0) {
+        this->reply(request->unique, pending.error);
+    } else {
+        this->reply(request->unique, std::move(pending.data), pending.size);
+    }
+    pending_reads.erase(it);
+    return true;
+}
+
+void Client::fuse_reply_compressed(std::span<const std::byte> reply) {
+    auto &msg = *reinterpret_cast<const FuseReplyCompressed *>(reply.data());
+    LOG_DEBUG(
+        logger, "Received FuseReplyCompressed, id={}, size={}, compressed={}", msg.id, msg.original_size,
+        msg.payload_size
+    );
+
+    if (msg.original_size < 0 || static_cast<std::size_t>(msg.original_size) > max_read) {
+        throw std::system_error(EPROTO, std::generic_category(), "Malformed FuseReplyCompressed");
+    }
+    // Decompressed in a buffer of its own, owned by the reply until the kernel took it.
+    auto data = std::make_unique_for_overwrite<std::byte[]>(msg.original_size);
+    if (decompress(msg.read_view(), std::span{data.get(), static_cast<std::size_t>(msg.original_size)}) !=
+        msg.original_size) {
+        throw std::system_error(EPROTO, std::generic_category(), "Malformed FuseReplyCompressed");
+    }
+
+    auto pending = complete(msg.id);
+    if (!pending) {
+        return;
+    }
+    if (pending->read_into) {
+        pending->read_into(0, std::span{data.get(), static_cast<std::size_t>(msg.original_size)});
+        return;
+    }
+    this->reply(pending->unique, std::move(data), msg.original_size);
+}
+
+messages::ContentVersion Client::cached_content(fuse_ino_t ino) {
+    auto guard = std::scoped_lock{contents_lock};
+    auto found = contents.find(ino);
+    return found != contents.end() ? found->second : messages::ContentVersion{};
+}
+
+void Client::forget_content(fuse_ino_t ino) {
+    auto guard = std::scoped_lock{contents_lock};
+    contents.erase(ino);
+}
+
+void Client::content_changed(fuse_ino_t ino) {
+    readaheads.erase(ino);
+    auto guard = std::scoped_lock{contents_lock};
+    changes[ino]++;
+}
+
+std::uint64_t Client::content_changes(fuse_ino_t ino) {
+    auto guard = std::scoped_lock{contents_lock};
+    auto found = changes.find(ino);
+    return found != changes.end() ? found->second : 0;
+}
+
+void Client::content_seen(fuse_ino_t ino, const struct stat &attr) {
+    auto version = messages::ContentVersion::of(attr);
+    auto previous = messages::ContentVersion{};
+    {
+        auto guard = std::scoped_lock{contents_lock};
+        auto found = contents.find(ino);
+        if (found == contents.end() || found->second == version) {
+            return;
+        }
+        previous = std::exchange(found->second, version);
+    }
+
+    // Only the end of the file changed if its modification time didn't, like after a truncation.
+    auto offset = previous.mtime_sec == version.mtime_sec && previous.mtime_nsec == version.mtime_nsec
+                      ? std::min(previous.size, version.size)
+                      : 0;
+    LOG_DEBUG(logger, "The content of {} changed, dropping its pages from {}", ino, offset);
+    notify_inval(ino, offset);
+}
+
+namespace {
+auto notification_written(quill::Logger *logger, fuse_ino_t ino) {
+    return [logger, ino](int syscall_ret) {
+        // ENOENT: the kernel forgot the inode in the meantime.
+        if (syscall_ret < 0 && syscall_ret != -ENOENT) {
+            LOG_WARNING(logger, "Failed to notify the kernel about {}: {}", ino, std::strerror(-syscall_ret));
+        }
+    };
+}
+}  // namespace
+
+void Client::notify_inval(fuse_ino_t ino, std::int64_t offset, std::int64_t size) {
+    auto callback = io_uring.get_unregistered_callback<fuse::InvalInodeNotification>(
+        notification_written(logger, ino), fuse::inval_inode(ino, offset, size)
+    );
+    auto notification = std::as_writable_bytes(std::span{&callback->get_storage(), 1});
+    io_uring.write(fuse_fd, notification, std::move(callback));
+}
+
+void Client::fuse_push(std::span<const std::byte> reply) {
+    const auto &msg = *reinterpret_cast<const FusePush *>(reply.data());
+    auto data = std::as_bytes(msg.read_view());
+    LOG_DEBUG(logger, "Received FusePush, ino={}, offset={}, result={}", msg.ino, msg.offset, msg.result);
+    if (auto pending = pending_pushes.find(msg.ino); pending != pending_pushes.end()) {
+        pending->second.remaining -= std::min<std::uint64_t>(pending->second.remaining, msg.requested);
+        if (pending->second.remaining == 0) {
+            pending_pushes.erase(pending);
+        }
+    }
+    // The kernel kept the pages this part was meant to replace.
+    if (auto requested = narrow_cast<std::size_t>(msg.requested); data.size() < requested) {
+        notify_inval(
+            msg.ino, narrow_cast<std::int64_t>(msg.offset + data.size()),
+            narrow_cast<std::int64_t>(requested - data.size())
+        );
+    }
+    if (data.empty()) {
+        return;
+    }
+
+    auto notification = fuse::store(msg.ino, msg.offset, narrow_cast<std::uint32_t>(data.size()));
+    auto payload = std::make_unique_for_overwrite<std::byte[]>(sizeof(notification.arguments) + data.size());
+    std::memcpy(payload.get(), &notification.arguments, sizeof(notification.arguments));
+    std::ranges::copy(data, payload.get() + sizeof(notification.arguments));
+
+    auto callback = io_uring.get_unregistered_callback<Reply>(notification_written(logger, msg.ino));
+    auto &store = callback->get_storage();
+    store.header = notification.header;
+    store.payload = std::move(payload);
+    store.iov = {
+        iovec{.iov_base = &store.header, .iov_len = sizeof(store.header)},
+        iovec{.iov_base = store.payload.get(), .iov_len = store.header.len - sizeof(store.header)}};
+    auto iov = std::span<const iovec, 2>{store.iov};
+    io_uring.write_vector(fuse_fd, iov, std::move(callback));
+}
+
+void Client::fuse_reply_raw(std::span<const std::byte> reply, Connection::Message *owner) {
+    auto &msg = *reinterpret_cast<FuseReplyRaw *>(const_cast<std::byte *>(reply.data()));
+    if (reply.size() < offsetof(FuseReplyRaw, payload) || msg.header.len < sizeof(fuse_out_header) ||
+        offsetof(FuseReplyRaw, header) + msg.header.len > std::min(reply.size(), sizeof(msg))) {
+        throw std::system_error(EPROTO, std::generic_category(), "Malformed FuseReplyRaw");
+    }
+    LOG_DEBUG(logger, "Received FuseReplyRaw, id={}, error={}, size={}", msg.id, msg.header.error, msg.header.len);
+
+    auto pending = complete(msg.id);
+    if (!pending) {
+        return;
+    }
+    auto error = -msg.header.error;
+    if (error != 0) {
+        this->reply(pending->unique, error);
+        return;
+    }
+
+    // Only the node ids differ from what the kernel expects.
+    if (auto *entry = msg.get<fuse_entry_out>(); entry != nullptr && pending->opcode == FUSE_LOOKUP) {
+        entry->nodeid = entry->attr.ino = inodes.add(pending->ino, pending->name, entry->nodeid);
+    } else if (auto *attr = msg.get<fuse_attr_out>(); attr != nullptr && pending->opcode == FUSE_GETATTR) {
+        attr->attr.ino = pending->ino;
+    }
+    auto payload = msg.fuse_view().subspan(sizeof(fuse_out_header));
+    if (can_reply_in_place(reply, owner)) {
+        reply_in_place(pending->unique, std::move(*owner), payload);
+    } else {
+        this->reply(pending->unique, 0, payload);
+    }
+}
+
+void Client::read_callback(std::size_t index, int syscall_ret, Connection::Message old_callback) {
+    if (syscall_ret == 0 || syscall_ret == -ECONNRESET || syscall_ret == -ENOTCONN || syscall_ret == -ETIMEDOUT ||
+        syscall_ret == -EPIPE) {
+        LOG_ERROR(logger, "Server closed the connection: {}", std::strerror(-syscall_ret));
+        disconnected(index);
+        return;
+    }
+
+    if (syscall_ret < 0) {
+        LOG_ERROR(logger, "Read failed: {}", std::strerror(-syscall_ret));
+        receive(index);
+        return;
+    }
+
+    auto reply = std::span{old_callback->get_storage()}.subspan(0, syscall_ret);
+    connections[index].in_flight -= dispatch_reply(reply, &old_callback);
+    receive(index);
+}
+
+int Client::dispatch_reply(std::span<const std::byte> reply, Connection::Message *owner) {
+    switch (reply[0]) {
         case std::byte{1}: {
-            auto *msg =
-                reinterpret_cast<const messages::responses::FuseReplyEntry *>(old_callback->get_storage().data());
+            auto *msg = reinterpret_cast<const messages::responses::FuseReplyEntry *>(reply.data());
+            auto entry = msg->entry();
+            if (!entry) {
+                throw std::system_error(EPROTO, std::generic_category(), "Malformed FuseReplyEntry");
+            }
             LOG_DEBUG(
-                logger, "Received FuseReplyEntry, ino={}, req={}, fd={}, size={}", msg->attr.ino,
-                static_cast<void *>(msg->req), msg->req->ch->fd, msg->attr.attr.st_size
+                logger, "Received FuseReplyEntry, ino={}, id={}, size={}", entry->ino, msg->id, entry->attr.st_size
             );
 
-            if (auto ret = fuse_reply_entry(msg->req, &msg->attr); ret < 0) {
-                throw std::system_error(-ret, std::generic_category(), "fuse_reply_entry failure");
+            auto pending = complete(msg->id);
+            if (!pending) {
+                break;
+            }
+            if (pending->resolving != RemoteInodes::unresolved) {
+                resolved(pending->resolving, entry->ino);
+                break;
+            }
+            entry->ino = entry->attr.st_ino = inodes.add(pending->ino, pending->name, entry->ino);
+            entry->attr_timeout = entry->entry_timeout = seconds(attributes->ttl());
+            attributes->update(entry->ino, entry->attr);
+            content_seen(entry->ino, entry->attr);
+            if (pending->refreshing == RemoteInodes::unresolved) {
+                this->reply(pending->unique, fuse::entry_out(*entry));
             }
             break;
         }
         case std::byte{2}: {
-            auto &msg =
-                *reinterpret_cast<const messages::responses::FuseReplyAttr *>(old_callback->get_storage().data());
-            LOG_DEBUG(
-                logger, "Received FuseReplyAttr, req={}, fd={}, fd={}", static_cast<void *>(msg.req), fuse_fd,
-                msg.req->ch->fd
-            );
-            if (auto ret = fuse_reply_attr(msg.req, &msg.attr, 1.0); ret < 0) {
-                throw std::system_error(-ret, std::generic_category(), "fuse_reply_attr failure");
+            auto &msg = *reinterpret_cast<const messages::responses::FuseReplyAttr *>(reply.data());
+            auto attr = msg.attr();
+            if (!attr) {
+                throw std::system_error(EPROTO, std::generic_category(), "Malformed FuseReplyAttr");
+            }
+            LOG_DEBUG(logger, "Received FuseReplyAttr, id={}, fd={}", msg.id, fuse_fd);
+            auto pending = complete(msg.id);
+            if (!pending) {
+                break;
+            }
+            attr->st_ino = pending->ino;
+            attributes->update(pending->ino, *attr);
+            content_seen(pending->ino, *attr);
+            if (pending->refreshing == RemoteInodes::unresolved) {
+                this->reply(pending->unique, fuse::attr_out(*attr, seconds(attributes->ttl())));
             }
             break;
         }
         case std::byte{3}: {
-            auto &msg =
-                *reinterpret_cast<const messages::responses::FuseReplyOpen *>(old_callback->get_storage().data());
+            auto &msg = *reinterpret_cast<const messages::responses::FuseReplyOpen *>(reply.data());
 
-            LOG_DEBUG(logger, "Received FuseReplyOpen, req={}", static_cast<void *>(msg.req));
-            if (auto ret = fuse_reply_open(msg.req, &msg.file_info); ret < 0) {
-                throw std::system_error(-ret, std::generic_category(), "fuse_reply_open failure");
+            LOG_DEBUG(logger, "Received FuseReplyOpen, id={}, keep_cache={}", msg.id, msg.file_info.keep_cache != 0);
+            auto pending = complete(msg.id);
+            if (!pending) {
+                break;
             }
+            {
+                auto guard = std::scoped_lock{contents_lock};
+                contents[pending->ino] = msg.version;
+            }
+            if (msg.pushed > 0 && pending->connection) {
+                pending_pushes[pending->ino] = {.connection = *pending->connection, .remaining = msg.pushed};
+            }
+            this->reply(pending->unique, fuse::open_out(msg.file_info));
             break;
         }
         case std::byte{4}: {
-            fuse_reply_data(std::move(old_callback));
+            fuse_reply_data(reply, owner);
             break;
         }
         case std::byte{5}: {
-            auto &msg =
-                *reinterpret_cast<const messages::responses::FuseReplyErr *>(old_callback->get_storage().data());
-            LOG_WARNING(
-                logger, "Received error for req {}: {}", static_cast<void *>(msg.req), std::strerror(msg.error_code)
-            );
-            if (auto ret = fuse_reply_err(msg.req, msg.error_code); ret < 0) {
-                throw std::system_error(-ret, std::generic_category(), "fuse_reply_err failure");
+            auto &msg = *reinterpret_cast<const messages::responses::FuseReplyErr *>(reply.data());
+            if (msg.error_code != 0) {
+                LOG_WARNING(logger, "Received error for request {}: {}", msg.id, std::strerror(msg.error_code));
+            }
+            // The server forgot the inode, most likely because it restarted. It is resolved again once.
+            auto *entry = requests.find(msg.id);
+            if (msg.error_code == ESTALE && entry != nullptr && !entry->request.retried &&
+                entry->request.ino != RemoteInodes::root) {
+                entry->request.retried = true;
+                inodes.invalidate(entry->request.ino);
+                send_request(msg.id);
+                break;
+            }
+            fail(msg.id, msg.error_code);
+            break;
+        }
+        case std::byte{6}:
+            return fuse_reply_chunk(reply) ? 1 : 0;
+        case std::byte{13}:
+            fuse_push(reply);
+            return 0;
+        case std::byte{8}: {
+            auto completed = 0;
+            FuseReplyBatch::for_each(reply, [this, &completed](auto batched) { completed += dispatch_reply(batched); });
+            return completed;
+        }
+        case std::byte{9}:
+            fuse_reply_compressed(reply);
+            break;
+        case std::byte{10}:
+            fuse_reply_raw(reply, owner);
+            break;
+        case std::byte{11}: {
+            const auto &msg = *reinterpret_cast<const messages::responses::FuseReplyWrite *>(reply.data());
+            LOG_DEBUG(logger, "Received FuseReplyWrite, id={}, size={}", msg.id, msg.size);
+            auto pending = complete(msg.id);
+            if (!pending) {
+                break;
+            }
+            // The server changed the size and times. The pages of the kernel are up to date, but the next open can't
+            // tell.
+            attributes->invalidate(pending->ino);
+            forget_content(pending->ino);
+            this->reply(pending->unique, fuse_write_out{.size = msg.size});
+            break;
+        }
+        case std::byte{12}: {
+            const auto &msg = *reinterpret_cast<const messages::responses::FuseReplyCreate *>(reply.data());
+            auto entry = msg.entry();
+            if (!entry) {
+                throw std::system_error(EPROTO, std::generic_category(), "Malformed FuseReplyCreate");
+            }
+            LOG_DEBUG(logger, "Received FuseReplyCreate, ino={}, id={}", entry->ino, msg.id);
+            auto pending = complete(msg.id);
+            if (!pending) {
+                break;
             }
+            entry->ino = entry->attr.st_ino = inodes.add(pending->ino, pending->name, entry->ino);
+            entry->attr_timeout = entry->entry_timeout = seconds(attributes->ttl());
+            attributes->update(entry->ino, entry->attr);
+            this->reply(pending->unique, fuse::create_out(*entry, msg.file_info));
             break;
         }
         default:
             assert(false);
     }
 
-    io_uring.read_fixed(socket, 0, std::move(callable));
+    return 1;
 }
 
 void Client::fuse_callback(
     int syscall_ret, std::unique_ptr<CallbackWithStorageAbstract<std::array<std::byte, FUSE_REQUEST_SIZE>>> callback
 ) {
     LOG_TRACE_L2(logger, "Fuse callback: {}", syscall_ret);
-    if (syscall_ret <= 0 && syscall_ret != -EINTR) {
-        throw std::system_error(-syscall_ret, std::generic_category(), "fuse reading failure");
-    } else if (syscall_ret <= 0) {
+    auto view = std::span{callback->get_storage()};
+    // ENOENT: the request was interrupted before being read. The read is posted again, or there would be one less.
+    if (syscall_ret == -EINTR || syscall_ret == -ENOENT || syscall_ret == -EAGAIN) {
+        io_uring.read(fuse_fd, view, 0, std::move(callback));
         return;
     }
-    auto fuse_buffer = fuse_buf{.size = static_cast<size_t>(syscall_ret), .mem = callback->get_storage().data()};
-    // fuse_session_process_buf_int could be called with fuse_channel, but this method is not exposed by libfuse.
+    if (syscall_ret <= 0) {
+        throw std::system_error(-syscall_ret, std::generic_category(), "fuse reading failure");
+    }
+    auto request = fuse::decode(view.first(static_cast<std::size_t>(syscall_ret)));
+    if (!request) {
+        throw std::system_error(EPROTO, std::generic_category(), "Malformed fuse request");
+    }
+
+    // Init, forget, interrupt and the operations not implemented natively go through libfuse.
+    if (!dispatch_request(*request)) {
+        if (request->header->opcode == FUSE_INIT && static_fuse_uring) {
+            fuse_init(*request, view.first(static_cast<std::size_t>(syscall_ret)));
+        } else {
+            process_with_libfuse(view.first(static_cast<std::size_t>(syscall_ret)), fuse_fd);
+        }
+    }
+    io_uring.read(fuse_fd, view, 0, std::move(callback));
+}
+
+bool Client::dispatch_request(const fuse::InRequest &request) {
+    auto opcode = request.header->opcode;
+    const auto &operations = static_tunnel ? tunneled_operations : native_operations;
+    auto handler = opcode < fuse::max_opcode ? operations[opcode] : nullptr;
+    if (handler == nullptr) {
+        return false;
+    }
+    (this->*handler)(request);
+    return true;
+}
+
+void Client::process_with_libfuse(std::span<std::byte> buffer, int reply_fd) {
+    // fuse_session_process_buf_int could be called with a channel, but this method is not exposed by libfuse.
+    auto fuse_buffer = fuse_buf{.size = buffer.size(), .mem = buffer.data()};
+    auto lock = std::scoped_lock{fuse_session_lock};
     auto backup_fd = fuse_session->fd;
-    fuse_session->fd = fuse_fd;
+    fuse_session->fd = reply_fd;
     fuse_session_process_buf(fuse_session, &fuse_buffer);
     fuse_session->fd = backup_fd;
-    auto view = std::span{callback->get_storage()};
-    //    io_uring.read_fixed(fuse_fd, view, std::move(callback));
-    io_uring.read(fuse_fd, view, 0, std::move(callback));
 }
 
-void Client::start(const std::string &address) {
-    socket = remotefs::Socket::connect(
-        address, 6512,
-        {.rx_buffer_size = 10 * settings::MAX_MESSAGE_SIZE,
-         .tx_buffer_size = 10 * settings::MAX_MESSAGE_SIZE,
-         .delivery_point = settings::MAX_MESSAGE_SIZE}
+void Client::fuse_init(const fuse::InRequest &request, std::span<std::byte> buffer) {
+    const auto *arguments = request.get<fuse_init_in>();
+    if (arguments == nullptr || (arguments->flags & FUSE_INIT_EXT) == 0 ||
+        (arguments->flags2 & (fuse::over_io_uring >> 32)) == 0) {
+        LOG_WARNING(logger, "The kernel doesn't offer FUSE over io_uring, requests are read from /dev/fuse");
+        process_with_libfuse(buffer, fuse_fd);
+        return;
+    }
+
+    // libfuse doesn't know about the flag, its reply goes through a pipe to add it.
+    auto pipe = SplicePipe{};
+    process_with_libfuse(buffer, pipe.write_end);
+    auto reply = std::array<std::byte, sizeof(fuse_out_header) + sizeof(fuse_init_out)>{};
+    auto size = ::read(pipe.read_end, reply.data(), reply.size());
+    if (size < 0) {
+        throw std::system_error(errno, std::generic_category(), "Failed to read the reply to FUSE_INIT");
+    }
+
+    auto header = fuse_out_header{};
+    auto out = fuse_init_out{};
+    if (static_cast<std::size_t>(size) >= sizeof(header) + offsetof(fuse_init_out, flags2) + sizeof(out.flags2)) {
+        std::memcpy(&header, reply.data(), sizeof(header));
+        std::memcpy(&out, reply.data() + sizeof(header), static_cast<std::size_t>(size) - sizeof(header));
+    }
+    if (header.error == 0 && header.len == static_cast<std::uint32_t>(size)) {
+        out.flags |= FUSE_INIT_EXT;
+        out.flags2 |= fuse::over_io_uring >> 32;
+        std::memcpy(reply.data() + sizeof(header), &out, static_cast<std::size_t>(size) - sizeof(header));
+        fuse_uring_negotiated.test_and_set();
+        LOG_INFO(logger, "Negotiated FUSE over io_uring");
+    }
+    if (::write(fuse_fd, reply.data(), static_cast<std::size_t>(size)) != size) {
+        throw std::system_error(errno, std::generic_category(), "Failed to reply to FUSE_INIT");
+    }
+}
+
+void Client::register_fuse_uring() {
+    fuse_uring_registered = true;
+    // The kernel has a queue per possible cpu, and uses the ring once all of them have entries. Thread i takes the
+    // cpus i, i + threads, etc. which, with --pin, includes the one it runs on.
+    auto queues = static_cast<unsigned>(get_nprocs_conf());
+    for (auto queue = thread_index; queue < queues; queue += static_threads) {
+        for (auto i = 0u; i < static_fuse_reads; i++) {
+            auto &entry = *ring_entries.emplace_back(std::make_unique<RingEntry>());
+            entry.payload = std::make_unique_for_overwrite<std::byte[]>(ring_payload_size);
+            entry.queue = narrow_cast<std::uint16_t>(queue);
+            entry.iov = {
+                iovec{.iov_base = &entry.headers, .iov_len = sizeof(entry.headers)},
+                iovec{.iov_base = entry.payload.get(), .iov_len = ring_payload_size}};
+            ring_command(entry, fuse::uring_cmd_register);
+        }
+    }
+    LOG_INFO(logger, "Registered {} fuse ring entries", ring_entries.size());
+}
+
+void Client::ring_command(RingEntry &entry, std::uint32_t command) {
+    auto cmd = fuse::UringCommand{
+        .flags = 0,
+        .commit_id = command == fuse::uring_cmd_commit_and_fetch ? entry.headers.entry.commit_id : 0,
+        .queue = entry.queue,
+        .padding = {}};
+    auto buffers = command == fuse::uring_cmd_register ? std::span<const iovec>{entry.iov} : std::span<const iovec>{};
+    auto callback = io_uring.get_unregistered_callback<RingEntry *>(
+        [this](int32_t syscall_ret, auto callback) { fuse_uring_callback(*callback->get_storage(), syscall_ret); },
+        &entry
     );
-    //    io_uring.assign_file((socket_uring_idx = 1), socket);
+    io_uring.uring_cmd(fuse_fd, command, singular_bytes(cmd), buffers, std::move(callback));
+}
+
+void Client::fuse_uring_callback(RingEntry &entry, int syscall_ret) {
+    if (syscall_ret < 0) {
+        // Refused by a kernel without FUSE over io_uring after all, or on unmount. Requests keep coming from the
+        // /dev/fuse reads, which are always posted.
+        LOG_WARNING(
+            logger, "Fuse ring command failed on queue {}: {}, requests are read from /dev/fuse", entry.queue,
+            std::strerror(-syscall_ret)
+        );
+        return;
+    }
+
+    auto request = fuse::decode(entry.headers, std::span{entry.payload.get(), ring_payload_size}, ring_request);
+    if (!request) {
+        throw std::system_error(EPROTO, std::generic_category(), "Malformed fuse ring request");
+    }
+    LOG_TRACE_L2(logger, "Fuse ring request, opcode={}, queue={}", request->header->opcode, entry.queue);
+    ring_requests.emplace(request->header->unique, &entry);
+    if (!dispatch_request(*request)) {
+        fuse_reply_default(*request);
+    }
+}
+
+void Client::commit(RingEntry &entry, const fuse_out_header &header, std::span<const std::byte> payload) {
+    assert(payload.size() <= ring_payload_size);
+    std::memcpy(entry.headers.in_out.data(), &header, sizeof(header));
+    std::ranges::copy(payload, entry.payload.get());
+    entry.headers.entry.payload_size = narrow_cast<std::uint32_t>(payload.size());
+    ring_command(entry, fuse::uring_cmd_commit_and_fetch);
+}
+
+void Client::fuse_reply_default(const fuse::InRequest &request) {
+    auto unique = request.header->unique;
+    switch (request.header->opcode) {
+        case FUSE_OPENDIR:
+            reply(unique, fuse_open_out{});
+            break;
+        case FUSE_RELEASEDIR:
+            reply(unique, 0);
+            break;
+        case FUSE_STATFS:
+            reply(unique, fuse_statfs_out{.st = {.bsize = 512, .namelen = 255}});
+            break;
+        default:
+            reply(unique, ENOSYS);
+    }
+}
+
+void Client::fuse_lookup(const fuse::InRequest &request) {
+    const auto *name = request.name();
+    if (name == nullptr || std::strlen(name) > PATH_MAX) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    auto parent = fuse_ino_t{request.header->nodeid};
+    if (auto ino = inodes.find(parent, name); ino != RemoteInodes::unresolved) {
+        if (auto cached = attributes->find(ino)) {
+            auto timeout = seconds(cached->fresh_for);
+            reply(
+                request.header->unique,
+                fuse::entry_out({.ino = ino, .attr = cached->attr, .attr_timeout = timeout, .entry_timeout = timeout})
+            );
+            if (cached->refresh) {
+                LOG_TRACE_L1(logger, "Refreshing lookup for {}/{}", parent, name);
+                submit(
+                    {.unique = 0,
+                     .ino = parent,
+                     .send = lookup_sender(name),
+                     .replayable = true,
+                     .name = name,
+                     .refreshing = ino}
+                );
+            }
+            return;
+        }
+    }
+
+    LOG_TRACE_L1(logger, "Sending lookup for {}/{}, unique={}", parent, name, request.header->unique);
+    submit(
+        {.unique = request.header->unique,
+         .ino = parent,
+         .send = lookup_sender(name),
+         .replayable = true,
+         .name = name}
+    );
+}
+
+void Client::fuse_getattr(const fuse::InRequest &request) {
+    auto ino = fuse_ino_t{request.header->nodeid};
+    if (auto cached = attributes->find(ino)) {
+        reply(request.header->unique, fuse::attr_out(cached->attr, seconds(cached->fresh_for)));
+        if (cached->refresh) {
+            LOG_TRACE_L1(logger, "Refreshing getattr for {}", ino);
+            submit({.unique = 0, .ino = ino, .send = getattr_sender(), .replayable = true, .refreshing = ino});
+        }
+        return;
+    }
+
+    LOG_TRACE_L1(logger, "Sending getattr, unique={}, fd={}", request.header->unique, fuse_fd);
+    submit({.unique = request.header->unique, .ino = ino, .send = getattr_sender(), .replayable = true});
+}
+
+void Client::fuse_open(const fuse::InRequest &request) {
+    const auto *arguments = request.get<fuse_open_in>();
+    if (arguments == nullptr) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    if ((arguments->flags & O_TRUNC) != 0) {
+        attributes->invalidate(request.header->nodeid);
+        content_changed(request.header->nodeid);
+    }
+
+    LOG_TRACE_L1(logger, "Sending open, unique={}", request.header->unique);
+    auto send = [this, file_info = fuse_file_info{.flags = static_cast<int>(arguments->flags)},
+                 cached = cached_content(request.header->nodeid), ino = fuse_ino_t{request.header->nodeid}](
+                    Connection &connection, messages::RequestId id, fuse_ino_t server_ino
+                ) {
+        auto callback = io_uring.get_callback<messages::requests::Open>([](int) {});
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_ino;
+        callback->get_storage().file_info = file_info;
+        callback->get_storage().cached = cached;
+        callback->get_storage().client_ino = ino;
+        connection.send(std::move(callback));
+    };
+    // Opens have side effects on the server, they fail with EIO instead of being sent twice.
+    submit({.unique = request.header->unique, .ino = request.header->nodeid, .send = send, .replayable = false});
+}
+
+void Client::fuse_read(const fuse::InRequest &request) {
+    const auto *arguments = request.get<fuse_read_in>();
+    if (arguments == nullptr) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    LOG_TRACE_L1(
+        logger, "Sending read for {} of size {}, unique={}", request.header->nodeid, arguments->size,
+        request.header->unique
+    );
+    if (static_read_stripe != 0 && arguments->size != 0) {
+        read_striped(request.header->nodeid, request.header->unique, arguments->offset, arguments->size);
+        return;
+    }
+    submit(
+        {.unique = request.header->unique,
+         .ino = request.header->nodeid,
+         .send = read_sender(arguments->offset, arguments->size),
+         .replayable = true}
+    );
+}
+
+void Client::read_striped(fuse_ino_t ino, std::uint64_t unique, std::uint64_t offset, std::uint32_t size) {
+    auto stripe = std::uint64_t{static_read_stripe};
+    auto end = offset + size;
+    auto *readahead = static_readahead != 0 ? &readaheads[ino] : nullptr;
+    if (readahead != nullptr) {
+        // Another thread may have handled a change of the file since its stripes were read.
+        if (auto changed = content_changes(ino); readahead->changes != changed) {
+            *readahead = Readahead{.changes = changed};
+        }
+    }
+    auto sequential = readahead != nullptr && offset == std::exchange(readahead->next, end);
+    // The stripe read ahead holding [part, part_end), forgotten once read up to its end.
+    auto take = [readahead, stripe](std::uint64_t part, std::uint64_t part_end) {
+        auto taken = std::shared_ptr<ReadaheadStripe>{};
+        if (readahead == nullptr) {
+            return taken;
+        }
+        auto aligned = part / stripe * stripe;
+        if (auto found = readahead->stripes.find(aligned); found != readahead->stripes.end()) {
+            taken = found->second;
+            if (part_end == aligned + stripe) {
+                readahead->stripes.erase(found);
+            }
+        }
+        return taken;
+    };
+
+    // Aligned, for the stripes read ahead to be found again.
+    auto parts = std::vector<std::pair<std::uint64_t, std::uint64_t>>{};
+    for (auto part = offset; part < end; part = (part / stripe + 1) * stripe) {
+        parts.emplace_back(part, std::min(end, (part / stripe + 1) * stripe));
+    }
+
+    if (parts.size() == 1 && (readahead == nullptr || !readahead->stripes.contains(offset / stripe * stripe))) {
+        // Replied to as is, without being copied.
+        submit({.unique = unique, .ino = ino, .send = read_sender(offset, size), .replayable = true});
+    } else {
+        auto read = std::make_shared<StripedRead>(StripedRead{
+            .unique = unique,
+            .data = std::make_unique_for_overwrite<std::byte[]>(size),
+            .size = size,
+            .parts = parts.size()});
+        for (auto [part, part_end] : parts) {
+            auto into = [this, read, at = part - offset, requested = part_end - part](
+                            int error, std::span<const std::byte> data
+                        ) {
+                if (error != 0) {
+                    read->error = error;
+                } else {
+                    data = data.first(std::min<std::size_t>(data.size(), requested));
+                    std::ranges::copy(data, &read->data[at]);
+                    if (data.size() < requested) {
+                        read->size = std::min(read->size, at + data.size());
+                    }
+                }
+                if (--read->parts != 0) {
+                    return;
+                }
+                if (read->error != 0) {
+                    reply(read->unique, read->error);
+                } else {
+                    reply(read->unique, std::move(read->data), read->size);
+                }
+            };
+
+            auto ahead = take(part, part_end);
+            if (!ahead) {
+                read_stripe(ino, part, narrow_cast<std::uint32_t>(part_end - part), std::move(into));
+                continue;
+            }
+            auto slice = [into = std::move(into), from = part % stripe, to = part_end - part / stripe * stripe](
+                             int error, std::span<const std::byte> data
+                         ) mutable {
+                auto first = std::min<std::size_t>(from, data.size());
+                into(error, data.subspan(first, std::min<std::size_t>(to, data.size()) - first));
+            };
+            if (ahead->error) {
+                slice(*ahead->error, ahead->data);
+            } else {
+                ahead->waiting.emplace_back(std::move(slice));
+            }
+        }
+    }
+
+    if (sequential) {
+        read_ahead(ino, offset, end);
+    }
+}
+
+void Client::read_stripe(fuse_ino_t ino, std::uint64_t offset, std::uint32_t size, ReadInto read_into) {
+    submit(
+        {.unique = 0,
+         .ino = ino,
+         .send = read_sender(offset, size),
+         .replayable = true,
+         .read_into = std::move(read_into)}
+    );
+}
+
+void Client::read_ahead(fuse_ino_t ino, std::uint64_t offset, std::uint64_t end) {
+    auto stripe = std::uint64_t{static_read_stripe};
+    auto &readahead = readaheads[ino];
+    // The reader went past these.
+    readahead.stripes.erase(readahead.stripes.begin(), readahead.stripes.lower_bound(offset / stripe * stripe));
+
+    // Nothing is read ahead past the end of the file, when its size is known.
+    auto cached = attributes->find(ino);
+    auto file_size =
+        cached ? narrow_cast<std::uint64_t>(cached->attr.st_size) : std::numeric_limits<std::uint64_t>::max();
+    auto first = (end + stripe - 1) / stripe * stripe;
+    for (auto next = first; next < first + static_readahead * stripe && next < file_size; next += stripe) {
+        if (readahead.stripes.contains(next)) {
+            continue;
+        }
+
+        LOG_TRACE_L2(logger, "Reading ahead {} at {}", ino, next);
+        auto ahead = std::make_shared<ReadaheadStripe>();
+        readahead.stripes.emplace(next, ahead);
+        read_stripe(ino, next, narrow_cast<std::uint32_t>(stripe), [ahead](int error, std::span<const std::byte> data) {
+            ahead->data.assign(data.begin(), data.end());
+            ahead->error = error;
+            for (auto &waiting : std::exchange(ahead->waiting, {})) {
+                waiting(error, ahead->data);
+            }
+        });
+    }
+}
 
-    for (auto i = 0; i < 1; i++) {
+void Client::fuse_write(const fuse::InRequest &request) {
+    const auto *arguments = request.get<fuse_write_in>();
+    if (arguments == nullptr || request.arguments.size() < sizeof(fuse_write_in) + arguments->size ||
+        arguments->size > WriteRequest::max_payload_size()) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    LOG_TRACE_L1(
+        logger, "Sending write for {} of size {}, unique={}", request.header->nodeid, arguments->size,
+        request.header->unique
+    );
+    // The stripes read ahead may not hold this data.
+    content_changed(request.header->nodeid);
+    // The buffer of the request is reused once it returns, the data is kept until sent.
+    auto data = request.arguments.subspan(sizeof(fuse_write_in), arguments->size);
+    auto send = [this, data = std::vector<std::byte>(data.begin(), data.end()), off = arguments->offset](
+                    Connection &connection, messages::RequestId id, fuse_ino_t server_ino
+                ) {
         auto callback =
-            io_uring.get_callback<std::array<std::byte, FUSE_REQUEST_SIZE>>([this](int32_t syscall_ret, auto callback) {
-                fuse_callback(syscall_ret, std::move(callback));
-            });
+            io_uring.get_callback<WriteRequest>([](int) {}, id, server_ino, narrow_cast<off_t>(off), std::span{data});
+        auto view = callback->get_storage().view();
+        connection.send(view, std::move(callback));
+    };
+    // Writing the same data at the same offset twice is harmless.
+    submit(
+        {.unique = request.header->unique, .ino = request.header->nodeid, .send = std::move(send), .replayable = true}
+    );
+}
+
+void Client::fuse_create(const fuse::InRequest &request) {
+    const auto *arguments = request.get<fuse_create_in>();
+    const auto *name = request.name(sizeof(fuse_create_in));
+    if (arguments == nullptr || name == nullptr || std::strlen(name) > PATH_MAX) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    auto parent = fuse_ino_t{request.header->nodeid};
+    LOG_TRACE_L1(logger, "Sending create for {}/{}, unique={}", parent, name, request.header->unique);
+    auto send = [this, name = std::string{name}, flags = arguments->flags, mode = arguments->mode](
+                    Connection &connection, messages::RequestId id, fuse_ino_t server_parent
+                ) {
+        auto callback = io_uring.get_callback<messages::requests::Create>([](int) {});
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_parent;
+        callback->get_storage().flags = flags;
+        callback->get_storage().mode = mode;
+        strcpy(callback->get_storage().path.data(), name.c_str());
+        auto view = callback->get_storage().view();
+        connection.send(view, std::move(callback));
+    };
+    // The server changes the times of the parent.
+    attributes->invalidate(parent);
+    // Like opens, creations fail with EIO instead of being sent twice.
+    submit({.unique = request.header->unique, .ino = parent, .send = send, .replayable = false, .name = name});
+}
+
+void Client::fuse_setattr(const fuse::InRequest &request) {
+    const auto *arguments = request.get<fuse_setattr_in>();
+    if (arguments == nullptr) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    auto ino = fuse_ino_t{request.header->nodeid};
+    LOG_TRACE_L1(
+        logger, "Sending setattr for {}, valid={:x}, unique={}", ino, arguments->valid, request.header->unique
+    );
+    attributes->invalidate(ino);
+    content_changed(ino);
+    auto send = [this, arguments = *arguments](Connection &connection, messages::RequestId id, fuse_ino_t server_ino) {
+        auto callback = io_uring.get_callback<messages::requests::SetAttr>([](int) {});
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_ino;
+        callback->get_storage().arguments = arguments;
+        connection.send(std::move(callback));
+    };
+    submit({.unique = request.header->unique, .ino = ino, .send = send, .replayable = true});
+}
+
+void Client::fuse_fsync(const fuse::InRequest &request) {
+    const auto *arguments = request.get<fuse_fsync_in>();
+    if (arguments == nullptr) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    LOG_TRACE_L1(logger, "Sending fsync for {}, unique={}", request.header->nodeid, request.header->unique);
+    auto send = [this, datasync = (arguments->fsync_flags & FUSE_FSYNC_FDATASYNC) != 0](
+                    Connection &connection, messages::RequestId id, fuse_ino_t server_ino
+                ) {
+        auto callback = io_uring.get_callback<messages::requests::Fsync>([](int) {});
+        callback->get_storage().datasync = datasync;
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_ino;
+        connection.send(std::move(callback));
+    };
+    submit({.unique = request.header->unique, .ino = request.header->nodeid, .send = send, .replayable = true});
+}
+
+void Client::fuse_mkdir(const fuse::InRequest &request) {
+    const auto *arguments = request.get<fuse_mkdir_in>();
+    const auto *name = request.name(sizeof(fuse_mkdir_in));
+    if (arguments == nullptr || name == nullptr || std::strlen(name) > PATH_MAX) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    auto parent = fuse_ino_t{request.header->nodeid};
+    LOG_TRACE_L1(logger, "Sending mkdir for {}/{}, unique={}", parent, name, request.header->unique);
+    auto send = [this, name = std::string{name}, mode = arguments->mode](
+                    Connection &connection, messages::RequestId id, fuse_ino_t server_parent
+                ) {
+        auto callback = io_uring.get_callback<messages::requests::Mkdir>([](int) {});
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_parent;
+        callback->get_storage().mode = mode;
+        strcpy(callback->get_storage().path.data(), name.c_str());
+        auto view = callback->get_storage().view();
+        connection.send(view, std::move(callback));
+    };
+    attributes->invalidate(parent);
+    // Replied to with an entry, like a lookup.
+    submit({.unique = request.header->unique, .ino = parent, .send = send, .replayable = false, .name = name});
+}
+
+void Client::fuse_unlink(const fuse::InRequest &request) {
+    const auto *name = request.name();
+    if (name == nullptr || std::strlen(name) > PATH_MAX) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    auto parent = fuse_ino_t{request.header->nodeid};
+    auto directory = request.header->opcode == FUSE_RMDIR;
+    LOG_TRACE_L1(
+        logger, "Sending unlink for {}/{}, directory={}, unique={}", parent, name, directory, request.header->unique
+    );
+    auto send = [this, name = std::string{name}, directory](
+                    Connection &connection, messages::RequestId id, fuse_ino_t server_parent
+                ) {
+        auto callback = io_uring.get_callback<messages::requests::Unlink>([](int) {});
+        callback->get_storage().directory = directory;
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_parent;
+        strcpy(callback->get_storage().path.data(), name.c_str());
+        auto view = callback->get_storage().view();
+        connection.send(view, std::move(callback));
+    };
+    // The link count of the file changes too, it may still be open.
+    attributes->invalidate(parent);
+    if (auto removed = inodes.find(parent, name); removed != RemoteInodes::unresolved) {
+        attributes->invalidate(removed);
+    }
+    // Removing twice would fail the second time, with ENOENT.
+    submit(
+        {.unique = request.header->unique,
+         .ino = parent,
+         .send = send,
+         .replayable = false,
+         .acknowledged = [this, parent, name = std::string{name}]() { inodes.remove(parent, name); }}
+    );
+}
+
+void Client::fuse_rename(const fuse::InRequest &request) {
+    auto parent = fuse_ino_t{request.header->nodeid};
+    // fuse_rename_in is the beginning of fuse_rename2_in, which adds the flags.
+    const auto *arguments = request.get<fuse_rename_in>();
+    auto rename2 = request.header->opcode == FUSE_RENAME2;
+    const auto *arguments2 = rename2 ? request.get<fuse_rename2_in>() : nullptr;
+    auto offset = rename2 ? sizeof(fuse_rename2_in) : sizeof(fuse_rename_in);
+    const auto *name = request.name(offset);
+    // The new name follows the name.
+    const auto *new_name = name == nullptr ? nullptr : request.name(offset + std::strlen(name) + 1);
+    if (arguments == nullptr || (rename2 && arguments2 == nullptr) || new_name == nullptr) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    auto new_parent = fuse_ino_t{arguments->newdir};
+    auto flags = arguments2 != nullptr ? arguments2->flags : 0;
+    auto message = messages::requests::Rename{.flags = flags};
+    if (!message.set_names(name, new_name)) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    LOG_TRACE_L1(
+        logger, "Sending rename of {}/{} to {}/{}, unique={}", parent, name, new_parent, new_name,
+        request.header->unique
+    );
+    auto send = [this, message, new_parent](
+                    Connection &connection, messages::RequestId id, fuse_ino_t server_parent
+                ) mutable {
+        // When the new parent was forgotten by the server, this fails with ESTALE.
+        message.id = id;
+        message.ino = server_parent;
+        message.new_ino = inodes.server_ino(new_parent);
+        auto callback = io_uring.get_callback<messages::requests::Rename>([](int) {}, std::move(message));
+        auto view = callback->get_storage().view();
+        connection.send(view, std::move(callback));
+    };
+    attributes->invalidate(parent);
+    attributes->invalidate(new_parent);
+    submit(
+        {.unique = request.header->unique,
+         .ino = parent,
+         .send = std::move(send),
+         .replayable = false,
+         .acknowledged =
+             [this, parent, name = std::string{name}, new_parent, new_name = std::string{new_name}]() {
+                 inodes.rename(parent, name, new_parent, new_name);
+             }}
+    );
+}
+
+void Client::fuse_release(const fuse::InRequest &request) {
+    auto ino = fuse_ino_t{request.header->nodeid};
+    const auto *arguments = request.get<fuse_release_in>();
+    LOG_TRACE_L1(logger, "Sending release for {}", ino);
+    content_changed(ino);
+    // Nothing to release when the server forgot the inode, or when the connection is lost.
+    auto server_ino = inodes.server_ino(ino);
+    if (auto index = next_connection(false); server_ino != RemoteInodes::unresolved && index) {
+        auto callback = io_uring.get_callback<messages::requests::Release>([](int) {});
+        callback->get_storage().ino = server_ino;
+        callback->get_storage().writable = arguments != nullptr && (arguments->flags & (O_RDWR | O_WRONLY)) != 0;
+        connections[*index].connection->send(std::move(callback));
+    }
+    // The server doesn't reply to releases.
+    reply(request.header->unique, 0);
+}
+
+void Client::fuse_readdir(const fuse::InRequest &request) {
+    const auto *arguments = request.get<fuse_read_in>();
+    if (arguments == nullptr) {
+        reply(request.header->unique, EINVAL);
+        return;
+    }
+
+    LOG_TRACE_L1(
+        logger, "Sending readdir for {} with off {} and size {}, unique={}", request.header->nodeid,
+        arguments->offset, arguments->size, request.header->unique
+    );
+    auto send = [this, size = arguments->size, off = arguments->offset](
+                    Connection &connection, messages::RequestId id, fuse_ino_t server_ino
+                ) {
+        auto callback = io_uring.get_callback<messages::requests::ReadDir>([](int) {});
+        callback->get_storage().id = id;
+        callback->get_storage().ino = server_ino;
+        callback->get_storage().size = size;
+        callback->get_storage().offset = narrow_cast<off_t>(off);
+        connection.send(std::move(callback));
+    };
+    submit({.unique = request.header->unique, .ino = request.header->nodeid, .send = send, .replayable = true});
+}
+
+void Client::tunnel(const fuse::InRequest &request) {
+    const auto &header = *request.header;
+    const auto *name = header.opcode == FUSE_LOOKUP ? request.name() : "";
+    if (name == nullptr || header.len > sizeof(messages::requests::Fuse::request)) {
+        reply(header.unique, EINVAL);
+        return;
+    }
+
+    LOG_TRACE_L1(logger, "Tunneling request, opcode={}, unique={}", header.opcode, header.unique);
+    // Opens have side effects on the server, they fail with EIO instead of being sent twice.
+    submit(
+        {.unique = header.unique,
+         .ino = header.nodeid,
+         .send = tunnel_sender(request),
+         .replayable = header.opcode != FUSE_OPEN,
+         .name = name,
+         .opcode = header.opcode}
+    );
+}
+
+void Client::start(const std::string &address) {
+    this->address = address;
+    // The server listens with SO_REUSEPORT, the connections are spread over its threads.
+    for (auto i = 0u; i < static_connections; i++) {
+        connections.push_back({connect()});
+    }
+    LOG_INFO(logger, "Connected to {} with {} connections", address, connections.size());
+    //    io_uring.assign_file((socket_uring_idx = 1), socket);
+
+    // Many reads are kept in flight, for the kernel to hand over requests without waiting for the previous ones to be
+    // processed. Their buffers are reused for the lifetime of the client, they don't take registered buffers.
+    for (auto i = 0u; i < static_fuse_reads; i++) {
+        auto callback = io_uring.get_unregistered_callback<std::array<std::byte, FUSE_REQUEST_SIZE>>(
+            [this](int32_t syscall_ret, auto callback) { fuse_callback(syscall_ret, std::move(callback)); }
+        );
         auto view = std::span{callback->get_storage()};
         io_uring.read(fuse_fd, view, 0, std::move(callback));
     }
-    {
-        io_uring.read_fixed(socket, 0, [this](int32_t syscall_ret, auto callback) {
-            read_callback(syscall_ret, std::move(callback));
-        });
+    for (auto i = 0ul; i < connections.size(); i++) {
+        if (static_splice) {
+            enable_splice(i);
+        }
+        receive(i);
     }
 
     while (!fuse_session_exited(fuse_session)) {
+        // Once the kernel accepted FUSE over io_uring, which one of the threads negotiated.
+        if (static_fuse_uring && !fuse_uring_registered && fuse_uring_negotiated.test()) {
+            register_fuse_uring();
+        }
         io_uring.queue_wait();
+        if (!std::ranges::all_of(connections, [](const auto &pooled) { return pooled.connection != nullptr; })) {
+            reconnect();
+        }
     }
 
     LOG_INFO(logger, "Done");
@@ -200,10 +1721,75 @@ Client::~Client() {
 
 void Client::common_init(int argc, char *argv[]) {
     auto args = fuse_args{argc, argv, 0};
+    auto client_options = ClientOptions{};
+    if (fuse_opt_parse(&args, &client_options, client_options_spec, nullptr) != 0) {
+        throw std::logic_error("Failed to parse command line");
+    }
+    if (client_options.transport != nullptr) {
+        static_transport = transport_from_string(client_options.transport);
+        free(client_options.transport);
+    }
+    if (client_options.connections == 0) {
+        throw std::invalid_argument("--connections must be at least 1");
+    }
+    if (client_options.threads == 0) {
+        throw std::invalid_argument("-j must be at least 1");
+    }
+    if (client_options.fuse_reads == 0) {
+        throw std::invalid_argument("--fuse-reads must be at least 1");
+    }
+    if (client_options.attr_timeout < 0 || client_options.stale_timeout < 0) {
+        throw std::invalid_argument("--attr-timeout and --stale-timeout can't be negative");
+    }
+    if (client_options.readahead != 0 && client_options.read_stripe == 0) {
+        throw std::invalid_argument("--readahead requires --read-stripe");
+    }
+    if (client_options.compression != 0 && !compression_supported) {
+        throw std::invalid_argument("--compression requires a build with LZ4");
+    }
+    static_sctp_interleave = client_options.sctp_interleave != 0;
+    static_port = client_options.port;
+    static_connections = client_options.connections;
+    static_compression = client_options.compression != 0;
+    static_threads = client_options.threads;
+    static_pin = client_options.pin != 0;
+    static_fuse_reads = client_options.fuse_reads;
+    static_splice = client_options.splice != 0;
+    static_tunnel = client_options.tunnel != 0;
+    static_fuse_uring = client_options.fuse_uring != 0;
+    static_writeback_cache = client_options.writeback_cache != 0;
+    static_read_stripe = client_options.read_stripe;
+    static_readahead = client_options.readahead;
+    attributes = std::make_unique<AttributeCache>(
+        std::chrono::duration_cast<AttributeCache::Clock::duration>(
+            std::chrono::duration<double>{client_options.attr_timeout}
+        ),
+        std::chrono::duration_cast<AttributeCache::Clock::duration>(
+            std::chrono::duration<double>{client_options.stale_timeout}
+        )
+    );
+
     auto options = FuseCmdlineOptsWrapper(args);
 
     if (options.show_help) {
         printf("usage: %s [options] <mountpoint>\n\n", argv[0]);
+        printf("    --transport=sctp|tcp   transport to the server (default: sctp)\n");
+        printf("    (a server address of the form ipc://path uses shared memory instead)\n");
+        printf("    --sctp-interleave      interleave large SCTP messages with small ones (net.sctp.intl_enable)\n");
+        printf("    --port=N               port of the server (default: 6512)\n");
+        printf("    --connections=N        connections to the server, spread over its threads (default: 1)\n");
+        printf("    --compression          accept read replies compressed with LZ4 (server needs --compression)\n");
+        printf("    -j N, --threads=N      client threads, each with its own ring and connections (default: 1)\n");
+        printf("    --pin                  pin client thread i to cpu i\n");
+        printf("    --fuse-reads=N         requests read from the kernel in parallel, per thread (default: 4)\n");
+        printf("    --splice               splice read replies from TCP sockets to the kernel without copying them\n");
+        printf("    --tunnel               forward requests of the kernel as is, the server replies in its format\n");
+        printf("    --fuse-uring           receive requests through per-cpu io_uring queues, when the kernel can\n");
+        printf("    --writeback-cache      let the kernel cache writes and send them in large batches\n");
+        printf("    --attr-timeout=SECS    attributes and entries are cached that long (default: 1)\n");
+        printf("    --stale-timeout=SECS   then answered while refreshed in the background (default: 0)\n");
+        printf("    --read-stripe=BYTES    split bigger reads in stripes read at the same time (default: 0, off)\n");
+        printf("    --readahead=N          stripes read ahead of a sequential reader, per file (default: 0)\n");
         fuse_cmdline_help();
         fuse_lowlevel_help();
         return;
@@ -223,6 +1809,7 @@ void Client::common_init(int argc, char *argv[]) {
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+    // Only init is left to libfuse, see native_operations for the others.
     const struct fuse_lowlevel_ops fuse_ops = {
         .init =
             [](void *, struct fuse_conn_info *conn) {
@@ -230,79 +1817,9 @@ void Client::common_init(int argc, char *argv[]) {
                 conn->max_readahead = std::numeric_limits<decltype(conn->max_readahead)>::max();
                 conn->max_read = FUSE_MAX_MAX_PAGES * PAGE_SIZE;
                 conn->max_write = FUSE_MAX_MAX_PAGES * PAGE_SIZE;
-            },
-        .lookup =
-            [](fuse_req_t req, fuse_ino_t parent, const char *name) {
-                auto &client = *Client::self;
-                LOG_TRACE_L1(client.logger, "Sending lookup for {}/{}, req={}", parent, name, static_cast<void *>(req));
-                auto callback = client.io_uring.get_callback<messages::requests::Lookup>([](int) {});
-                callback->get_storage().tag = std::byte{2};
-                callback->get_storage().ino = parent;
-                callback->get_storage().req = req;
-                callback->get_storage().req->ch = &client.fuse_channel;
-                strcpy(callback->get_storage().path.data(), name);
-                client.io_uring.write_fixed(client.socket, std::move(callback));
-            },
-        .getattr =
-            [](fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *) {
-                auto &client = *Client::self;
-
-                LOG_TRACE_L1(client.logger, "Sending getattr, req={}, fd={}", static_cast<void *>(req), client.fuse_fd);
-                auto callback = client.io_uring.get_callback<messages::requests::GetAttr>([](int) {});
-                callback->get_storage().req = req;
-                callback->get_storage().ino = ino;
-                callback->get_storage().req->ch = &client.fuse_channel;
-                client.io_uring.write_fixed(client.socket, std::move(callback));
-            },
-        .open =
-            [](fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
-                auto &client = *Client::self;
-                LOG_TRACE_L1(client.logger, "Sending open, req={}", static_cast<void *>(req));
-                auto callback = client.io_uring.get_callback<messages::requests::Open>([](int) {});
-                callback->get_storage().req = req;
-                callback->get_storage().ino = ino;
-                callback->get_storage().file_info = *fi;
-                callback->get_storage().req->ch = &client.fuse_channel;
-                client.io_uring.write_fixed(client.socket, std::move(callback));
-            },
-        .read =
-            [](fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *) {
-                auto &client = *Client::self;
-                LOG_TRACE_L1(
-                    client.logger, "Sending read for {} of size {}, req={}", ino, size, static_cast<void *>(req)
-                );
-                auto callback = client.io_uring.get_callback<messages::requests::Read>([](int) {});
-                callback->get_storage().req = req;
-                callback->get_storage().ino = ino;
-                callback->get_storage().size = size;
-                callback->get_storage().offset = off;
-                callback->get_storage().req->ch = &client.fuse_channel;
-                client.io_uring.write_fixed(client.socket, std::move(callback));
-            },
-        .release =
-            [](fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *) {
-                auto &client = *Client::self;
-                LOG_TRACE_L1(client.logger, "Sending release for {}", ino);
-                auto callback = client.io_uring.get_callback<messages::requests::Release>([](int) {});
-                callback->get_storage().req = req;
-                callback->get_storage().ino = ino;
-                callback->get_storage().req->ch = &client.fuse_channel;
-                client.io_uring.write_fixed(client.socket, std::move(callback));
-            },
-        .readdir =
-            [](fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *) {
-                auto &client = *Client::self;
-                LOG_TRACE_L1(
-                    client.logger, "Sending readdir for {} with off {} and size {}, req=", ino, off, size,
-                    static_cast<void *>(req)
-                );
-                auto callback = client.io_uring.get_callback<messages::requests::ReadDir>([](int) {});
-                callback->get_storage().req = req;
-                callback->get_storage().ino = ino;
-                callback->get_storage().size = size;
-                callback->get_storage().offset = off;
-                callback->get_storage().req->ch = &client.fuse_channel;
-                client.io_uring.write_fixed(client.socket, std::move(callback));
+                if (static_writeback_cache) {
+                    conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+                }
             },
     };
 #pragma GCC diagnostic pop
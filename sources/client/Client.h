@@ -4,12 +4,26 @@
 #include <fuse3/fuse_i.h>
 #include <fuse_lowlevel.h>
 
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "Config.h"
+#include "remotefs/fuse/FuseProtocol.h"
+#include "remotefs/inodecache/AttributeCache.h"
+#include "remotefs/inodecache/RemoteInodes.h"
 #include "remotefs/messages/Messages.h"
+#include "remotefs/sockets/Connection.h"
 #include "remotefs/sockets/Socket.h"
 #include "remotefs/tools/FuseOp.h"
+#include "remotefs/tools/RequestTable.h"
 #include "remotefs/uring/IoUring.h"
 
 namespace quill {
@@ -20,38 +34,330 @@ namespace remotefs {
 class Client {
     static const auto PAGE_SIZE = 4096;
     static const auto FUSE_REQUEST_SIZE = FUSE_MAX_MAX_PAGES * PAGE_SIZE + FUSE_BUFFER_HEADER_SIZE;
+    // The biggest read of the kernel, no read reply of the server is bigger.
+    static constexpr auto max_read = std::size_t{FUSE_MAX_MAX_PAGES * PAGE_SIZE};
     using FuseReplyBuf = messages::responses::FuseReplyBuf<settings::MAX_MESSAGE_SIZE>;
+    using FuseReplyChunk = messages::responses::FuseReplyChunk<settings::MAX_MESSAGE_SIZE>;
+    using FuseReplyBatch = messages::responses::Batch<settings::MAX_MESSAGE_SIZE>;
+    using FuseReplyCompressed = messages::responses::FuseReplyCompressed<settings::MAX_MESSAGE_SIZE>;
+    using FuseReplyRaw = messages::responses::FuseReplyRaw;
+    using FusePush = messages::responses::FusePush<settings::MAX_MESSAGE_SIZE>;
+    using WriteRequest = messages::requests::Write<sizeof(Connection::Buffer)>;
+    // Sends a request with the given id, about the given inode of the server.
+    using Sender = std::move_only_function<void(Connection&, messages::RequestId, fuse_ino_t)>;
+    // Takes the data of a read, empty along with an error.
+    using ReadInto = std::move_only_function<void(int, std::span<const std::byte>)>;
+
+    struct PendingRequest {
+        // Of the request of the kernel, 0 for the lookups resolving an inode again and for the refreshes.
+        std::uint64_t unique;
+        fuse_ino_t ino;  // Given to the kernel, see RemoteInodes.
+        Sender send;
+        // Sent again when its connection is lost. Only idempotent requests are.
+        bool replayable;
+        std::string name{};  // Of the entry looked up in ino, for lookups.
+        fuse_ino_t resolving = RemoteInodes::unresolved;  // Inode resolved again by this lookup.
+        // Inode whose stale attributes this getattr or lookup refreshes, the kernel was answered from the cache.
+        fuse_ino_t refreshing = RemoteInodes::unresolved;
+        std::optional<std::size_t> connection{};  // Sent on, empty while waiting.
+        bool retried = false;  // Already sent again after the server forgot ino.
+        std::uint32_t opcode = 0;  // Of the request tunneled as is to the server, 0 if it was translated.
+        // Called once the server acknowledged the change, before replying to the kernel.
+        std::move_only_function<void()> acknowledged{};
+        // For the stripes of a read, which are given to it instead of being replied to the kernel.
+        ReadInto read_into{};
+    };
+    using Requests = RequestTable<PendingRequest>;
+
+    static constexpr auto reconnect_backoff_min = std::chrono::milliseconds{100};
+    static constexpr auto reconnect_backoff_max = std::chrono::seconds{10};
 
    public:
-    explicit Client(int argc, char* argv[]);
+    // Each thread of the client runs its own, with the given index.
+    explicit Client(int argc, char* argv[], unsigned index = 0);
     ~Client();
     void start(const std::string& address);
+    // How many client threads to run, once the command line was parsed by the first one.
+    static unsigned threads();
 
    private:
     void common_init(int argc, char* argv[]);
+    void pin(unsigned index);
 
-    template <auto BufferSize>
-    void read_callback(
-        int syscall_ret, std::unique_ptr<CallbackWithStorageAbstract<std::array<std::byte, BufferSize>>> old_callback
-    );
+    // Read replies go through it from the socket to the fuse fd, see splice_reply. It is empty between two replies.
+    class SplicePipe {
+       public:
+        SplicePipe();
+        ~SplicePipe();
+        SplicePipe(const SplicePipe&) = delete;
+        SplicePipe& operator=(const SplicePipe&) = delete;
+        // Drops whatever is left of a reply that couldn't be delivered.
+        void reset();
+
+        int read_end = -1;
+        int write_end = -1;
+        std::size_t capacity = 0;
+        // A reply is being spliced to the fuse fd.
+        bool busy = false;
+    };
+
+    struct PooledConnection {
+        std::shared_ptr<Connection> connection;
+        // Requests sent and not answered yet.
+        int in_flight = 0;
+        std::unique_ptr<SplicePipe> pipe;  // With --splice, only for TCP.
+    };
+
+    // Requests go to the connection with the fewest replies pending, the next one in turn on ties. Requests without a
+    // reply, like release, are not counted. Empty if every connection is lost.
+    std::optional<std::size_t> next_connection(bool expects_reply = true);
+    std::shared_ptr<Connection> connect();
+    void receive(std::size_t index);
+    void enable_splice(std::size_t index);
+    // Writes the fuse header and the part of a read reply already received to the pipe of the connection, whose socket
+    // then splices the rest. Returns the pipe, or -1 if the reply can't be spliced.
+    int splice_reply(std::size_t index, std::span<const std::byte> received, std::size_t size);
+    // Requests in flight on a lost connection are sent again on another one, or once reconnected.
+    void disconnected(std::size_t index);
+    void reconnect();
+    void read_callback(std::size_t index, int syscall_ret, Connection::Message old_callback);
+    // Returns how many requests were answered, none for a part of a reply, many for a batch.
+    // owner is the message holding reply, if reply can take it over.
+    int dispatch_reply(std::span<const std::byte> reply, Connection::Message* owner = nullptr);
 
     void fuse_callback(
         int syscall_ret, std::unique_ptr<CallbackWithStorageAbstract<std::array<std::byte, FUSE_REQUEST_SIZE>>> buffer
     );
+    // Returns false if the request has no native handler.
+    bool dispatch_request(const fuse::InRequest& request);
+    // Replies are written to reply_fd.
+    void process_with_libfuse(std::span<std::byte> buffer, int reply_fd);
+    // Adds FUSE over io_uring to the reply of libfuse, when the kernel offers it.
+    void fuse_init(const fuse::InRequest& request, std::span<std::byte> buffer);
+    void fuse_lookup(const fuse::InRequest& request);
+    void fuse_getattr(const fuse::InRequest& request);
+    void fuse_open(const fuse::InRequest& request);
+    void fuse_read(const fuse::InRequest& request);
+    void fuse_release(const fuse::InRequest& request);
+    void fuse_readdir(const fuse::InRequest& request);
+    void fuse_write(const fuse::InRequest& request);
+    void fuse_create(const fuse::InRequest& request);
+    void fuse_setattr(const fuse::InRequest& request);
+    void fuse_fsync(const fuse::InRequest& request);
+    void fuse_mkdir(const fuse::InRequest& request);
+    // Also rmdir.
+    void fuse_unlink(const fuse::InRequest& request);
+    // Also rename2.
+    void fuse_rename(const fuse::InRequest& request);
+    // Forwards the request as is, see messages::requests::Fuse.
+    void tunnel(const fuse::InRequest& request);
+
+    // The requests of the kernel decoded by the client itself, the others go through libfuse.
+    static constexpr auto native_operations = fuse::dispatch_table<Client>({
+        {FUSE_LOOKUP, &Client::fuse_lookup},
+        {FUSE_GETATTR, &Client::fuse_getattr},
+        {FUSE_OPEN, &Client::fuse_open},
+        {FUSE_READ, &Client::fuse_read},
+        {FUSE_RELEASE, &Client::fuse_release},
+        {FUSE_READDIR, &Client::fuse_readdir},
+        {FUSE_WRITE, &Client::fuse_write},
+        {FUSE_CREATE, &Client::fuse_create},
+        {FUSE_SETATTR, &Client::fuse_setattr},
+        {FUSE_FSYNC, &Client::fuse_fsync},
+        {FUSE_MKDIR, &Client::fuse_mkdir},
+        {FUSE_UNLINK, &Client::fuse_unlink},
+        {FUSE_RMDIR, &Client::fuse_unlink},
+        {FUSE_RENAME, &Client::fuse_rename},
+        {FUSE_RENAME2, &Client::fuse_rename},
+    });
+    // With --tunnel. Releases aren't replied to by the server, and writes and other changes aren't tunneled yet, they
+    // are still translated.
+    static constexpr auto tunneled_operations = fuse::dispatch_table<Client>({
+        {FUSE_LOOKUP, &Client::tunnel},
+        {FUSE_GETATTR, &Client::tunnel},
+        {FUSE_OPEN, &Client::tunnel},
+        {FUSE_READ, &Client::tunnel},
+        {FUSE_RELEASE, &Client::fuse_release},
+        {FUSE_READDIR, &Client::tunnel},
+        {FUSE_WRITE, &Client::fuse_write},
+        {FUSE_CREATE, &Client::fuse_create},
+        {FUSE_SETATTR, &Client::fuse_setattr},
+        {FUSE_FSYNC, &Client::fuse_fsync},
+        {FUSE_MKDIR, &Client::fuse_mkdir},
+        {FUSE_UNLINK, &Client::fuse_unlink},
+        {FUSE_RMDIR, &Client::fuse_unlink},
+        {FUSE_RENAME, &Client::fuse_rename},
+        {FUSE_RENAME2, &Client::fuse_rename},
+    });
+
+    // With --fuse-uring, a buffer registered with the kernel in one of its queues. The kernel writes a request into it
+    // and waits for the reply in the same buffer, committing it fetches the next request.
+    struct RingEntry {
+        fuse::UringRequestHeader headers;
+        std::unique_ptr<std::byte[]> payload;
+        std::array<iovec, 2> iov;
+        std::uint16_t queue;
+    };
+    static constexpr auto ring_payload_size = std::size_t{FUSE_MAX_MAX_PAGES * PAGE_SIZE};
+
+    // Registers ring entries in the queues of the cpus of this thread.
+    void register_fuse_uring();
+    void ring_command(RingEntry& entry, std::uint32_t command);
+    void fuse_uring_callback(RingEntry& entry, int syscall_ret);
+    void commit(RingEntry& entry, const fuse_out_header& header, std::span<const std::byte> payload);
+    // Requests received from a ring don't go through libfuse, which replies to these on its own.
+    void fuse_reply_default(const fuse::InRequest& request);
 
-    template <auto BufferSize>
-    void fuse_reply_data(std::unique_ptr<CallbackWithStorageAbstract<std::array<std::byte, BufferSize>>> buffer);
+    // Replies to the kernel are written with io_uring, or committed to the ring entry of the request. Their payload is
+    // copied, or owned until the write completes.
+    struct Reply {
+        fuse_out_header header;
+        std::unique_ptr<std::byte[]> payload;
+        std::array<iovec, 2> iov;
+    };
+    void reply(std::uint64_t unique, int error, std::span<const std::byte> payload = {});
+    void reply(std::uint64_t unique, std::unique_ptr<std::byte[]> payload, std::size_t size);
+    template <typename Payload>
+    void reply(std::uint64_t unique, const Payload& payload) {
+        reply(unique, 0, std::as_bytes(std::span{&payload, 1}));
+    }
+    // The header of the reply is written in message, in the room reserved before payload.
+    void reply_in_place(std::uint64_t unique, Connection::Message message, std::span<const std::byte> payload);
+
+    // Requests are sent with an id, which their reply echoes.
+    void submit(PendingRequest request);
+    // Waits for ino to be resolved, or for a connection, when needed.
+    void send_request(messages::RequestId id);
+    Sender lookup_sender(std::string name);
+    Sender getattr_sender();
+    Sender read_sender(std::uint64_t offset, std::uint32_t size);
+    Sender tunnel_sender(const fuse::InRequest& request);
+    // Looks ino up again from its path, on behalf of the requests waiting for it.
+    void resolve(fuse_ino_t ino);
+    void resolved(fuse_ino_t ino, fuse_ino_t server_ino);
+    void fail(messages::RequestId id, int error);
+    // Empty, after logging it, if the request is not in flight anymore.
+    std::optional<PendingRequest> complete(messages::RequestId id);
+
+    void fuse_reply_data(std::span<const std::byte> reply, Connection::Message* owner);
+    void fuse_reply_spliced(messages::RequestId id, SplicePipe& pipe, std::size_t payload_size);
+    // Returns true once the last part arrived and the request was answered.
+    bool fuse_reply_chunk(std::span<const std::byte> reply);
+    void fuse_reply_compressed(std::span<const std::byte> reply);
+    void fuse_reply_raw(std::span<const std::byte> reply, Connection::Message* owner);
+    // Version of the pages the kernel caches for ino, unknown if it wasn't opened.
+    static messages::ContentVersion cached_content(fuse_ino_t ino);
+    static void forget_content(fuse_ino_t ino);
+    // Drops the stripes of ino read ahead by this thread, and by the others once they see it changed.
+    void content_changed(fuse_ino_t ino);
+    static std::uint64_t content_changes(fuse_ino_t ino);
+    // The kernel drops the pages of a file reopened without keep_cache by itself. Those of files kept open are dropped
+    // here, once new attributes show they changed.
+    void content_seen(fuse_ino_t ino, const struct stat& attr);
+    // Notifications are written asynchronously: the kernel may wait for the reply to a read of these pages before
+    // taking them.
+    void notify_inval(fuse_ino_t ino, std::int64_t offset = 0, std::int64_t size = 0);
+    // Stores the pushed part of a file in the page cache of the kernel.
+    void fuse_push(std::span<const std::byte> reply);
+
+    // With --read-stripe, splits the read in aligned stripes read at the same time over all the connections, or takes
+    // them from the ones read ahead.
+    void read_striped(fuse_ino_t ino, std::uint64_t unique, std::uint64_t offset, std::uint32_t size);
+    void read_stripe(fuse_ino_t ino, std::uint64_t offset, std::uint32_t size, ReadInto read_into);
+    // With --readahead, reads the stripes following end, for a sequential reader.
+    void read_ahead(fuse_ino_t ino, std::uint64_t offset, std::uint64_t end);
     quill::Logger* logger;
-    remotefs::Socket socket;
+    std::vector<PooledConnection> connections;  // A lost connection is null until reconnected.
+    std::size_t last_connection = 0;
+    std::string address;
+    std::chrono::steady_clock::time_point next_reconnect;
+    std::chrono::milliseconds reconnect_backoff = reconnect_backoff_min;
+
+    // Read replies received in parts, until all of them arrived.
+    struct PendingRead {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;  // Shortened when a part ends before what it requested, at the end of the file.
+        std::size_t total_size;  // As announced by the first part, the others must agree.
+        std::size_t received = 0;  // Requested bytes of the parts received.
+        int error = 0;
+    };
+
+    // A read of the kernel split in stripes, replied to once all of them arrived.
+    struct StripedRead {
+        std::uint64_t unique;
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;  // Shortened when a stripe ends before what it requested, at the end of the file.
+        std::size_t parts;  // Still to arrive.
+        int error = 0;
+    };
+
+    // A stripe read ahead, until the reads of the kernel took it.
+    struct ReadaheadStripe {
+        std::vector<std::byte> data;
+        std::optional<int> error{};  // Once it arrived, 0 on success.
+        std::vector<ReadInto> waiting{};  // The reads of the kernel which took it before it arrived.
+    };
+
+    struct Readahead {
+        std::uint64_t next = 0;  // Where the last read ended, reads from there are sequential.
+        std::map<std::uint64_t, std::shared_ptr<ReadaheadStripe>> stripes{};  // By offset.
+        std::uint64_t changes = 0;  // Of the file when its stripes were read, see content_changes.
+    };
+
+    Requests requests;
+    static RemoteInodes inodes;
+    static std::unique_ptr<AttributeCache> attributes;  // Once the command line was parsed.
+    // Of the files opened, updated by each open.
+    static std::unordered_map<fuse_ino_t, messages::ContentVersion> contents;
+    // Of the files written, truncated or released, by any thread.
+    static std::unordered_map<fuse_ino_t, std::uint64_t> changes;
+    static std::mutex contents_lock;
+    // Requests waiting for their inode to be resolved again, and for a connection.
+    std::unordered_map<fuse_ino_t, std::vector<messages::RequestId>> waiting_resolution;
+    std::vector<messages::RequestId> waiting_connection;
+    std::unordered_map<messages::RequestId, PendingRead> pending_reads;
+    // The pages of a file pushed after its open replace the ones the kernel kept, those which don't arrive are dropped.
+    struct PendingPush {
+        std::size_t connection;
+        std::uint64_t remaining;  // Bytes still to arrive.
+    };
+    std::unordered_map<fuse_ino_t, PendingPush> pending_pushes;
+    // Forgotten when the file changes or is released, which other threads tell through changes. Each thread follows the
+    // reads it receives.
+    std::unordered_map<fuse_ino_t, Readahead> readaheads;
+    // Replies whose payload waits in a pipe instead of the received message.
+    std::unordered_map<messages::RequestId, SplicePipe*> spliced_replies;
     IoUring io_uring;
+    unsigned thread_index;
+    std::vector<std::unique_ptr<RingEntry>> ring_entries;
+    // The ring entries of the requests being processed, by unique.
+    std::unordered_map<std::uint64_t, RingEntry*> ring_requests;
+    std::vector<std::byte> ring_request;  // The request of a ring entry, as if it was read from /dev/fuse.
+    bool fuse_uring_registered = false;
     struct fuse_session* fuse_session;
     int fuse_fd;
     int fuse_uring_idx;
     int socket_uring_idx;
-    fuse_chan fuse_channel;
 
     static thread_local Client* self;
     static struct fuse_session* static_fuse_session;
+    static Transport static_transport;
+    static bool static_sctp_interleave;
+    static int static_port;
+    static unsigned static_connections;
+    static unsigned static_threads;
+    static bool static_pin;
+    static unsigned static_fuse_reads;
+    static bool static_splice;
+    static bool static_tunnel;
+    static bool static_fuse_uring;
+    static bool static_writeback_cache;
+    static std::uint32_t static_read_stripe;
+    static unsigned static_readahead;
+    static std::atomic_flag fuse_uring_negotiated;
+    // Guards the file descriptor of the shared fuse session, swapped while processing a request.
+    static std::mutex fuse_session_lock;
+    static bool static_compression;
     static std::atomic_flag common_init_done;
 };
 }  // namespace remotefs
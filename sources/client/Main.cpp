@@ -15,16 +15,17 @@ int main(int argc, char* argv[]) {
 
     auto args = std::span(argv, argc);
 
+    auto run = [](int argc, char* argv[], auto args, unsigned index) {
+        LOG_DEBUG(quill::get_logger(), "Ready to start");
+        auto client = remotefs::Client(argc - 1, argv, index);
+        client.start(args.back());
+    };
+
+    // The first thread parses the command line, which says how many others to start.
     auto threads = std::vector<std::jthread>{};
-    for (auto i = 0; i < 1; i++) {
-        threads.emplace_back(
-            [](int argc, char* argv[], auto args) {
-                LOG_DEBUG(quill::get_logger(), "Ready to start");
-                auto client = remotefs::Client(argc - 1, argv);
-                client.start(args.back());
-            },
-            argc, argv, args
-        );
+    threads.emplace_back(run, argc, argv, args, 0u);
+    for (auto i = 1u; i < remotefs::Client::threads(); i++) {
+        threads.emplace_back(run, argc, argv, args, i);
     }
 
     LOG_INFO(logger, "Waiting for workers");
@@ -9,7 +9,7 @@ int main(int argc, char* argv[]) {
     int verbosity = 0;
 
     // Positional arguments
-    program.add_argument("address").help("address to bind to");
+    program.add_argument("address").help("address to bind to, or ipc://path for clients on the same host");
     program.add_argument("port").help("port to bind to").scan<'d', int>().default_value(6512);
 
     // Basic options
@@ -37,6 +37,9 @@ int main(int argc, char* argv[]) {
         .scan<'d', int>();
 
     // Socket options
+    program.add_argument("--transport")
+        .help("sctp or tcp. TCP messages are framed by a length header.")
+        .default_value(std::string{"sctp"});
     program.add_argument("-r", "--rx-buffer-size")
         .help("How big the socket's RX buffer is.")
         .default_value(10l * remotefs::settings::MAX_MESSAGE_SIZE)
@@ -56,6 +59,13 @@ int main(int argc, char* argv[]) {
         .help("Enable SCTP ordered delivery.")
         .default_value(false)
         .implicit_value(true);
+    program.add_argument("--sctp-interleave")
+        .help(
+            "Interleave large SCTP messages with the small ones of other streams. "
+            "Needs net.sctp.intl_enable=1, ignored otherwise."
+        )
+        .default_value(false)
+        .implicit_value(true);
     program.add_argument("-n", "--nagle").help("Enable the nagle's algorithm.").default_value(false);
     program.add_argument("-R", "--disable-fragment")
         .help(
@@ -98,6 +108,42 @@ int main(int argc, char* argv[]) {
         .help("How long to maximally wait for --min-batch.")
         .scan<'d', long>()
         .default_value(duration_cast<std::chrono::nanoseconds>(remotefs::IoUring::wait_timeout_default).count());
+    program.add_argument("--latency-budget")
+        .help(
+            "Adapt --min-batch and the wait timeout to the load so that completions wait at most this long (ns). "
+            "0 disables it."
+        )
+        .scan<'d', long>()
+        .default_value(0l);
+    program.add_argument("--zero-copy-threshold")
+        .help("Send read replies at least this big (bytes) without copying them. 0 disables it. Not supported by SCTP.")
+        .scan<'d', std::size_t>()
+        .default_value(std::size_t{0});
+    program.add_argument("--read-chunk-size")
+        .help(
+            "Reply to reads bigger than this (bytes) in parts of this size, read from the disk and sent in parallel. "
+            "The delivery point (--chunk-size) is a good start. 0 disables it."
+        )
+        .scan<'d', std::size_t>()
+        .default_value(std::size_t{0});
+    program.add_argument("--compression")
+        .help(
+            "Compress read replies with LZ4 for the clients that accept it. Each file is sampled, and compression "
+            "backs off for the files that don't compress well."
+        )
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--read-write")
+        .help("Accept writes, file creations and attribute changes. The directory is served read-only otherwise.")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--push-cap")
+        .help(
+            "Send the content of the files of at most this size (bytes) right after they are opened for reading, for "
+            "the client to store in the page cache of the kernel. 0 disables it."
+        )
+        .scan<'d', std::size_t>()
+        .default_value(std::size_t{0});
     program.add_argument("--buffers-alignment")
         .help("Override default buffers alignment")
         .scan<'d', std::size_t>()
@@ -111,6 +157,11 @@ int main(int argc, char* argv[]) {
         std::exit(1);
     }
 
+    if (program.get<bool>("--compression") && !remotefs::compression_supported) {
+        std::cerr << "--compression requires a build with LZ4" << std::endl;
+        std::exit(1);
+    }
+
     auto cfg = quill::Config{.enable_console_colours = true};
     quill::configure(cfg);
     quill::start(true);
@@ -146,17 +197,22 @@ int main(int argc, char* argv[]) {
         64,
         program.get<bool>("--ordered-delivery"),
         !program.get<bool>("--nagle"),
-        program.get<bool>("--disable-fragment")};
+        program.get<bool>("--disable-fragment"),
+        remotefs::transport_from_string(program.get("--transport")),
+        program.get<bool>("--sctp-interleave")};
 
     LOG_DEBUG(logger, "Ready to start");
     auto server = remotefs::Server(
         program.get("address"), program.get<int>("port"), socket_options, program.get<bool>("--metrics"),
-        program.get<int>("--ring-depth"), program.get<int>("--register-buffers"), program.get<int>("--threads")
+        program.get<int>("--ring-depth"), program.get<int>("--register-buffers"), program.get<int>("--threads"),
+        program.get<std::size_t>("--zero-copy-threshold"), program.get<std::size_t>("--read-chunk-size"),
+        program.get<bool>("--compression"), program.get<bool>("--read-write"), program.get<std::size_t>("--push-cap")
     );
 
     server.start(
         program.get<int>("--pipeline"), program.get<int>("--min-batch"),
-        std::chrono::nanoseconds{program.get<long>("--batch-wait-timeout")}, 64, program.get<bool>("--register-ring")
+        std::chrono::nanoseconds{program.get<long>("--batch-wait-timeout")},
+        std::chrono::nanoseconds{program.get<long>("--latency-budget")}, 64, program.get<bool>("--register-ring")
 
     );
 
@@ -1,6 +1,7 @@
 #include "Server.h"
 
 #include <quill/Quill.h>
+#include <sys/socket.h>
 
 #include <memory>
 #include <optional>
@@ -25,11 +26,17 @@ void signal_term_handler(int signal) {
 }
 }
 
-namespace {}
+namespace {
+// Buffers kept free for the requests being processed. Serving a request takes up to two buffers, for example a statx
+// result and the reply to send. Chunked reads and pushes take more, those fall back to the heap once the registered
+// buffers are gone.
+constexpr auto reserved_buffers = 4;
+}  // namespace
 
 Server::Server(
     const std::string& address, int port, const Socket::Options& socket_options, bool metrics_on_stop, int ring_depth,
-    int max_registered_buffers, int thread_n
+    int max_registered_buffers, int thread_n, std::size_t zero_copy_threshold, std::size_t read_chunk_size,
+    bool compression, bool read_write, std::size_t push_cap
 )
     : inode_cache{},
       threads{},
@@ -39,20 +46,32 @@ Server::Server(
     std::signal(SIGTERM, signal_term_handler);
     std::signal(SIGPIPE, SIG_IGN);
 
+    if (is_ipc_address(address) && thread_n > 1) {
+        // A unix socket path can only be bound once.
+        LOG_WARNING(logger, "Only one thread can serve {}", address);
+        thread_n = 1;
+    }
+
     for (auto i = 0; i < thread_n; i++) {
         LOG_INFO(logger, "Binding a new thread to {}", address);
+        auto socket = remotefs::Socket::listen(address, port, socket_options);
+        if (zero_copy_threshold > 0 && !socket.supports_zero_copy()) {
+            LOG_WARNING(logger, "Zero copy is not supported by this transport, disabling it");
+            zero_copy_threshold = 0;
+        }
         threads.emplace_back(
-            IoUring{ring_depth, max_registered_buffers}, remotefs::Socket::listen(address, port, socket_options),
-            inode_cache
+            IoUring{ring_depth, max_registered_buffers}, std::move(socket), inode_cache, zero_copy_threshold,
+            read_chunk_size, compression, read_write, push_cap
         );
     }
 }
 
 void Server::start(
-    int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout, int max_clients, bool register_ring
+    int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout, std::chrono::nanoseconds latency_budget,
+    int max_clients, bool register_ring
 ) {
     for (auto& thread : threads) {
-        thread.start(pipeline, min_batch_size, wait_timeout, max_clients, register_ring);
+        thread.start(pipeline, min_batch_size, wait_timeout, latency_budget, max_clients, register_ring);
     }
 }
 
@@ -65,25 +84,28 @@ void Server::join() {
 void Server::ServerThread::accept_callback(int client_socket, int pipeline) {
     if (client_socket >= 0) {
         LOG_INFO(logger, "Accepted a connection");
-        for (auto i = 0; i < pipeline; i++) {
-            io_uring.read_fixed(
-                client_socket, 0,
-                [this, client_socket = Socket{client_socket}](int syscall_ret, auto callback) mutable {
-                    read_callback(syscall_ret, std::move(client_socket), std::move(callback));
+        // Shared memory connections are only set up once the client sent its half of the handshake.
+        Connection::create(
+            io_uring, Socket{client_socket},
+            [this, pipeline](int error, std::shared_ptr<Connection> connection) {
+                if (error != 0) {
+                    LOG_ERROR(logger, "Failed to set up the connection: {}", std::strerror(error));
+                    return;
                 }
-            );
-        }
+                for (auto i = 0; i < pipeline; i++) {
+                    arm_read(connection);
+                }
+            }
+        );
     } else {
         LOG_ERROR(logger, "Error accepting a connection {}", std::strerror(-client_socket));
     }
 }
 
-template <auto MaxBufferSize>
 void Server::ServerThread::read_callback(
-    int syscall_ret, Socket client_socket,
-    std::unique_ptr<CallbackWithStorageAbstract<std::array<std::byte, MaxBufferSize>>> old_callback
+    int syscall_ret, std::shared_ptr<Connection> connection, Connection::Message old_callback
 ) {
-    auto client_socket_int = static_cast<int>(client_socket);
+    auto client_socket_int = static_cast<int>(*connection);
 
     if (syscall_ret < 0) [[unlikely]] {
         if (syscall_ret == -ECONNRESET || syscall_ret == -EPIPE || syscall_ret == -EBADF) {
@@ -92,12 +114,7 @@ void Server::ServerThread::read_callback(
         }
 
         LOG_ERROR(logger, "Read failed ({}), retrying: {}", client_socket_int, std::strerror(-syscall_ret));
-        io_uring.read_fixed(
-            client_socket_int, 0,
-            [this, client_socket = std::move(client_socket)](int syscall_ret, auto callback) mutable {
-                read_callback(syscall_ret, std::move(client_socket), std::move(callback));
-            }
-        );
+        arm_read(std::move(connection));
         return;
     }
 
@@ -113,36 +130,85 @@ void Server::ServerThread::read_callback(
             // TODO: Move all of that to a unique_ptr_reinterpret_cast helper
             // TODO: Move pointer into handler so that it can be freed sooner, and uniformize Ping handler?
             syscalls.open(
-                *reinterpret_cast<messages::requests::Open*>(old_callback->get_storage().data()), client_socket
+                *reinterpret_cast<messages::requests::Open*>(old_callback->get_storage().data()), connection
             );
             break;
         }
         case messages::requests::Lookup().tag: {
             syscalls.lookup(
-                *reinterpret_cast<messages::requests::Lookup*>(old_callback->get_storage().data()), client_socket
+                *reinterpret_cast<messages::requests::Lookup*>(old_callback->get_storage().data()), connection
             );
             break;
         }
         case messages::requests::GetAttr().tag: {
             syscalls.getattr(
-                *reinterpret_cast<messages::requests::GetAttr*>(old_callback->get_storage().data()), client_socket
+                *reinterpret_cast<messages::requests::GetAttr*>(old_callback->get_storage().data()), connection
             );
             break;
         }
         case messages::requests::ReadDir().tag: {
             syscalls.readdir(
-                *reinterpret_cast<messages::requests::ReadDir*>(old_callback->get_storage().data()), client_socket
+                *reinterpret_cast<messages::requests::ReadDir*>(old_callback->get_storage().data()), connection
             );
             break;
         }
         case messages::requests::Read().tag:
             syscalls.read(
-                *reinterpret_cast<messages::requests::Read*>(old_callback->get_storage().data()), client_socket
+                *reinterpret_cast<messages::requests::Read*>(old_callback->get_storage().data()), connection
             );
             break;
         case messages::requests::Release().tag:
             syscalls.release(*reinterpret_cast<messages::requests::Release*>(old_callback->get_storage().data()));
             break;
+        case Syscalls::WriteRequest::message_tag:  // Keeps the buffer until its data is written.
+            syscalls.write(std::move(old_callback), narrow_cast<std::size_t>(syscall_ret), connection);
+            break;
+        case messages::requests::Create().tag:
+            syscalls.create(
+                *reinterpret_cast<messages::requests::Create*>(old_callback->get_storage().data()), connection
+            );
+            break;
+        case messages::requests::SetAttr().tag:
+            syscalls.setattr(
+                *reinterpret_cast<messages::requests::SetAttr*>(old_callback->get_storage().data()), connection
+            );
+            break;
+        case messages::requests::Fsync().tag:
+            syscalls.fsync(
+                *reinterpret_cast<messages::requests::Fsync*>(old_callback->get_storage().data()), connection
+            );
+            break;
+        case messages::requests::Mkdir().tag:
+            syscalls.mkdir(
+                *reinterpret_cast<messages::requests::Mkdir*>(old_callback->get_storage().data()), connection
+            );
+            break;
+        case messages::requests::Unlink().tag:
+            syscalls.unlink(
+                *reinterpret_cast<messages::requests::Unlink*>(old_callback->get_storage().data()), connection
+            );
+            break;
+        case messages::requests::Rename().tag:
+            syscalls.rename(
+                *reinterpret_cast<messages::requests::Rename*>(old_callback->get_storage().data()), connection
+            );
+            break;
+        case messages::requests::Fuse().tag:
+            syscalls.fuse(*reinterpret_cast<messages::requests::Fuse*>(old_callback->get_storage().data()), connection);
+            break;
+        case messages::requests::Hello().tag: {
+            auto version = reinterpret_cast<messages::requests::Hello*>(old_callback->get_storage().data())->version;
+            if (version != messages::protocol_version) {
+                LOG_ERROR(
+                    logger, "Client speaks protocol version {}, expected {}. Closing socket.", version,
+                    messages::protocol_version
+                );
+                // The other reads in flight complete and drop the connection.
+                ::shutdown(client_socket_int, SHUT_RDWR);
+                return;
+            }
+            break;
+        }
         case std::byte{7}: {
             auto view = std::span{old_callback->get_storage()}.subspan(0, syscall_ret);
             auto callback = io_uring.get_callback(
@@ -155,7 +221,7 @@ void Server::ServerThread::read_callback(
                 },
                 std::move(old_callback)
             );
-            io_uring.write_fixed(client_socket_int, view, std::move(callback));
+            connection->send(view, std::move(callback));
             break;
         }
         default:
@@ -165,23 +231,53 @@ void Server::ServerThread::read_callback(
     // Release memory a bit sooner
     old_callback.reset();
 
-    io_uring.read_fixed(
-        client_socket_int, 0,
-        [this, client_socket = std::move(client_socket)](int syscall_ret, auto callback) mutable {
-            read_callback(syscall_ret, std::move(client_socket), std::move(callback));
-        }
-    );
+    arm_read(std::move(connection));
+}
+
+void Server::ServerThread::arm_read(std::shared_ptr<Connection> connection) {
+    // A read holds a buffer until the client sends something, which may never happen. Keep enough buffers to answer
+    // the requests already received.
+    if (get_pool().available() <= reserved_buffers) [[unlikely]] {
+        LOG_TRACE_L1(logger, "Running out of buffers, pausing reads from {}", static_cast<int>(*connection));
+        metric_paused_reads.increment();
+        paused_reads.push_back(std::move(connection));
+        return;
+    }
+
+    auto& connection_ref = *connection;
+    connection_ref.receive([this, connection = std::move(connection)](int syscall_ret, auto callback) mutable {
+        read_callback(syscall_ret, std::move(connection), std::move(callback));
+    });
+}
+
+void Server::ServerThread::resume_reads() {
+    while (!paused_reads.empty() && get_pool().available() > reserved_buffers) {
+        auto connection = std::move(paused_reads.front());
+        paused_reads.pop_front();
+        arm_read(std::move(connection));
+    }
+
+    auto overload_stats = io_uring.take_overload_stats();
+    metric_deferred_sqes += overload_stats.deferred_sqes;
+    metric_forced_submits += overload_stats.forced_submits;
 }
 
 void Server::ServerThread::start(
-    int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout, int max_clients, bool register_ring
+    int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout, std::chrono::nanoseconds latency_budget,
+    int max_clients, bool register_ring
 ) {
     thread = std::jthread{
         [this](
-            int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout, int max_clients, bool register_ring
+            int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout,
+            std::chrono::nanoseconds latency_budget, int max_clients, bool register_ring
         ) {
             io_uring.start();
 
+            auto batching = std::optional<AdaptiveBatching>{};
+            if (latency_budget.count() > 0) {
+                batching.emplace(latency_budget, std::max(wait_timeout, latency_budget));
+            }
+
             // TODO: Move to .start?
             if (register_ring) {
                 io_uring.register_ring();
@@ -200,11 +296,16 @@ void Server::ServerThread::start(
 
             while (!stop_requested) [[likely]] {
                 {
-                    if (auto tasks_run = io_uring.queue_wait(min_batch_size, wait_timeout)) {
+                    auto tasks_run = batching ? io_uring.queue_wait(*batching)
+                                              : io_uring.queue_wait(min_batch_size, wait_timeout);
+                    if (tasks_run) {
                         LOG_TRACE_L3(logger, "looped, {} task executed", tasks_run);
                     }
                 }
 
+                syscalls.flush_replies();
+                resume_reads();
+
                 if (log_requested) [[unlikely]] {
                     log_requested = false;
                     std::cerr << metric_registry << std::flush;
@@ -214,16 +315,23 @@ void Server::ServerThread::start(
         pipeline,
         min_batch_size,
         wait_timeout,
+        latency_budget,
         max_clients,
         register_ring};
 }
 
-Server::ServerThread::ServerThread(IoUring&& uring, Socket&& s, InodeCache& inode_cache)
+Server::ServerThread::ServerThread(
+    IoUring&& uring, Socket&& s, InodeCache& inode_cache, std::size_t zero_copy_threshold, std::size_t read_chunk_size,
+    bool compression, bool read_write, std::size_t push_cap
+)
     : thread{},
       io_uring{std::move(uring)},
       socket{std::move(s)},
-      syscalls{io_uring, inode_cache},
-      logger{quill::get_logger()} {}
+      syscalls{io_uring, inode_cache, zero_copy_threshold, read_chunk_size, compression, read_write, push_cap},
+      logger{quill::get_logger()},
+      metric_deferred_sqes{metric_registry.create_counter("deferred_sqes")},
+      metric_forced_submits{metric_registry.create_counter("forced_submits")},
+      metric_paused_reads{metric_registry.create_counter("paused_reads")} {}
 
 void Server::ServerThread::join() {
     thread.join();
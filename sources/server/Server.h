@@ -1,6 +1,7 @@
 #ifndef REMOTE_FS_SERVER_H
 #define REMOTE_FS_SERVER_H
 
+#include <deque>
 #include <string>
 #include <thread>
 #include <vector>
@@ -8,6 +9,7 @@
 #include "Config.h"
 #include "Syscalls.h"
 #include "remotefs/metrics/Metrics.h"
+#include "remotefs/sockets/Connection.h"
 #include "remotefs/sockets/Socket.h"
 #include "remotefs/uring/IoUring.h"
 
@@ -20,16 +22,20 @@ namespace remotefs {
 class Server {
     class ServerThread {
        public:
-        ServerThread(IoUring&& uring, remotefs::Socket&& socket, InodeCache& inode_cache);
-
-        template <auto MaxBufferSize>
-        void read_callback(
-            int syscall_ret, Socket client_socket,
-            std::unique_ptr<CallbackWithStorageAbstract<std::array<std::byte, MaxBufferSize>>> old_callback
+        ServerThread(
+            IoUring&& uring, remotefs::Socket&& socket, InodeCache& inode_cache, std::size_t zero_copy_threshold,
+            std::size_t read_chunk_size, bool compression, bool read_write, std::size_t push_cap
         );
+
+        void read_callback(int syscall_ret, std::shared_ptr<Connection> connection, Connection::Message old_callback);
         void accept_callback(int client_socket, int pipeline);
+        // Queues a read of the next request from the client, unless buffers are running out. The read is then paused
+        // until resume_reads finds enough free buffers.
+        void arm_read(std::shared_ptr<Connection> connection);
+        void resume_reads();
         void start(
-            int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout, int max_clients, bool register_ring
+            int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout,
+            std::chrono::nanoseconds latency_budget, int max_clients, bool register_ring
         );
         void join();
 
@@ -40,18 +46,26 @@ class Server {
         Syscalls syscalls;
         quill::Logger* logger;
         MetricRegistry<settings::DISABLE_METRICS> metric_registry{};
+        MetricRegistry<settings::DISABLE_METRICS>::Counter& metric_deferred_sqes;
+        MetricRegistry<settings::DISABLE_METRICS>::Counter& metric_forced_submits;
+        MetricRegistry<settings::DISABLE_METRICS>::Counter& metric_paused_reads;
+        // Resumed in the order they were paused, so that no client starves.
+        std::deque<std::shared_ptr<Connection>> paused_reads;
         bool register_fd = false;  // Turning this on crashes Linux 6.2.8!
     };
 
    public:
     explicit Server(
         const std::string& address, int port, const Socket::Options& socket_options, bool metrics_on_stop = false,
-        int ring_depth = remotefs::IoUring::queue_depth_default, int max_registered_buffers = 64, int thread_n = 1
+        int ring_depth = remotefs::IoUring::queue_depth_default, int max_registered_buffers = 64, int thread_n = 1,
+        std::size_t zero_copy_threshold = 0, std::size_t read_chunk_size = 0, bool compression = false,
+        bool read_write = false, std::size_t push_cap = 0
     );
     Server(const Server&) = delete;
     Server& operator=(const Server&) = delete;
     void start(
-        int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout, int max_clients, bool register_ring
+        int pipeline, int min_batch_size, std::chrono::nanoseconds wait_timeout,
+        std::chrono::nanoseconds latency_budget, int max_clients, bool register_ring
     );
     void join();
 
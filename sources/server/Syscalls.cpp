@@ -2,11 +2,18 @@
 
 #include <fuse_lowlevel.h>
 #include <quill/Quill.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <array>
+#include <cstdio>
+#include <ctime>
 #include <filesystem>
 
+#include "remotefs/fuse/FuseProtocol.h"
+#include "remotefs/sockets/Connection.h"
 #include "remotefs/uring/IoUring.h"
 
 namespace remotefs {
@@ -29,79 +36,229 @@ struct stat statx_to_stat(const struct statx input) {
         .st_ctim = {input.stx_ctime.tv_sec, input.stx_ctime.tv_nsec}};
 }
 
+// For utimensat, from the FATTR_ flags of a setattr.
+timespec time_to_set(std::uint32_t valid, std::uint32_t set, std::uint32_t now, std::uint64_t sec, std::uint32_t nsec) {
+    if ((valid & set) == 0) {
+        return {0, UTIME_OMIT};
+    }
+    if ((valid & now) != 0) {
+        return {0, UTIME_NOW};
+    }
+    return {static_cast<time_t>(sec), static_cast<long>(nsec)};
+}
+
 }  // namespace
 
-Syscalls::Syscalls(IoUring& ring, InodeCache& cache)
+Syscalls::Syscalls(
+    IoUring& ring, InodeCache& cache, std::size_t zero_copy_threshold, std::size_t read_chunk_size, bool compression,
+    bool read_write, std::size_t push_cap
+)
     : logger{quill::get_logger()},
       uring{ring},
-      inode_cache{cache} {}
+      inode_cache{cache},
+      zero_copy_threshold{zero_copy_threshold},
+      read_chunk_size{read_chunk_size},
+      compression{compression},
+      read_write{read_write},
+      push_cap{push_cap} {}
+
+template <typename Reply>
+void Syscalls::reply(
+    const std::shared_ptr<Connection>& connection, std::unique_ptr<CallbackWithStorageAbstract<Reply>> callback
+) {
+    auto source = callback->get_storage().view();
+    auto batch = std::ranges::find(batches, connection, &PendingBatch::first);
+    if (batch == batches.end()) {
+        batch = batches.emplace(batches.end(), connection, uring.get_callback<ReplyBatch>([](int) {}));
+    }
 
-void Syscalls::lookup(messages::requests::Lookup& message, int socket) {
-    auto ino = message.ino;
-    auto root_path = std::filesystem::path{inode_cache.inode_from_ino(ino).first};
+    if (!batch->second->get_storage().add(source)) {
+        send_batch(*batch);
+        batch->second = uring.get_callback<ReplyBatch>([](int) {});
+        [[maybe_unused]] auto added = batch->second->get_storage().add(source);
+        assert(added);
+    }
+}
+
+void Syscalls::send_batch(PendingBatch& batch) {
+    auto& [connection, callback] = batch;
+    LOG_TRACE_L2(logger, "Sending a batch of {} replies", callback->get_storage().count);
+    auto view = callback->get_storage().outer_view();
+    connection->send(view, std::move(callback), false, Connection::metadata_stream);
+}
+
+void Syscalls::flush_replies() {
+    for (auto& batch : batches) {
+        send_batch(batch);
+    }
+    batches.clear();
+}
+
+void Syscalls::reply_entry(
+    messages::RequestId id, std::uint64_t unique, const fuse_entry_param& entry,
+    const std::shared_ptr<Connection>& connection
+) {
+    if (unique == 0) {
+        reply(connection, uring.get_callback<messages::responses::FuseReplyEntry>([](int) {}, id, entry));
+        return;
+    }
+    auto out = fuse::entry_out(entry);
+    reply(
+        connection,
+        uring.get_callback<messages::responses::FuseReplyRaw>([](int) {}, id, unique, 0, singular_bytes(out))
+    );
+}
+
+void Syscalls::reply_attr(
+    messages::RequestId id, std::uint64_t unique, const struct stat& attr, const std::shared_ptr<Connection>& connection
+) {
+    if (unique == 0) {
+        reply(connection, uring.get_callback<messages::responses::FuseReplyAttr>([](int) {}, id, attr));
+        return;
+    }
+    auto out = fuse::attr_out(attr, 1.0);
+    reply(
+        connection,
+        uring.get_callback<messages::responses::FuseReplyRaw>([](int) {}, id, unique, 0, singular_bytes(out))
+    );
+}
+
+void Syscalls::reply_open(
+    messages::RequestId id, std::uint64_t unique, const fuse_file_info& file_info,
+    const messages::ContentVersion& version, std::uint64_t pushed, const std::shared_ptr<Connection>& connection
+) {
+    if (unique == 0) {
+        auto callback =
+            uring.get_callback<messages::responses::FuseReplyOpen>([](int) {}, id, file_info, version, pushed);
+        if (pushed != 0) {
+            // Not batched, the client must know about the push before its parts, which are sent on the same stream.
+            connection->send(std::move(callback));
+            return;
+        }
+        reply(connection, std::move(callback));
+        return;
+    }
+    auto out = fuse::open_out(file_info);
+    reply(
+        connection,
+        uring.get_callback<messages::responses::FuseReplyRaw>([](int) {}, id, unique, 0, singular_bytes(out))
+    );
+}
+
+template <typename Then>
+void Syscalls::refresh(const InodeCache::Inode& inode, Then then) {
+    // The path may change in the meantime, like the one of stat_entry it must stay alive until the ring is submitted.
+    auto path = std::make_unique<std::string>(inode.first);
+    auto* path_ptr = path.get();
+    auto ino = inode_cache.stat_of(inode).st_ino;
+    auto callback = uring.get_callback<struct statx>([this, ino, path = std::move(path),
+                                                      then = std::move(then)](int ret, auto callback) mutable {
+        using Stat = struct stat;
+        if (ret < 0) [[unlikely]] {
+            then(-ret, Stat{});
+            return;
+        }
+        auto fresh = inode_cache.update(ino, statx_to_stat(callback->get_storage()));
+        then(fresh ? 0 : ESTALE, fresh.value_or(Stat{}));
+    });
+    uring.queue_statx(AT_FDCWD, *path_ptr, std::move(callback));
+}
+
+InodeCache::Inode* Syscalls::find_inode(
+    fuse_ino_t ino, messages::RequestId id, const std::shared_ptr<Connection>& connection
+) {
+    auto* inode = inode_cache.find_ino(ino);
+    if (inode == nullptr) [[unlikely]] {
+        LOG_DEBUG(logger, "Unknown ino {} for id {}", ino, id);
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, ESTALE));
+    }
+    return inode;
+}
+
+bool Syscalls::check_writable(messages::RequestId id, const std::shared_ptr<Connection>& connection) {
+    if (!read_write) [[unlikely]] {
+        LOG_DEBUG(logger, "Refusing to change anything for id {}, the server is read-only", id);
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, EROFS));
+    }
+    return read_write;
+}
+
+void Syscalls::lookup(
+    messages::requests::Lookup& message, const std::shared_ptr<Connection>& connection, std::uint64_t unique
+) {
+    auto* parent = find_inode(message.ino, message.id, connection);
+    if (parent == nullptr) [[unlikely]] {
+        return;
+    }
+    auto root_path = std::filesystem::path{parent->first};
     auto path = std::make_unique<std::string>(root_path / message.path.data());
     LOG_DEBUG(logger, "Looking up path={}, relative={}, root={}", *path, &message.path[0], root_path.string());
 
     if (auto found = inode_cache.find(*path)) {
-        auto callback = uring.get_callback<messages::responses::FuseReplyEntry>(
-            [](int) {}, message.req,
+        auto stat = inode_cache.stat_of(*found);
+        reply_entry(
+            message.id, unique,
             fuse_entry_param{
-                .ino = found->second.stat.st_ino,
+                .ino = stat.st_ino,
                 .generation = 0,
-                .attr = found->second.stat,
+                .attr = stat,
                 .attr_timeout = 1,
-                .entry_timeout = 1}
+                .entry_timeout = 1},
+            connection
         );
-        uring.write_fixed(socket, std::move(callback));
         return;
     }
 
+    stat_entry(std::move(path), message.id, unique, connection);
+}
+
+void Syscalls::stat_entry(
+    std::unique_ptr<std::string> path, messages::RequestId id, std::uint64_t unique,
+    const std::shared_ptr<Connection>& connection
+) {
     auto* path_ptr = path.get();
 
     // path is moved into the closure because it needs to stay alive until iouring submit.
-    auto callback = uring.get_callback<struct statx>([this, req = message.req, socket,
+    auto callback = uring.get_callback<struct statx>([this, id, unique, connection,
                                                       path = std::move(path)](int ret, auto callback) mutable {
-        auto response = uring.get_callback<messages::responses::FuseReplyEntry>([](int) {}, req);
-
         if (ret < 0) [[unlikely]] {
             LOG_DEBUG(logger, "queue_statx callback failure, ret={}: {}", -ret, std::strerror(-ret));
-            auto error_response = uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, req, -ret);
-            uring.write_fixed(socket, std::move(error_response));
+            auto error_response = uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, -ret);
+            reply(connection, std::move(error_response));
             return;
         }
 
         auto stat = statx_to_stat(callback->get_storage());
         LOG_TRACE_L1(logger, "queue_statx callback success, uid={}, size={}", stat.st_uid, stat.st_size);
 
-        response->get_storage().attr = fuse_entry_param{
-            .ino = reinterpret_cast<fuse_ino_t>(&inode_cache.create_inode(std::move(*path), stat)),
-            .generation = 0,
-            .attr = stat,
-            .attr_timeout = 1,
-            .entry_timeout = 1};
-        response->get_storage().attr.attr.st_ino = response->get_storage().attr.ino;
-        LOG_TRACE_L2(
-            logger, "Sending FuseReplyEntry req={}, ino={}", static_cast<void*>(response->get_storage().req),
-            response->get_storage().attr.ino
+        auto ino = reinterpret_cast<fuse_ino_t>(&inode_cache.add(std::move(*path), stat));
+        stat.st_ino = ino;
+        LOG_TRACE_L2(logger, "Sending FuseReplyEntry id={}, ino={}", id, ino);
+        reply_entry(
+            id, unique,
+            fuse_entry_param{.ino = ino, .generation = 0, .attr = stat, .attr_timeout = 1, .entry_timeout = 1},
+            connection
         );
-        uring.write_fixed(socket, std::move(response));
     });
 
     LOG_INFO(logger, "PATH: {}", *path_ptr);
     uring.queue_statx(AT_FDCWD, *path_ptr, std::move(callback));
 }
 
-void Syscalls::getattr(messages::requests::GetAttr& message, int socket) {
-    const auto& entry = inode_cache.inode_from_ino(message.ino);
-    auto callback = uring.get_callback<messages::responses::FuseReplyAttr>([](int) {}, message.req, entry.second.stat);
-    LOG_TRACE_L2(
-        logger, "Sending FuseReplyAttr req={}, ino={}", static_cast<void*>(callback->get_storage().req),
-        entry.second.stat.st_ino
-    );
-    uring.write_fixed(socket, std::move(callback));
+void Syscalls::getattr(
+    messages::requests::GetAttr& message, const std::shared_ptr<Connection>& connection, std::uint64_t unique
+) {
+    const auto* inode = find_inode(message.ino, message.id, connection);
+    if (inode == nullptr) [[unlikely]] {
+        return;
+    }
+    const auto& entry = *inode;
+    auto stat = inode_cache.stat_of(entry);
+    LOG_TRACE_L2(logger, "Sending FuseReplyAttr id={}, ino={}", message.id, stat.st_ino);
+    reply_attr(message.id, unique, stat, connection);
 }
 
-void Syscalls::readdir(messages::requests::ReadDir& message, int socket) {
+void Syscalls::readdir(messages::requests::ReadDir& message, const std::shared_ptr<Connection>& connection) {
     // Probably not important to return a valid inode number
     // https://fuse-devel.narkive.com/L338RZTz/lookup-readdir-and-inode-numbers
     auto ino = message.ino;
@@ -109,19 +266,22 @@ void Syscalls::readdir(messages::requests::ReadDir& message, int socket) {
     auto callable = [](int) {};
     auto callback =
         uring.get_callback<messages::responses::FuseReplyBuf<IoUring::MaxPayloadForCallback<decltype(callable)>()>>(
-            std::move(callable), message.req, message.size
+            std::move(callable), message.id
         );
     LOG_TRACE_L1(
-        logger, "Received readdir for ino {} with size {} and offset {} for req {}", ino, message.size, off,
-        static_cast<void*>(message.req)
+        logger, "Received readdir for ino {} with size {} and offset {} for id {}", ino, message.size, off, message.id
     );
 
-    const auto& root_entry = inode_cache.inode_from_ino(ino);
+    const auto* inode = find_inode(ino, message.id, connection);
+    if (inode == nullptr) [[unlikely]] {
+        return;
+    }
+    const auto& root_entry = *inode;
 
     [&]() {
         if (off == 1) {  // off must start at 1
             LOG_TRACE_L3(logger, "Adding . to buffer");
-            if (!callback->get_storage().add_directory_entry(".", root_entry.second.stat, off)) {
+            if (!callback->get_storage().add_directory_entry(".", inode_cache.stat_of(root_entry), off, message.size)) {
                 return;
             }
 
@@ -133,7 +293,7 @@ void Syscalls::readdir(messages::requests::ReadDir& message, int socket) {
             const struct stat stbuf = {
                 .st_ino = 1, .st_mode = std::to_underlying(std::filesystem::status("..").permissions())};
 
-            if (!callback->get_storage().add_directory_entry("..", stbuf, off)) {
+            if (!callback->get_storage().add_directory_entry("..", stbuf, off, message.size)) {
                 return;
             }
 
@@ -151,7 +311,7 @@ void Syscalls::readdir(messages::requests::ReadDir& message, int socket) {
                 // Other fields are not currently used by fuse
             };
 
-            if (!callback->get_storage().add_directory_entry(entry.path(), stbuf, off)) {
+            if (!callback->get_storage().add_directory_entry(entry.path(), stbuf, off, message.size)) {
                 return;
             }
 
@@ -160,71 +320,635 @@ void Syscalls::readdir(messages::requests::ReadDir& message, int socket) {
     }();
 
     LOG_TRACE_L2(
-        logger, "Sending FuseReplyBuf req={}, size={}", static_cast<void*>(callback->get_storage().req),
-        callback->get_storage().payload_size
+        logger, "Sending FuseReplyBuf id={}, size={}", callback->get_storage().id, callback->get_storage().payload_size
     );
     auto view = callback->get_storage().outer_view();
-    uring.write_fixed(socket, view, std::move(callback));
+    connection->send(view, std::move(callback), false, Connection::metadata_stream);
 }
 
-void Syscalls::read(messages::requests::Read& message, int socket) {
+void Syscalls::read(messages::requests::Read& message, const std::shared_ptr<Connection>& connection) {
     LOG_TRACE_L1(
-        logger, "Received read for ino {}, with size {} and offset {}, req={}", message.ino, message.size,
-        message.offset, static_cast<void*>(message.req)
+        logger, "Received read for ino {}, with size {} and offset {}, id={}", message.ino, message.size,
+        message.offset, message.id
     );
-    auto file_handle = inode_cache.inode_from_ino(message.ino).second.handle();
+    auto* inode = find_inode(message.ino, message.id, connection);
+    if (inode == nullptr) [[unlikely]] {
+        return;
+    }
 
-    auto callable = [this, socket](int ret, auto old_callback) {
+    if (read_chunk_size > 0 && message.size > read_chunk_size) {
+        // Reads ahead of the client aren't made on behalf of an open file of its kernel.
+        auto state = std::shared_ptr<ChunkedRead>{};
+        try {
+            state = keep_open(
+                *inode, ChunkedRead{
+                            .id = message.id,
+                            .file_handle = -1,
+                            .offset = message.offset,
+                            .size = message.size,
+                            .connection = connection}
+            );
+        } catch (const std::system_error& error) {
+            reply(
+                connection,
+                uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, message.id, error.code().value())
+            );
+            return;
+        }
+        state->file_handle = inode->second.handle();
+        for (auto i = 0; i < chunks_in_flight && state->next < state->size; i++) {
+            read_chunk(state);
+        }
+        return;
+    }
+
+    auto file_handle = inode->second.handle();
+    auto compressed = compression && (message.flags & messages::requests::Read::accept_compressed);
+    auto callable = [this, connection, ino = message.ino, compressed](int ret, auto old_callback) {
         if (ret >= 0) [[likely]] {
+            if (compressed && ret > 0) {
+                auto data = std::span<const std::byte>{old_callback->get_storage().payload, static_cast<size_t>(ret)};
+                if (send_compressed(ino, old_callback->get_storage().id, data, connection)) {
+                    return;
+                }
+            }
+
             auto callback = uring.get_callback([](int) {}, std::move(old_callback));
             callback->get_storage().set_size(ret);
             LOG_TRACE_L1(
-                logger, "Sending FuseReplyBuf req={}, inner size={}, outer size={}",
-                static_cast<void*>(callback->get_storage().req), callback->get_storage().read_view().size(),
-                callback->get_storage().outer_view().size()
+                logger, "Sending FuseReplyBuf id={}, inner size={}, outer size={}", callback->get_storage().id,
+                callback->get_storage().read_view().size(), callback->get_storage().outer_view().size()
             );
             auto view = callback->get_storage().outer_view();
-            uring.write_fixed(socket, view, std::move(callback));
+            auto zero_copy = zero_copy_threshold > 0 && view.size() >= zero_copy_threshold;
+            connection->send(view, std::move(callback), zero_copy);
         } else {
             auto callback_error = uring.get_callback<messages::responses::FuseReplyErr>(
-                [](int) {}, old_callback->get_storage().req, -ret
+                [](int) {}, old_callback->get_storage().id, -ret
             );
             LOG_TRACE_L1(logger, "Sending FuseReplyErr");
-            uring.write_fixed(socket, std::move(callback_error));
+            reply(connection, std::move(callback_error));
         }
     };
 
-    auto callback = uring.get_callback<
-        messages::responses::FuseReplyBuf<IoUring::MaxPayloadForCallback<decltype([this, socket](int) {})>()>>(
-        std::move(callable), message.req, message.size
+    using Response = messages::responses::FuseReplyBuf<
+        IoUring::MaxPayloadForCallback<decltype([this, connection, ino = message.ino, compressed](int) {})>()>;
+    auto callback = uring.get_callback<Response>(std::move(callable), message.id);
+    auto buffer_view = callback->get_storage().write_view(message.size);
+    uring.read_fixed(file_handle, buffer_view, message.offset, std::move(callback));
+}
+
+bool Syscalls::send_compressed(
+    fuse_ino_t ino, messages::RequestId id, std::span<const std::byte> data,
+    const std::shared_ptr<Connection>& connection
+) {
+    auto& sampler = compression_samplers[ino];
+    if (!sampler.should_compress()) {
+        return false;
+    }
+
+    using Response =
+        messages::responses::FuseReplyCompressed<IoUring::MaxPayloadForCallback<decltype([](int) {})>()>;
+    auto callback = uring.get_callback<Response>([](int) {}, id, data.size());
+    // Compressing to more than the original is never worth it, let LZ4 give up early.
+    auto target = callback->get_storage().write_view();
+    auto size = compress(data, target.first(std::min(target.size(), data.size())));
+    if (!sampler.record(data.size(), size)) {
+        LOG_TRACE_L2(logger, "Not worth compressing ino={}, {} bytes to {}", ino, data.size(), size);
+        return false;
+    }
+
+    callback->get_storage().set_size(narrow_cast<int>(size));
+    LOG_TRACE_L1(
+        logger, "Sending FuseReplyCompressed id={}, size={}, compressed={}", id, data.size(), size
     );
+    auto view = callback->get_storage().outer_view();
+    connection->send(view, std::move(callback));
+    return true;
+}
+
+template <typename State>
+std::shared_ptr<State> Syscalls::keep_open(InodeCache::Inode& inode, State state) {
+    inode_cache.open(inode);
+    return std::shared_ptr<State>(new State(std::move(state)), [this, &inode](State* done) {
+        delete done;
+        try {
+            inode_cache.close(inode);
+        } catch (const std::system_error& error) {
+            LOG_WARNING(logger, "Failed to close {}: {}", inode.first, error.what());
+        }
+    });
+}
+
+void Syscalls::read_chunk(const std::shared_ptr<ChunkedRead>& state) {
+    auto chunk_offset = state->next;
+    auto chunk_size = std::min(read_chunk_size, state->size - chunk_offset);
+    state->next += chunk_size;
+
+    // Each chunk is sent as soon as it is read. Once sent, it makes room for the next one, so that a read never holds
+    // more than chunks_in_flight buffers. Failures are reported in the chunk, the client replies once it got all of
+    // them.
+    auto callable = [this, state](int ret, auto old_callback) {
+        auto callback = uring.get_callback(
+            [this, state](int sent) {
+                if (sent >= 0 && state->next < state->size) {
+                    read_chunk(state);
+                }
+            },
+            std::move(old_callback)
+        );
+        callback->get_storage().result = ret;
+        LOG_TRACE_L1(
+            logger, "Sending FuseReplyChunk id={}, offset={}, result={}", state->id, callback->get_storage().offset,
+            ret
+        );
+        auto view = callback->get_storage().outer_view();
+        auto zero_copy = zero_copy_threshold > 0 && view.size() >= zero_copy_threshold;
+        state->connection->send(view, std::move(callback), zero_copy);
+    };
+
+    using Response =
+        messages::responses::FuseReplyChunk<IoUring::MaxPayloadForCallback<decltype([this, state](int) {})>()>;
+    auto callback =
+        uring.get_callback<Response>(std::move(callable), state->id, state->size, chunk_offset, chunk_size);
     auto buffer_view = callback->get_storage().write_view();
-    uring.read_fixed(file_handle, buffer_view, message.offset, std::move(callback));
+    uring.read_fixed(
+        state->file_handle, buffer_view, state->offset + static_cast<off_t>(chunk_offset), std::move(callback)
+    );
 }
 
-void Syscalls::open(messages::requests::Open& message, int socket) {
-    auto ino = message.ino;
+void Syscalls::push_chunk(const std::shared_ptr<PushedFile>& state) {
+    // Like the chunks of a read, each part makes room for the next one once sent.
+    auto callable = [this, state](int ret, auto old_callback) {
+        auto callback = uring.get_callback(
+            [this, state](int sent) {
+                if (sent >= 0 && state->next < state->size) {
+                    push_chunk(state);
+                }
+            },
+            std::move(old_callback)
+        );
+        callback->get_storage().result = ret;
+        LOG_TRACE_L1(
+            logger, "Sending FusePush ino={}, offset={}, result={}", state->client_ino, callback->get_storage().offset,
+            ret
+        );
+        auto view = callback->get_storage().outer_view();
+        auto zero_copy = zero_copy_threshold > 0 && view.size() >= zero_copy_threshold;
+        state->connection->send(view, std::move(callback), zero_copy);
+    };
+
+    using Response = messages::responses::FusePush<IoUring::MaxPayloadForCallback<decltype([this, state](int) {})>()>;
+    auto offset = state->next;
+    auto size = std::min(Response::max_payload_size(), state->size - offset);
+    state->next += size;
+    auto callback = uring.get_callback<Response>(std::move(callable), state->client_ino, offset, size);
+    auto buffer_view = callback->get_storage().write_view();
+    uring.read_fixed(state->file_handle, buffer_view, offset, std::move(callback));
+}
+
+void Syscalls::open(
+    messages::requests::Open& message, const std::shared_ptr<Connection>& connection, std::uint64_t unique
+) {
+    auto* inode = find_inode(message.ino, message.id, connection);
+    if (inode == nullptr) [[unlikely]] {
+        return;
+    }
     auto file_info = message.file_info;
+    auto writable = (file_info.flags & (O_RDWR | O_WRONLY)) != 0;
+    if (writable && !check_writable(message.id, connection)) {
+        return;
+    }
 
     // TODO: Add FOPEN_PARALLEL_DIRECT_WRITES to flags. Probably better doing it client side.
-    if (!(file_info.flags & (O_RDWR | O_WRONLY))) {
-        // Only read-only for now
-        auto& inode = inode_cache.inode_from_ino(ino);
-        InodeCache::open(inode);  // TODO: Handle errors
-        auto callback = uring.get_callback<messages::responses::FuseReplyOpen>([](int) {}, message.req, file_info);
-        LOG_TRACE_L2(logger, "Sending FuseReplyOpen");
-        uring.write_fixed(socket, std::move(callback));
-    } else {
-        auto callback = uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, message.req, EACCES);
-        LOG_TRACE_L2(logger, "Sending FuseReplyErr");
-        uring.write_fixed(socket, std::move(callback));
+    try {
+        inode_cache.open(*inode, writable);
+    } catch (const std::system_error& error) {
+        LOG_DEBUG(logger, "Failed to open {}: {}", inode->first, error.what());
+        reply(
+            connection,
+            uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, message.id, error.code().value())
+        );
+        return;
+    }
+
+    // The kernel leaves O_TRUNC to opens, see FUSE_CAP_ATOMIC_O_TRUNC.
+    if (writable && (file_info.flags & O_TRUNC) != 0) {
+        auto callback = uring.get_callback([this, message, unique, connection](int ret) {
+            auto* inode = find_inode(message.ino, message.id, connection);
+            if (inode == nullptr) [[unlikely]] {
+                return;
+            }
+            if (ret < 0) [[unlikely]] {
+                LOG_DEBUG(logger, "Failed to truncate {}: {}", inode->first, std::strerror(-ret));
+                inode_cache.close(*inode, true);
+                reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, message.id, -ret));
+                return;
+            }
+            opened(message, *inode, unique, connection);
+        });
+        uring.ftruncate(inode->second.write_handle(), 0, std::move(callback));
+        return;
     }
+    opened(message, *inode, unique, connection);
+}
+
+void Syscalls::opened(
+    const messages::requests::Open& message, InodeCache::Inode& inode, std::uint64_t unique,
+    const std::shared_ptr<Connection>& connection
+) {
+    // Changes made by others since the last open are only seen with a fresh stat. The cached one is used if it fails.
+    // The inode stays until the client releases what it opens here.
+    refresh(inode, [this, message, &inode, unique, connection](int error, const struct stat& fresh) {
+        const auto stat = error == 0 ? fresh : inode_cache.stat_of(inode);
+        auto file_info = message.file_info;
+        auto writable = (file_info.flags & (O_RDWR | O_WRONLY)) != 0;
+        auto version = messages::ContentVersion::of(stat);
+        auto size = narrow_cast<std::size_t>(stat.st_size);
+        // Unless the client already has it. Tunneled opens can't tell which inode of the client this is.
+        auto push = push_cap > 0 && unique == 0 && message.client_ino != 0 && !writable && size > 0 &&
+                    size <= push_cap && S_ISREG(stat.st_mode) && message.cached != version;
+        // The kernel would drop the pushed pages otherwise, they replace the cached ones.
+        file_info.keep_cache = message.cached == version || push ? 1 : 0;
+        LOG_TRACE_L2(logger, "Sending FuseReplyOpen, keep_cache={}, push={}", file_info.keep_cache != 0, push);
+        reply_open(message.id, unique, file_info, version, push ? size : 0, connection);
+        if (push) {
+            // The client may release the file before the last part is sent. Opening it again doesn't throw, the open
+            // being replied to holds it.
+            auto state = keep_open(
+                inode, PushedFile{
+                           .client_ino = message.client_ino,
+                           .file_handle = inode.second.handle(),
+                           .size = size,
+                           .connection = connection}
+            );
+            for (auto i = 0; i < chunks_in_flight && state->next < state->size; i++) {
+                push_chunk(state);
+            }
+        }
+    });
 }
 
 void Syscalls::release(messages::requests::Release& message) {
-    auto ino = message.ino;
-    auto& inode = inode_cache.inode_from_ino(ino);
-    InodeCache::close(inode);
+    if (auto* inode = inode_cache.find_ino(message.ino)) [[likely]] {
+        inode_cache.close(*inode, message.writable);
+    }
+}
+
+void Syscalls::write(Connection::Message message, std::size_t size, const std::shared_ptr<Connection>& connection) {
+    auto& request = *reinterpret_cast<WriteRequest*>(message->get_storage().data());
+    LOG_TRACE_L1(
+        logger, "Received write for ino {}, with size {} and offset {}, id={}", request.ino, request.size,
+        request.offset, request.id
+    );
+    if (offsetof(WriteRequest, payload) + request.size > size) [[unlikely]] {
+        LOG_WARNING(logger, "Truncated write, id={}", request.id);
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, request.id, EINVAL));
+        return;
+    }
+    if (!check_writable(request.id, connection)) [[unlikely]] {
+        return;
+    }
+    auto* inode = find_inode(request.ino, request.id, connection);
+    if (inode == nullptr) [[unlikely]] {
+        return;
+    }
+    if (!inode->second.is_writable()) [[unlikely]] {
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, request.id, EBADF));
+        return;
+    }
+
+    auto data = request.data();
+    auto offset = request.offset;
+    auto write_handle = inode->second.write_handle();
+    // The data is written from the buffer it was received in, which the callback keeps until then.
+    auto callback = uring.get_callback(
+        [this, connection, ino = request.ino, id = request.id, offset](int ret) {
+            if (ret < 0) [[unlikely]] {
+                LOG_DEBUG(logger, "Write failed, id={}: {}", id, std::strerror(-ret));
+                reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, -ret));
+                return;
+            }
+
+            // Attributes are replied to from the inode cache, keep them up to date. The inode may be gone by now.
+            inode_cache.wrote(ino, offset + ret);
+            LOG_TRACE_L2(logger, "Sending FuseReplyWrite id={}, size={}", id, ret);
+            reply(
+                connection,
+                uring.get_callback<messages::responses::FuseReplyWrite>(
+                    [](int) {}, id, static_cast<std::uint32_t>(ret)
+                )
+            );
+        },
+        std::move(message)
+    );
+    uring.write_fixed(write_handle, data, narrow_cast<size_t>(offset), std::move(callback));
+}
+
+void Syscalls::create(messages::requests::Create& message, const std::shared_ptr<Connection>& connection) {
+    if (!check_writable(message.id, connection)) [[unlikely]] {
+        return;
+    }
+    auto* parent = find_inode(message.ino, message.id, connection);
+    if (parent == nullptr) [[unlikely]] {
+        return;
+    }
+    auto path = std::make_unique<std::string>(std::filesystem::path{parent->first} / message.path.data());
+    LOG_DEBUG(logger, "Creating path={}, mode={:o}", *path, message.mode);
+    auto* path_ptr = path.get();
+
+    // The descriptor opened here becomes the write handle of the inode, unless the file is only created for reading.
+    auto callback = uring.get_callback([this, id = message.id, flags = message.flags, connection,
+                                        path = std::move(path)](int ret) mutable {
+        auto error = ret < 0 ? -ret : 0;
+        auto* inode = static_cast<InodeCache::Inode*>(nullptr);
+        if (error == 0) {
+            struct stat stat {};
+            if (::fstat(ret, &stat) == -1) [[unlikely]] {
+                error = errno;
+                ::close(ret);
+            } else {
+                inode = &inode_cache.add(std::move(*path), stat);
+                // Opened for reading first, nothing is left to undo if that fails. The file stays, created, like
+                // after an open failing once it created its file.
+                try {
+                    inode_cache.open(*inode);
+                } catch (const std::system_error& open_error) {
+                    error = open_error.code().value();
+                }
+                if (error == 0 && (flags & (O_RDWR | O_WRONLY)) != 0) {
+                    inode_cache.set_write_handle(*inode, ret);
+                } else {
+                    ::close(ret);
+                }
+            }
+        }
+        if (error != 0) [[unlikely]] {
+            LOG_DEBUG(logger, "Failed to create for id {}: {}", id, std::strerror(error));
+            reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, error));
+            return;
+        }
+
+        const auto stat = inode_cache.stat_of(*inode);
+        LOG_TRACE_L2(logger, "Sending FuseReplyCreate id={}, ino={}", id, stat.st_ino);
+        reply(
+            connection,
+            uring.get_callback<messages::responses::FuseReplyCreate>(
+                [](int) {}, id,
+                fuse_entry_param{
+                    .ino = stat.st_ino, .generation = 0, .attr = stat, .attr_timeout = 1, .entry_timeout = 1},
+                fuse_file_info{.flags = static_cast<int>(flags)}
+            )
+        );
+    });
+    uring.openat(
+        AT_FDCWD, *path_ptr, O_CREAT | O_WRONLY | (narrow_cast<int>(message.flags) & (O_EXCL | O_TRUNC)),
+        message.mode, std::move(callback)
+    );
+}
+
+void Syscalls::mkdir(messages::requests::Mkdir& message, const std::shared_ptr<Connection>& connection) {
+    if (!check_writable(message.id, connection)) [[unlikely]] {
+        return;
+    }
+    auto* parent = find_inode(message.ino, message.id, connection);
+    if (parent == nullptr) [[unlikely]] {
+        return;
+    }
+    auto path = std::make_unique<std::string>(std::filesystem::path{parent->first} / message.path.data());
+    LOG_DEBUG(logger, "Making directory path={}, mode={:o}", *path, message.mode);
+    auto* path_ptr = path.get();
+
+    auto callback = uring.get_callback([this, id = message.id, connection, path = std::move(path)](int ret) mutable {
+        if (ret < 0) [[unlikely]] {
+            LOG_DEBUG(logger, "Failed to make directory for id {}: {}", id, std::strerror(-ret));
+            reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, -ret));
+            return;
+        }
+        stat_entry(std::move(path), id, 0, connection);
+    });
+    uring.mkdirat(AT_FDCWD, *path_ptr, message.mode, std::move(callback));
+}
+
+void Syscalls::unlink(messages::requests::Unlink& message, const std::shared_ptr<Connection>& connection) {
+    if (!check_writable(message.id, connection)) [[unlikely]] {
+        return;
+    }
+    auto* parent = find_inode(message.ino, message.id, connection);
+    if (parent == nullptr) [[unlikely]] {
+        return;
+    }
+    auto path = std::make_unique<std::string>(std::filesystem::path{parent->first} / message.path.data());
+    LOG_DEBUG(logger, "Removing path={}, directory={}", *path, message.directory);
+    auto* path_ptr = path.get();
+
+    auto callback = uring.get_callback([this, id = message.id, connection, path = std::move(path)](int ret) {
+        if (ret == 0) {
+            inode_cache.remove(*path);
+        }
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, -ret));
+    });
+    uring.unlinkat(AT_FDCWD, *path_ptr, message.directory ? AT_REMOVEDIR : 0, std::move(callback));
+}
+
+void Syscalls::rename(messages::requests::Rename& message, const std::shared_ptr<Connection>& connection) {
+    if (!check_writable(message.id, connection)) [[unlikely]] {
+        return;
+    }
+    // RENAME_EXCHANGE would need the inodes to be swapped too, and RENAME_WHITEOUT is for overlay filesystems.
+    if ((message.flags & ~RENAME_NOREPLACE) != 0) [[unlikely]] {
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, message.id, EINVAL));
+        return;
+    }
+    auto* parent = find_inode(message.ino, message.id, connection);
+    if (parent == nullptr) [[unlikely]] {
+        return;
+    }
+    auto* new_parent = find_inode(message.new_ino, message.id, connection);
+    if (new_parent == nullptr) [[unlikely]] {
+        return;
+    }
+    auto paths = std::make_unique<std::pair<std::string, std::string>>(
+        std::filesystem::path{parent->first} / message.name(),
+        std::filesystem::path{new_parent->first} / message.new_name()
+    );
+    LOG_DEBUG(logger, "Renaming path={} to {}", paths->first, paths->second);
+    auto* paths_ptr = paths.get();
+
+    auto callback = uring.get_callback([this, id = message.id, connection, paths = std::move(paths)](int ret) {
+        if (ret == 0) {
+            inode_cache.rename(paths->first, paths->second);
+        }
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, -ret));
+    });
+    uring.renameat(AT_FDCWD, paths_ptr->first, AT_FDCWD, paths_ptr->second, message.flags, std::move(callback));
+}
+
+void Syscalls::setattr(messages::requests::SetAttr& message, const std::shared_ptr<Connection>& connection) {
+    if (!check_writable(message.id, connection)) [[unlikely]] {
+        return;
+    }
+    auto* inode = find_inode(message.ino, message.id, connection);
+    if (inode == nullptr) [[unlikely]] {
+        return;
+    }
+
+    // chmod and chown have no io_uring equivalent. They only change the inode, they are made synchronously.
+    const auto& arguments = message.arguments;
+    const auto* path = inode->first.c_str();
+    auto valid = arguments.valid;
+    LOG_DEBUG(logger, "Changing attributes of {}, valid={:x}", inode->first, valid);
+    auto failed = [&]() {
+        if ((valid & FATTR_MODE) != 0 && ::chmod(path, arguments.mode) == -1) {
+            return true;
+        }
+        return (valid & (FATTR_UID | FATTR_GID)) != 0 &&
+               ::lchown(
+                   path, (valid & FATTR_UID) != 0 ? arguments.uid : static_cast<uid_t>(-1),
+                   (valid & FATTR_GID) != 0 ? arguments.gid : static_cast<gid_t>(-1)
+               ) == -1;
+    }();
+    if (failed) {
+        truncated(message, errno, connection);
+        return;
+    }
+    if ((valid & FATTR_SIZE) == 0) {
+        truncated(message, 0, connection);
+        return;
+    }
+
+    // Truncations may have to write back or free many pages. The write handle of a file opened for writes truncates it
+    // through the ring. Others are truncated by path, synchronously, as there is no io_uring equivalent to truncate.
+    auto size = narrow_cast<off_t>(arguments.size);
+    if (inode->second.is_writable()) {
+        auto callback = uring.get_callback([this, message, connection](int ret) {
+            truncated(message, ret < 0 ? -ret : 0, connection);
+        });
+        uring.ftruncate(inode->second.write_handle(), size, std::move(callback));
+        return;
+    }
+    truncated(message, ::truncate(path, size) == -1 ? errno : 0, connection);
+}
+
+void Syscalls::truncated(
+    const messages::requests::SetAttr& message, int error, const std::shared_ptr<Connection>& connection
+) {
+    auto* inode = find_inode(message.ino, message.id, connection);
+    if (inode == nullptr) [[unlikely]] {
+        return;
+    }
+
+    // After the truncation, which changes the times. utimensat has no io_uring equivalent either.
+    const auto& arguments = message.arguments;
+    auto valid = arguments.valid;
+    if (error == 0 && (valid & (FATTR_ATIME | FATTR_MTIME)) != 0) {
+        auto times = std::array{
+            time_to_set(valid, FATTR_ATIME, FATTR_ATIME_NOW, arguments.atime, arguments.atimensec),
+            time_to_set(valid, FATTR_MTIME, FATTR_MTIME_NOW, arguments.mtime, arguments.mtimensec)};
+        if (::utimensat(AT_FDCWD, inode->first.c_str(), times.data(), AT_SYMLINK_NOFOLLOW) == -1) {
+            error = errno;
+        }
+    }
+    auto replied = [this, id = message.id, connection](int error, const struct stat& stat) {
+        if (error != 0) {
+            LOG_DEBUG(logger, "Failed to change attributes for id {}: {}", id, std::strerror(error));
+            reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, error));
+            return;
+        }
+        reply_attr(id, 0, stat, connection);
+    };
+    if (error != 0) {
+        replied(error, {});
+        return;
+    }
+    refresh(*inode, std::move(replied));
+}
+
+void Syscalls::fsync(messages::requests::Fsync& message, const std::shared_ptr<Connection>& connection) {
+    auto* inode = find_inode(message.ino, message.id, connection);
+    if (inode == nullptr) [[unlikely]] {
+        return;
+    }
+    // Nothing to sync if the file was never written through this server.
+    if (!inode->second.is_writable()) {
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, message.id, 0));
+        return;
+    }
+
+    auto callback = uring.get_callback([this, connection, id = message.id](int ret) {
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, id, ret < 0 ? -ret : 0));
+    });
+    uring.fsync(inode->second.write_handle(), message.datasync, std::move(callback));
+}
+
+void Syscalls::fuse(messages::requests::Fuse& message, const std::shared_ptr<Connection>& connection) {
+    auto request = fuse::decode(message.request);
+    if (!request) [[unlikely]] {
+        LOG_WARNING(logger, "Malformed tunneled request, id={}", message.id);
+        reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, message.id, EINVAL));
+        return;
+    }
+
+    // Errors are sent as FuseReplyErr, like for the other requests. Reads and readdirs are replied to with
+    // FuseReplyBuf, which the client writes to the kernel in place as well.
+    const auto& header = *request->header;
+    LOG_TRACE_L1(logger, "Received tunneled request, opcode={}, id={}", header.opcode, message.id);
+    switch (header.opcode) {
+        case FUSE_LOOKUP: {
+            const auto* name = request->name();
+            auto lookup = messages::requests::Lookup{.id = message.id, .ino = header.nodeid};
+            if (name == nullptr || std::strlen(name) > PATH_MAX) [[unlikely]] {
+                break;
+            }
+            std::strcpy(lookup.path.data(), name);
+            this->lookup(lookup, connection, header.unique);
+            return;
+        }
+        case FUSE_GETATTR: {
+            auto getattr = messages::requests::GetAttr{.id = message.id, .ino = header.nodeid};
+            this->getattr(getattr, connection, header.unique);
+            return;
+        }
+        case FUSE_OPEN: {
+            const auto* arguments = request->get<fuse_open_in>();
+            if (arguments == nullptr) [[unlikely]] {
+                break;
+            }
+            auto open = messages::requests::Open{
+                .id = message.id, .ino = header.nodeid, .file_info = {.flags = static_cast<int>(arguments->flags)}};
+            this->open(open, connection, header.unique);
+            return;
+        }
+        case FUSE_READ:
+        case FUSE_READDIR: {
+            const auto* arguments = request->get<fuse_read_in>();
+            if (arguments == nullptr) [[unlikely]] {
+                break;
+            }
+            if (header.opcode == FUSE_READ) {
+                auto read = messages::requests::Read{
+                    .flags = message.flags,
+                    .id = message.id,
+                    .ino = header.nodeid,
+                    .size = arguments->size,
+                    .offset = narrow_cast<off_t>(arguments->offset)};
+                this->read(read, connection);
+            } else {
+                auto readdir = messages::requests::ReadDir{
+                    .id = message.id,
+                    .ino = header.nodeid,
+                    .size = arguments->size,
+                    .offset = narrow_cast<off_t>(arguments->offset)};
+                this->readdir(readdir, connection);
+            }
+            return;
+        }
+        default:
+            break;
+    }
+
+    LOG_WARNING(logger, "Unsupported tunneled request, opcode={}, id={}", header.opcode, message.id);
+    reply(connection, uring.get_callback<messages::responses::FuseReplyErr>([](int) {}, message.id, ENOSYS));
 }
 
 void Syscalls::ping(std::unique_ptr<std::array<std::byte, settings::MAX_MESSAGE_SIZE>>&&, int) {}
@@ -3,10 +3,17 @@
 
 #include <memory>
 #include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "Config.h"
+#include "remotefs/compression/Compression.h"
 #include "remotefs/inodecache/InodeCache.h"
 #include "remotefs/messages/Messages.h"
+#include "remotefs/sockets/Connection.h"
+#include "remotefs/uring/IoUring.h"
 
 namespace quill {
 class Logger;
@@ -18,19 +25,137 @@ class IoUring;
 class Syscalls {
 
    public:
-    explicit Syscalls(IoUring& ring, InodeCache& cache);
-    void open(messages::requests::Open& message, int socket);
-    void lookup(messages::requests::Lookup& message, int socket);
-    void getattr(messages::requests::GetAttr& message, int socket);
-    void readdir(messages::requests::ReadDir& message, int socket);
-    void read(messages::requests::Read& message, int socket);
+    using WriteRequest = messages::requests::Write<sizeof(Connection::Buffer)>;
+
+    // Read replies of at least zero_copy_threshold bytes are sent without copying them, 0 disables it.
+    // Reads bigger than read_chunk_size are replied to in parts of that size, 0 disables it.
+    // With compression, read replies are compressed for the clients that accept it, when it pays off.
+    // Without read_write, writes and metadata changes fail with EROFS.
+    // Files of at most push_cap bytes are pushed to the clients that take them once opened for reading, 0 disables it.
+    explicit Syscalls(
+        IoUring& ring, InodeCache& cache, std::size_t zero_copy_threshold = 0, std::size_t read_chunk_size = 0,
+        bool compression = false, bool read_write = false, std::size_t push_cap = 0
+    );
+    // unique is the one of the tunneled request of the kernel, replied to with a FuseReplyRaw, or 0.
+    void open(
+        messages::requests::Open& message, const std::shared_ptr<Connection>& connection, std::uint64_t unique = 0
+    );
+    void lookup(
+        messages::requests::Lookup& message, const std::shared_ptr<Connection>& connection, std::uint64_t unique = 0
+    );
+    void getattr(
+        messages::requests::GetAttr& message, const std::shared_ptr<Connection>& connection, std::uint64_t unique = 0
+    );
+    void readdir(messages::requests::ReadDir& message, const std::shared_ptr<Connection>& connection);
+    void read(messages::requests::Read& message, const std::shared_ptr<Connection>& connection);
     void release(messages::requests::Release& message);
+    // message holds a WriteRequest of size bytes, its data is written from there.
+    void write(Connection::Message message, std::size_t size, const std::shared_ptr<Connection>& connection);
+    void create(messages::requests::Create& message, const std::shared_ptr<Connection>& connection);
+    void setattr(messages::requests::SetAttr& message, const std::shared_ptr<Connection>& connection);
+    void fsync(messages::requests::Fsync& message, const std::shared_ptr<Connection>& connection);
+    void mkdir(messages::requests::Mkdir& message, const std::shared_ptr<Connection>& connection);
+    void unlink(messages::requests::Unlink& message, const std::shared_ptr<Connection>& connection);
+    void rename(messages::requests::Rename& message, const std::shared_ptr<Connection>& connection);
+    // A request of the kernel tunneled by the client, see messages::requests::Fuse.
+    void fuse(messages::requests::Fuse& message, const std::shared_ptr<Connection>& connection);
     void ping(std::unique_ptr<std::array<std::byte, settings::MAX_MESSAGE_SIZE>>&& buffer, int socket);
+    // Sends the small replies batched since the last call. Called once per event loop iteration.
+    void flush_replies();
 
    private:
+    // Chunks of a read being read from the disk or sent at the same time.
+    static constexpr auto chunks_in_flight = 2;
+
+    struct ChunkedRead {
+        messages::RequestId id;
+        int file_handle;
+        off_t offset;
+        std::size_t size;
+        std::size_t next = 0;  // Offset in the reply of the next chunk to read.
+        std::shared_ptr<Connection> connection;
+    };
+
+    // A file sent after its open, see messages::responses::FusePush.
+    struct PushedFile {
+        fuse_ino_t client_ino;
+        int file_handle;
+        std::size_t size;
+        std::size_t next = 0;  // Offset of the next part to read.
+        std::shared_ptr<Connection> connection;
+    };
+
+    // Replies to an open once its file is opened, and truncated for O_TRUNC.
+    void opened(
+        const messages::requests::Open& message, InodeCache::Inode& inode, std::uint64_t unique,
+        const std::shared_ptr<Connection>& connection
+    );
+    // Replies to a setattr once its file is truncated, error is the errno of the truncation.
+    void truncated(
+        const messages::requests::SetAttr& message, int error, const std::shared_ptr<Connection>& connection
+    );
+    // Stats inode again, for the changes made by others, and stores it in the cache. Then then is called with the errno
+    // of the stat, ESTALE if the inode was forgotten meanwhile, and the fresh stat on success.
+    template <typename Then>
+    void refresh(const InodeCache::Inode& inode, Then then);
+    // Null, after replying ESTALE, if ino is unknown, like the ones given by a previous instance of the server.
+    InodeCache::Inode* find_inode(
+        fuse_ino_t ino, messages::RequestId id, const std::shared_ptr<Connection>& connection
+    );
+    // The reads of state may outlive the request that started them, the client can release the file meanwhile. inode
+    // stays open until state is freed. Throws std::system_error if it can't be opened.
+    template <typename State>
+    std::shared_ptr<State> keep_open(InodeCache::Inode& inode, State state);
+    void read_chunk(const std::shared_ptr<ChunkedRead>& state);
+    void push_chunk(const std::shared_ptr<PushedFile>& state);
+    // Stats path, known to exist, adds it to the cache and replies with its entry.
+    void stat_entry(
+        std::unique_ptr<std::string> path, messages::RequestId id, std::uint64_t unique,
+        const std::shared_ptr<Connection>& connection
+    );
+    // Replies EROFS, and returns false, without read_write.
+    bool check_writable(messages::RequestId id, const std::shared_ptr<Connection>& connection);
+    // Returns false, without sending anything, if data is not worth compressing.
+    bool send_compressed(
+        fuse_ino_t ino, messages::RequestId id, std::span<const std::byte> data,
+        const std::shared_ptr<Connection>& connection
+    );
+
+    // Room for hundreds of replies, while staying below the default SCTP delivery point.
+    using ReplyBatch = messages::responses::Batch<65536 - 256>;
+    using PendingBatch =
+        std::pair<std::shared_ptr<Connection>, std::unique_ptr<CallbackWithStorageAbstract<ReplyBatch>>>;
+
+    // Small replies are copied to their connection's batch instead of being sent on their own.
+    template <typename Reply>
+    void reply(
+        const std::shared_ptr<Connection>& connection, std::unique_ptr<CallbackWithStorageAbstract<Reply>> callback
+    );
+    void send_batch(PendingBatch& batch);
+    void reply_entry(
+        messages::RequestId id, std::uint64_t unique, const fuse_entry_param& entry,
+        const std::shared_ptr<Connection>& connection
+    );
+    void reply_attr(
+        messages::RequestId id, std::uint64_t unique, const struct stat& attr,
+        const std::shared_ptr<Connection>& connection
+    );
+    // The kernel keeps its cached pages of the file if they are still of version, see messages::requests::Open.
+    void reply_open(
+        messages::RequestId id, std::uint64_t unique, const fuse_file_info& file_info,
+        const messages::ContentVersion& version, std::uint64_t pushed, const std::shared_ptr<Connection>& connection
+    );
+
     quill::Logger* logger;
     IoUring& uring;
     InodeCache& inode_cache;
+    std::size_t zero_copy_threshold;
+    std::size_t read_chunk_size;
+    bool compression;
+    bool read_write;
+    std::size_t push_cap;
+    std::unordered_map<fuse_ino_t, CompressionSampler> compression_samplers;
+    std::vector<PendingBatch> batches;
 };
 
 }  // namespace remotefs
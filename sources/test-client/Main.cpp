@@ -48,6 +48,9 @@ void configure_argument_parser(argparse::ArgumentParser& parser) {
         .scan<'d', long>()
         .default_value(std::numeric_limits<long>::max());
 
+    parser.add_argument("--transport")
+        .help("sctp or tcp. TCP messages are framed by a length header.")
+        .default_value(std::string{"sctp"});
     parser.add_argument("-c", "--chunk-size")
         .help("Deliver data to the application in chunk this big.")
         .default_value(0)
@@ -118,12 +121,19 @@ void configure_argument_parser(argparse::ArgumentParser& parser) {
         .help("How long to maximally wait for --min-batch.")
         .scan<'d', long>()
         .default_value(duration_cast<std::chrono::nanoseconds>(remotefs::IoUring::wait_timeout_default).count());
+    parser.add_argument("--latency-budget")
+        .help(
+            "Adapt --min-batch and the wait timeout to the load so that completions wait at most this long (ns). "
+            "0 disables it."
+        )
+        .scan<'d', long>()
+        .default_value(0l);
     parser.add_argument("--buffers-alignment")
         .help("Override default buffers alignment")
         .scan<'d', std::size_t>()
         .default_value(remotefs::buffers_alignment);
 
-    parser.add_argument("address").help("Address to connect to.");
+    parser.add_argument("address").help("Address to connect to, or ipc://path for a server on the same host.");
     parser.add_argument("port").help("Port to connect to.").scan<'d', int>().default_value(6512);
 }
 
@@ -162,10 +172,6 @@ int main(int argc, char* argv[]) {
             break;
     }
 
-    if (program.get<std::uint16_t>("--streams") != 1) {
-        throw std::logic_error("--streams is unimplemented.");
-    }
-
     if (program.is_used("--buffers-alignment")) {
         throw std::logic_error("--buffers-alignment is unimplemented.");
     }
@@ -174,7 +180,8 @@ int main(int argc, char* argv[]) {
         remotefs::Socket::Options{program.get<long>("--rx-buffer-size"),   program.get<long>("--tx-buffer-size"),
                                   program.get<int>("--chunk-size"),        program.get<int>("--fragment-size"),
                                   program.get<std::uint16_t>("--streams"), program.get<bool>("--ordered-delivery"),
-                                  !program.get<bool>("--nagle"),           program.get<bool>("--disable-fragment")};
+                                  !program.get<bool>("--nagle"),           program.get<bool>("--disable-fragment"),
+                                  remotefs::transport_from_string(program.get("--transport"))};
     auto client = TestClient{
         program.get("address"),
         program.get<int>("port"),
@@ -194,7 +201,8 @@ int main(int argc, char* argv[]) {
 
     client.start(
         program.get<int>("--min-batch"), std::chrono::nanoseconds{program.get<long>("--batch-wait-timeout")},
-        program.get<long>("--max-size"), program.get<bool>("--register-ring")
+        std::chrono::nanoseconds{program.get<long>("--latency-budget")}, program.get<long>("--max-size"),
+        program.get<bool>("--register-ring")
     );
 
     std::signal(SIGTERM, signal_handler);
@@ -2,6 +2,11 @@
 
 #include <quill/Quill.h>
 #include <remotefs/messages/Messages.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <optional>
 
 #include "EngFormat-Cpp/eng_format.hpp"
 
@@ -13,6 +18,7 @@ TestClient::TestClient(
     assert(threads_n > 0);
 
     auto total_sockets = std::max(1, sockets_n * threads_n);
+    auto sockets = std::vector<remotefs::Socket>{};
     sockets.reserve(total_sockets);
     for (auto i = 0; i < total_sockets; i++) {
         sockets.push_back(remotefs::Socket::connect(address, port, socket_options));
@@ -24,6 +30,28 @@ TestClient::TestClient(
         urings.emplace_back(ring_depth, register_buffers);
     }
 
+    // A connection is bound to a ring. Sockets shared between rings get a connection per ring, on a duplicate fd.
+    auto connections = std::map<std::pair<std::size_t, remotefs::IoUring*>, std::shared_ptr<remotefs::Connection>>{};
+    auto get_connection = [&](std::size_t socket_index, remotefs::IoUring& ring) {
+        auto& connection = connections[{socket_index, &ring}];
+        if (!connection) {
+            auto& socket = sockets.at(socket_index);
+            if (std::ranges::any_of(connections, [&](const auto& entry) {
+                    return entry.first.first == socket_index && entry.second;
+                })) {
+                if (socket.transport() != remotefs::Transport::sctp) {
+                    throw std::logic_error(
+                        "Only SCTP sockets can be shared between rings, use --sockets or --share-ring."
+                    );
+                }
+                connection = remotefs::Connection::create(ring, remotefs::Socket{::dup(socket)});
+            } else {
+                connection = remotefs::Connection::create(ring, std::move(socket));
+            }
+        }
+        return connection;
+    };
+
     threads.reserve(threads_n);
     for (auto i = 0; i < threads_n; i++) {
         auto& ring = urings.at(i % urings.size());
@@ -32,8 +60,10 @@ TestClient::TestClient(
         auto& latency_metric = thread.metrics.create_timer("latency");
 
         for (auto j = 0; j < std::max(1, sockets_n) * pipeline; j++) {
-            auto& socket = sockets.at((j * (std::max(1, sockets_n) * pipeline) + i) % sockets.size());
-            thread.stages.push_back({socket, ring, *thread.stages_running, bandwidth_metric, latency_metric, chunk_size}
+            auto socket_index = (j * (std::max(1, sockets_n) * pipeline) + i) % sockets.size();
+            thread.stages.push_back(
+                {get_connection(socket_index, ring), ring, *thread.stages_running, bandwidth_metric, latency_metric,
+                 chunk_size, static_cast<std::uint16_t>(j % std::max<int>(1, socket_options.max_streams))}
             );
         }
     }
@@ -46,7 +76,7 @@ TestClient::TestClient(
 void TestClient::ClientThread::PipelineStage::read_write(long max_size_thread) const {
     LOG_TRACE_L2(quill::get_logger(), "Scheduling");
 
-    auto read_callable = [this, max_size_thread](int32_t syscall_ret) mutable {
+    auto read_callable = [this, max_size_thread](int32_t syscall_ret, remotefs::Connection::Message) {
         if (measure_latency) {
             latency += std::chrono::high_resolution_clock::now() - start_time;
         }
@@ -62,30 +92,25 @@ void TestClient::ClientThread::PipelineStage::read_write(long max_size_thread) c
         }
     };
 
-    using Ping = remotefs::messages::both::Ping<remotefs::IoUring::MaxPayloadForCallback<decltype(read_callable)>()>;
-
-    {
-        auto write_callback =
-            chunk_size
-                ? uring.get_callback<Ping>(
-                      [](int ret) { LOG_TRACE_L1(quill::get_logger(), "Wrote data: {}", ret); }, chunk_size
-                  )
-                : uring.get_callback<Ping>([](int ret) { LOG_TRACE_L1(quill::get_logger(), "Wrote data: {}", ret); });
-        auto view = write_callback->get_storage().view();
-        uring.write_fixed(socket, view, std::move(write_callback));
-    }
+    // The echo must fit in the buffer it is received in.
+    using Ping = remotefs::messages::both::Ping<sizeof(remotefs::Connection::Buffer)>;
 
-    auto read_callback = chunk_size ? uring.get_callback<Ping>(std::move(read_callable), chunk_size)
-                                    : uring.get_callback<Ping>(std::move(read_callable));
-    auto view = read_callback->get_storage().view();
-    uring.read(socket, view, 0, std::move(read_callback));
+    auto write_callable = [](int ret) { LOG_TRACE_L1(quill::get_logger(), "Wrote data: {}", ret); };
+    auto write_callback = chunk_size ? uring.get_callback<Ping>(std::move(write_callable), chunk_size)
+                                     : uring.get_callback<Ping>(std::move(write_callable));
+    auto view = write_callback->get_storage().view();
+    connection->send(view, std::move(write_callback), false, stream);
+    connection->receive(std::move(read_callable));
 }
 
-void TestClient::start(int min_batch_size, std::chrono::nanoseconds wait_timeout, long max_size, bool register_ring) {
+void TestClient::start(
+    int min_batch_size, std::chrono::nanoseconds wait_timeout, std::chrono::nanoseconds latency_budget, long max_size,
+    bool register_ring
+) {
     for (auto& thread : threads) {
         *thread.stages_running = static_cast<int>(std::ssize(thread.stages));
         thread.thread = std::jthread{
-            [&thread, min_batch_size, wait_timeout, register_ring,
+            [&thread, min_batch_size, wait_timeout, latency_budget, register_ring,
              max_size_thread = max_size / static_cast<int>(threads.size())](std::stop_token stop_token) mutable {
                 thread.start = std::chrono::high_resolution_clock::now();
                 thread.uring.start();
@@ -93,12 +118,21 @@ void TestClient::start(int min_batch_size, std::chrono::nanoseconds wait_timeout
                     thread.uring.register_ring();
                 }
 
+                auto batching = std::optional<remotefs::AdaptiveBatching>{};
+                if (latency_budget.count() > 0) {
+                    batching.emplace(latency_budget, std::max(wait_timeout, latency_budget));
+                }
+
                 for (auto& stage : thread.stages) {
                     stage.read_write(max_size_thread);
                 }
 
                 while (!stop_token.stop_requested() && *thread.stages_running > 0) [[likely]] {
-                    thread.uring.queue_wait(min_batch_size, wait_timeout);
+                    if (batching) {
+                        thread.uring.queue_wait(*batching);
+                    } else {
+                        thread.uring.queue_wait(min_batch_size, wait_timeout);
+                    }
                 }
                 auto thread_time = std::chrono::duration_cast<std::chrono::duration<double>>(
                     std::chrono::high_resolution_clock::now() - thread.start
@@ -7,6 +7,7 @@
 
 #include "Config.h"
 #include "remotefs/metrics/Metrics.h"
+#include "remotefs/sockets/Connection.h"
 #include "remotefs/sockets/Socket.h"
 #include "remotefs/uring/IoUring.h"
 
@@ -25,12 +26,14 @@ class TestClient {
         struct PipelineStage {
             void read_write(long max_size_thread) const;
 
-            remotefs::Socket& socket;
+            std::shared_ptr<remotefs::Connection> connection;
             remotefs::IoUring& uring;
             std::atomic<int>& stages_running;
             remotefs::MetricRegistry<>::Counter& bandwidth;
             remotefs::MetricRegistry<>::Timer& latency;
             size_t chunk_size;
+            // Stages sharing a connection are spread over its SCTP streams.
+            std::uint16_t stream;
             std::chrono::high_resolution_clock::time_point start_time = std::chrono::high_resolution_clock::now();
             bool measure_latency = false;
         };
@@ -54,11 +57,13 @@ class TestClient {
     );
     ~TestClient();
     [[nodiscard]] bool done() const;
-    void start(int min_batch_size, std::chrono::nanoseconds wait_timeout, long max_size, bool register_ring);
+    void start(
+        int min_batch_size, std::chrono::nanoseconds wait_timeout, std::chrono::nanoseconds latency_budget,
+        long max_size, bool register_ring
+    );
     void register_sockets();
 
    private:
-    std::vector<remotefs::Socket> sockets;
     std::vector<remotefs::IoUring> urings;
     std::vector<ClientThread> threads;
 };
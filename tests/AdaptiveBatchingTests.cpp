@@ -0,0 +1,44 @@
+#include <doctest/doctest.h>
+
+#include "remotefs/uring/AdaptiveBatching.h"
+
+using namespace std::chrono_literals;
+using remotefs::AdaptiveBatching;
+
+TEST_CASE("AdaptiveBatching") {
+    auto batching = AdaptiveBatching{100us, 1s, 64};
+
+    SUBCASE("Starts unbatched") {
+        CHECK(batching.batch_size() == 1);
+        CHECK(batching.timeout() == 1s);
+    }
+
+    SUBCASE("Grows under load") {
+        // One completion per microsecond, 100 are expected within the budget, capped to 64.
+        for (auto i = 0; i < 100; i++) {
+            batching.update(batching.batch_size(), batching.batch_size() * 1us);
+        }
+        CHECK(batching.batch_size() == 64);
+        CHECK(batching.timeout() == 100us);
+    }
+
+    SUBCASE("Shrinks on timeout") {
+        for (auto i = 0; i < 100; i++) {
+            batching.update(batching.batch_size(), batching.batch_size() * 1us);
+        }
+        REQUIRE(batching.batch_size() > 1);
+
+        batching.update(0, 100us);
+        CHECK(batching.batch_size() == 1);
+        CHECK(batching.timeout() == 1s);
+    }
+
+    SUBCASE("Follows the arrival rate") {
+        // One completion every 10 microseconds, about 10 expected within the budget.
+        for (auto i = 0; i < 200; i++) {
+            batching.update(batching.batch_size(), batching.batch_size() * 10us);
+        }
+        CHECK(batching.batch_size() >= 9);
+        CHECK(batching.batch_size() <= 10);
+    }
+}
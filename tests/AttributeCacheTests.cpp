@@ -0,0 +1,48 @@
+#include <doctest/doctest.h>
+
+#include "remotefs/inodecache/AttributeCache.h"
+
+using remotefs::AttributeCache;
+using namespace std::chrono_literals;
+
+TEST_CASE("AttributeCache") {
+    auto cache = AttributeCache{1s, 10s};
+    auto now = AttributeCache::Clock::now();
+    cache.update(2, {.st_size = 1234}, now);
+
+    SUBCASE("Fresh attributes") {
+        auto cached = cache.find(2, now + 400ms);
+        REQUIRE(cached);
+        CHECK(cached->attr.st_size == 1234);
+        CHECK(cached->fresh_for == 600ms);
+        CHECK(!cached->refresh);
+        CHECK(!cache.find(3, now));
+    }
+
+    SUBCASE("Stale attributes are refreshed once") {
+        auto cached = cache.find(2, now + 2s);
+        REQUIRE(cached);
+        CHECK(cached->attr.st_size == 1234);
+        CHECK(cached->fresh_for == 0s);
+        CHECK(cached->refresh);
+        cached = cache.find(2, now + 3s);
+        REQUIRE(cached);
+        CHECK(!cached->refresh);
+
+        cache.update(2, {.st_size = 5678}, now + 4s);
+        cached = cache.find(2, now + 4s);
+        REQUIRE(cached);
+        CHECK(cached->attr.st_size == 5678);
+        CHECK(cached->fresh_for == 1s);
+    }
+
+    SUBCASE("Expired attributes") {
+        CHECK(!cache.find(2, now + 11s));
+        CHECK(!cache.find(2, now));
+    }
+
+    SUBCASE("Invalidated attributes") {
+        cache.invalidate(2);
+        CHECK(!cache.find(2, now));
+    }
+}
@@ -0,0 +1,69 @@
+#include <doctest/doctest.h>
+
+#include <random>
+#include <vector>
+
+#include "remotefs/compression/Compression.h"
+
+using remotefs::CompressionSampler;
+
+TEST_CASE("CompressionSampler") {
+    auto sampler = CompressionSampler{};
+
+    SUBCASE("Keeps compressing what compresses well") {
+        for (auto i = 0; i < 10; i++) {
+            REQUIRE(sampler.should_compress());
+            CHECK(sampler.record(1000, 100));
+        }
+    }
+
+    SUBCASE("Backs off exponentially from what doesn't") {
+        REQUIRE(sampler.should_compress());
+        CHECK(!sampler.record(1000, 0));  // Compressing failed, the data didn't fit.
+
+        auto skipped = std::vector<int>{};
+        for (auto sample = 0; sample < 10; sample++) {
+            auto count = 0;
+            while (!sampler.should_compress()) {
+                count++;
+            }
+            skipped.push_back(count);
+            CHECK(!sampler.record(1000, 990));
+        }
+        CHECK((skipped == std::vector{1, 2, 4, 8, 16, 32, 64, 128, 256, 256}));
+    }
+
+    SUBCASE("Recovers when the content becomes compressible") {
+        REQUIRE(sampler.should_compress());
+        sampler.record(1000, 1000);
+        CHECK(!sampler.should_compress());
+        REQUIRE(sampler.should_compress());
+        CHECK(sampler.record(1000, 10));
+        CHECK(sampler.should_compress());
+    }
+}
+
+TEST_CASE("Compression round trip") {
+    auto zeros = std::vector<std::byte>(65536);
+    auto compressed = std::vector<std::byte>(zeros.size());
+    if (!remotefs::compression_supported) {
+        CHECK(remotefs::compress(zeros, compressed) == 0);
+        return;
+    }
+
+    auto size = remotefs::compress(zeros, compressed);
+    REQUIRE(size > 0);
+    CHECK(size < zeros.size() / 10);
+
+    auto decompressed = std::vector<std::byte>(zeros.size());
+    CHECK(remotefs::decompress(std::span{compressed}.first(size), decompressed) == static_cast<long>(zeros.size()));
+    CHECK(decompressed == zeros);
+
+    auto random = std::vector<std::byte>(65536);
+    auto engine = std::mt19937{42};
+    for (auto& byte : random) {
+        byte = static_cast<std::byte>(engine());
+    }
+    // Random data doesn't fit in its own size once compressed.
+    CHECK(remotefs::compress(random, std::span{compressed}.first(random.size() - 1)) == 0);
+}
@@ -0,0 +1,110 @@
+#include <doctest/doctest.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <ranges>
+#include <vector>
+
+#include "remotefs/sockets/Connection.h"
+
+using remotefs::Connection;
+
+namespace {
+// Both ends of a TCP connection over the loopback interface.
+std::pair<remotefs::Socket, remotefs::Socket> tcp_pair() {
+    auto options = remotefs::Socket::Options{.transport = remotefs::Transport::tcp};
+    auto listener = remotefs::Socket::listen("127.0.0.1", 0, options);
+    auto address = sockaddr_in{};
+    socklen_t address_size = sizeof(address);
+    REQUIRE(getsockname(listener, reinterpret_cast<sockaddr*>(&address), &address_size) == 0);
+
+    auto client = remotefs::Socket::connect("127.0.0.1", ntohs(address.sin_port), options);
+    auto server = remotefs::Socket{::accept(listener, nullptr, nullptr)};
+    REQUIRE(server >= 0);
+    return {std::move(client), std::move(server)};
+}
+}  // namespace
+
+TEST_CASE("Connection") {
+    auto uring = remotefs::IoUring{};
+    uring.start();
+    auto [client_socket, server_socket] = tcp_pair();
+    auto sender = Connection::create(uring, std::move(client_socket));
+    auto receiver = Connection::create(uring, std::move(server_socket));
+    REQUIRE(sender->transport() == remotefs::Transport::tcp);
+
+    // Small messages are copied out of the reassembly buffer, large ones are read directly in their own buffer.
+    auto sizes = std::vector<int>{1, 100, Connection::copy_threshold + 1, 1 << 20, 7};
+    for (auto size : sizes) {
+        auto callback = uring.get_callback<Connection::Buffer>([size](int ret) { CHECK(ret == size); });
+        auto view = std::span{callback->get_storage()}.subspan(0, size);
+        std::ranges::fill(view, static_cast<std::byte>(size));
+        sender->send(view, std::move(callback));
+    }
+
+    auto received = std::vector<int>{};
+    for (auto i = 0u; i < sizes.size(); i++) {
+        receiver->receive([&received](int ret, Connection::Message message) {
+            REQUIRE(ret > 0);
+            auto view = std::span{message->get_storage()}.subspan(0, ret);
+            CHECK(std::ranges::all_of(view, [ret](auto byte) { return byte == static_cast<std::byte>(ret); }));
+            received.push_back(ret);
+        });
+    }
+
+    while (received.size() < sizes.size()) {
+        uring.queue_wait();
+    }
+    CHECK(received == sizes);
+
+    SUBCASE("End of file") {
+        sender.reset();
+        auto result = -1;
+        receiver->receive([&result](int ret, Connection::Message message) {
+            CHECK(!message);
+            result = ret;
+        });
+        while (result < 0) {
+            uring.queue_wait();
+        }
+        CHECK(result == 0);
+    }
+
+    SUBCASE("Splices the rest of large messages") {
+        auto pipe = std::array<int, 2>{};
+        REQUIRE(pipe2(pipe.data(), O_CLOEXEC) == 0);
+        fcntl(pipe[1], F_SETPIPE_SZ, 1 << 20);
+        receiver->set_splicer([&pipe](std::span<const std::byte> received, std::size_t size) {
+            CHECK(received.size() < size);
+            return pipe[1];
+        });
+
+        static constexpr auto size = Connection::copy_threshold * 2;
+        auto callback = uring.get_callback<Connection::Buffer>([](int) {});
+        std::ranges::fill(std::span{callback->get_storage()}.subspan(0, size), std::byte{42});
+        sender->send(std::span{callback->get_storage()}.subspan(0, size), std::move(callback));
+
+        auto prefix = -1;
+        receiver->receive([&prefix](int ret, Connection::Message message) {
+            REQUIRE(message);
+            prefix = ret;
+        });
+        while (prefix < 0) {
+            uring.queue_wait();
+        }
+
+        // Unless the whole message arrived with the first read, which is then not spliced.
+        fcntl(pipe[0], F_SETFL, O_NONBLOCK);
+        auto spliced = std::vector<std::byte>(size);
+        auto in_pipe = std::max(read(pipe[0], spliced.data(), spliced.size()), ssize_t{0});
+        CHECK(prefix + in_pipe == size);
+        CHECK(std::ranges::all_of(spliced | std::views::take(in_pipe), [](auto byte) {
+            return byte == std::byte{42};
+        }));
+        close(pipe[0]);
+        close(pipe[1]);
+    }
+}
@@ -0,0 +1,114 @@
+#include <doctest/doctest.h>
+
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "remotefs/fuse/FuseProtocol.h"
+
+namespace fuse = remotefs::fuse;
+
+TEST_CASE("FuseProtocol") {
+    SUBCASE("Decodes whole requests only") {
+        auto buffer = std::vector<std::byte>(sizeof(fuse_in_header) + sizeof("file.txt"));
+        auto header = fuse_in_header{.len = static_cast<std::uint32_t>(buffer.size()), .opcode = FUSE_LOOKUP};
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        std::memcpy(buffer.data() + sizeof(header), "file.txt", sizeof("file.txt"));
+
+        auto request = fuse::decode(buffer);
+        REQUIRE(request);
+        CHECK(request->header->opcode == FUSE_LOOKUP);
+        CHECK(request->arguments.size() == sizeof("file.txt"));
+        CHECK(std::strcmp(request->name(), "file.txt") == 0);
+        CHECK(request->get<fuse_read_in>() == nullptr);
+
+        CHECK(!fuse::decode(std::span{buffer}.first(buffer.size() - 1)));
+        CHECK(!fuse::decode(std::span{buffer}.first(sizeof(header) - 1)));
+    }
+
+    SUBCASE("Rejects names that are not terminated") {
+        auto buffer = std::vector<std::byte>(sizeof(fuse_in_header) + 4, std::byte{'a'});
+        auto header = fuse_in_header{.len = static_cast<std::uint32_t>(buffer.size()), .opcode = FUSE_LOOKUP};
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        auto request = fuse::decode(buffer);
+        REQUIRE(request);
+        CHECK(request->name() == nullptr);
+    }
+
+    SUBCASE("Finds the names after the arguments") {
+        auto names = std::string_view{"old\0new", sizeof("old\0new")};
+        auto buffer = std::vector<std::byte>(sizeof(fuse_in_header) + sizeof(fuse_rename_in) + names.size());
+        auto header = fuse_in_header{.len = static_cast<std::uint32_t>(buffer.size()), .opcode = FUSE_RENAME};
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        std::memcpy(buffer.data() + sizeof(header) + sizeof(fuse_rename_in), names.data(), names.size());
+
+        auto request = fuse::decode(buffer);
+        REQUIRE(request);
+        CHECK(std::strcmp(request->name(sizeof(fuse_rename_in)), "old") == 0);
+        CHECK(std::strcmp(request->name(sizeof(fuse_rename_in) + sizeof("old")), "new") == 0);
+        CHECK(request->name(buffer.size()) == nullptr);
+    }
+
+    SUBCASE("Decodes requests received from a ring") {
+        auto headers = fuse::UringRequestHeader{};
+        auto header = fuse_in_header{
+            .len = static_cast<std::uint32_t>(sizeof(fuse_in_header) + sizeof(fuse_read_in) + 4), .opcode = FUSE_READ};
+        auto arguments = fuse_read_in{.offset = 4096, .size = 512};
+        std::memcpy(headers.in_out.data(), &header, sizeof(header));
+        std::memcpy(headers.op_in.data(), &arguments, sizeof(arguments));
+        headers.entry.payload_size = 4;
+        auto payload = std::vector<std::byte>(64, std::byte{7});
+        auto scratch = std::vector<std::byte>{};
+
+        auto request = fuse::decode(headers, payload, scratch);
+        REQUIRE(request);
+        CHECK(request->header->len == header.len);
+        REQUIRE(request->get<fuse_read_in>() != nullptr);
+        CHECK(request->get<fuse_read_in>()->offset == 4096);
+        CHECK(request->get<fuse_read_in>()->size == 512);
+        CHECK(request->arguments.last(4)[0] == std::byte{7});
+
+        headers.entry.payload_size = 65;
+        CHECK(!fuse::decode(headers, payload, scratch));
+    }
+
+    SUBCASE("Encodes replies like libfuse") {
+        auto header = fuse::out_header(5, ENOENT, 0);
+        CHECK(header.len == sizeof(fuse_out_header));
+        CHECK(header.error == -ENOENT);
+        CHECK(header.unique == 5);
+
+        auto attr = fuse::attr_out({.st_ino = 3, .st_size = 10}, 1.5);
+        CHECK(attr.attr_valid == 1);
+        CHECK(attr.attr_valid_nsec == 500000000);
+        CHECK(attr.attr.ino == 3);
+        CHECK(attr.attr.size == 10);
+
+        auto open = fuse::open_out({.direct_io = 1, .keep_cache = 1, .fh = 9});
+        CHECK(open.fh == 9);
+        CHECK(open.open_flags == (FOPEN_DIRECT_IO | FOPEN_KEEP_CACHE));
+
+        // The kernel expects the open reply right after the entry.
+        auto create = fuse::create_out({.ino = 4, .attr = {.st_ino = 4}}, {.fh = 9});
+        CHECK(sizeof(create) == sizeof(fuse_entry_out) + sizeof(fuse_open_out));
+        CHECK(create.entry.nodeid == 4);
+        CHECK(create.open.fh == 9);
+    }
+
+    SUBCASE("Encodes notifications") {
+        auto notification = fuse::inval_inode(3, 4096);
+        CHECK(notification.header.len == sizeof(fuse_out_header) + sizeof(fuse_notify_inval_inode_out));
+        CHECK(notification.header.error == FUSE_NOTIFY_INVAL_INODE);
+        CHECK(notification.header.unique == 0);
+        CHECK(notification.arguments.ino == 3);
+        CHECK(notification.arguments.off == 4096);
+        CHECK(notification.arguments.len == 0);
+
+        auto store = fuse::store(3, 8192, 100);
+        CHECK(store.header.len == sizeof(fuse_out_header) + sizeof(fuse_notify_store_out) + 100);
+        CHECK(store.header.error == FUSE_NOTIFY_STORE);
+        CHECK(store.arguments.nodeid == 3);
+        CHECK(store.arguments.offset == 8192);
+        CHECK(store.arguments.size == 100);
+    }
+}
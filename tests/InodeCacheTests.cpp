@@ -3,6 +3,9 @@
 #include <filesystem>
 #include <fstream>
 #include <random>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 #include "remotefs/inodecache/InodeCache.h"
 
@@ -53,13 +56,13 @@ TEST_CASE("InodeCache") {
         auto inode = inode_cache.lookup(".");
         REQUIRE(inode != nullptr);
         REQUIRE(inode->first == ".");
-        REQUIRE(inode->second.st_ino == 1);
+        REQUIRE(inode->second.stat.st_ino == 1);
     }
 
     SUBCASE("lookup creates a single inode per path") {
         auto inode_1 = *inode_cache.lookup(".");
         auto inode_2 = *inode_cache.lookup(".");
-        REQUIRE(inode_1.second.st_ino == inode_2.second.st_ino);
+        REQUIRE(inode_1.second.stat.st_ino == inode_2.second.stat.st_ino);
     }
 
     SUBCASE("lookup returns a valid inode for a file") {
@@ -85,11 +88,158 @@ TEST_CASE("InodeCache") {
     // #pragma clang diagnostic pop
     //    }
 
+    SUBCASE("find_ino only finds inodes of this cache") {
+        auto file = create_file();
+        auto inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        REQUIRE(inode_cache.find_ino(inode->second.stat.st_ino) == inode);
+        REQUIRE(inode_cache.find_ino(1) != nullptr);
+
+        auto other_cache = remotefs::InodeCache{};
+        auto other_inode = other_cache.lookup(file.string());
+        REQUIRE(inode_cache.find_ino(other_inode->second.stat.st_ino) == nullptr);
+    }
+
+    SUBCASE("remove forgets the path and its inode") {
+        auto file = create_file();
+        auto* inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        auto ino = inode->second.stat.st_ino;
+        inode_cache.remove(file.string());
+        REQUIRE(inode_cache.find(file.string()) == nullptr);
+        REQUIRE(inode_cache.find_ino(ino) == nullptr);
+    }
+
+    SUBCASE("remove keeps the inodes still open") {
+        auto file = create_file();
+        auto* inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        inode_cache.open(*inode);
+        inode_cache.remove(file.string());
+        REQUIRE(inode_cache.find(file.string()) == nullptr);
+        REQUIRE(inode_cache.find_ino(inode->second.stat.st_ino) == inode);
+    }
+
+    SUBCASE("update replaces the stat of known inodes only") {
+        auto file = create_file();
+        auto* inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        auto ino = inode->second.stat.st_ino;
+        auto stat = inode->second.stat;
+        stat.st_ino = 0;
+        stat.st_size = 42;
+        auto updated = inode_cache.update(ino, stat);
+        REQUIRE(updated.has_value());
+        REQUIRE(updated->st_ino == ino);
+        REQUIRE(inode->second.stat.st_size == 42);
+        REQUIRE(inode->second.stat.st_ino == ino);
+        REQUIRE(!inode_cache.update(0, stat).has_value());
+        REQUIRE(inode_cache.stat_of(*inode).st_size == 42);
+    }
+
+    SUBCASE("wrote grows the file and updates its times") {
+        auto file = create_file();
+        auto* inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        auto before = inode->second.stat;
+        inode_cache.wrote(inode->second.stat.st_ino, 100);
+        REQUIRE(inode->second.stat.st_size == 100);
+        REQUIRE(inode->second.stat.st_mtim.tv_sec >= before.st_mtim.tv_sec);
+        inode_cache.wrote(inode->second.stat.st_ino, 10);
+        REQUIRE(inode->second.stat.st_size == 100);
+        // Forgotten inodes are left alone.
+        inode_cache.wrote(0, 10);
+    }
+
+    SUBCASE("The handle is closed along with its last opener") {
+        auto file = create_file();
+        auto* inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        inode_cache.open(*inode);
+        inode_cache.open(*inode);
+        inode_cache.close(*inode);
+        REQUIRE(inode->second.is_open());
+        inode_cache.close(*inode);
+        REQUIRE(!inode->second.is_open());
+    }
+
+    SUBCASE("A failed writable open doesn't count an opener") {
+        // Directories open for reading, not for writing.
+        std::filesystem::create_directory("directory");
+        auto* inode = inode_cache.lookup("directory");
+        REQUIRE(inode != nullptr);
+        REQUIRE_THROWS_AS(inode_cache.open(*inode, true), std::system_error);
+        REQUIRE(!inode->second.is_open());
+    }
+
+    SUBCASE("remove then release frees the inode") {
+        auto file = create_file();
+        auto* inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        auto ino = inode->second.stat.st_ino;
+        inode_cache.open(*inode, true);
+        inode_cache.remove(file.string());
+        REQUIRE(inode_cache.find_ino(ino) == inode);
+        inode_cache.close(*inode, true);
+        REQUIRE(inode_cache.find_ino(ino) == nullptr);
+    }
+
+    SUBCASE("The write handle is closed along with its last writer") {
+        auto file = create_file();
+        auto* inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        inode_cache.open(*inode, true);
+        inode_cache.open(*inode, true);
+        inode_cache.close(*inode, true);
+        REQUIRE(inode->second.is_writable());
+        inode_cache.close(*inode, true);
+        REQUIRE(!inode->second.is_writable());
+    }
+
+    SUBCASE("open from many threads opens a single handle") {
+        auto file = create_file();
+        auto* inode = inode_cache.lookup(file.string());
+        REQUIRE(inode != nullptr);
+        auto open_fds = [] {
+            return std::distance(
+                std::filesystem::directory_iterator{"/proc/self/fd"}, std::filesystem::directory_iterator{}
+            );
+        };
+        auto before = open_fds();
+
+        auto threads = std::vector<std::thread>{};
+        for (auto i = 0; i < 8; i++) {
+            threads.emplace_back([&] { inode_cache.open(*inode); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(inode->second.is_open());
+        REQUIRE(open_fds() == before + 1);
+    }
+
+    SUBCASE("rename keeps the inodes, including the ones below") {
+        std::filesystem::create_directory("directory");
+        auto* directory = inode_cache.lookup("directory");
+        auto* file = &inode_cache.add("directory/file", {});
+        auto* replaced = inode_cache.lookup(create_file().string());
+        REQUIRE(directory != nullptr);
+        REQUIRE(replaced != nullptr);
+        auto replaced_ino = replaced->second.stat.st_ino;
+
+        inode_cache.rename("directory", replaced->first);
+        REQUIRE(inode_cache.find("directory") == nullptr);
+        REQUIRE(inode_cache.find(directory->first) == directory);
+        REQUIRE(file->first == directory->first + "/file");
+        REQUIRE(inode_cache.find_ino(file->second.stat.st_ino) == file);
+        REQUIRE(inode_cache.find_ino(replaced_ino) == nullptr);
+    }
+
     SUBCASE("lookup caches an inode that can be found by inode_from_ino") {
         auto inode_lookup = inode_cache.lookup(".");
-        auto inode_from_ino = inode_cache.inode_from_ino(inode_lookup->second.st_ino);
+        auto inode_from_ino = inode_cache.inode_from_ino(inode_lookup->second.stat.st_ino);
         REQUIRE(inode_lookup != nullptr);
         REQUIRE(inode_lookup->first == inode_from_ino.first);
-        REQUIRE(inode_lookup->second.st_ino == inode_from_ino.second.st_ino);
+        REQUIRE(inode_lookup->second.stat.st_ino == inode_from_ino.second.stat.st_ino);
     }
 }
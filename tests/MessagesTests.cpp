@@ -0,0 +1,240 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "remotefs/messages/Messages.h"
+
+using remotefs::messages::requests::Fuse;
+using remotefs::messages::requests::Lookup;
+using remotefs::messages::requests::Rename;
+using remotefs::messages::requests::Write;
+using remotefs::messages::responses::Batch;
+using remotefs::messages::responses::FuseReplyAttr;
+using remotefs::messages::responses::FuseReplyCreate;
+using remotefs::messages::responses::FuseReplyEntry;
+using remotefs::messages::responses::FuseReplyRaw;
+
+TEST_CASE("Batch") {
+    using SmallBatch = Batch<4096>;
+    auto batch = std::make_unique<SmallBatch>();
+    REQUIRE(batch->empty());
+
+    auto added = 0;
+    for (auto size = 1;; size++) {
+        auto reply = std::vector<std::byte>(size, static_cast<std::byte>(size));
+        if (!batch->add(reply)) {
+            break;
+        }
+        added++;
+    }
+    REQUIRE(added > 0);
+    CHECK(!batch->empty());
+    CHECK(batch->count == static_cast<std::uint32_t>(added));
+    CHECK(batch->outer_view().size() <= sizeof(SmallBatch));
+
+    auto seen = 0;
+    // Read back with a different size, as the client does.
+    Batch<65536>::for_each(batch->outer_view(), [&seen](std::span<const std::byte> reply) {
+        seen++;
+        CHECK(reply.size() == static_cast<std::size_t>(seen));
+        CHECK(reply.front() == static_cast<std::byte>(seen));
+        CHECK(reinterpret_cast<std::uintptr_t>(reply.data()) % alignof(std::uint64_t) == 0);
+    });
+    CHECK(seen == added);
+}
+
+TEST_CASE("Batch rejects malformed batches") {
+    auto batch = std::make_unique<Batch<4096>>();
+    auto reply = std::vector<std::byte>(100, std::byte{1});
+    REQUIRE(batch->add(reply));
+    REQUIRE(batch->add(reply));
+    auto view = batch->outer_view();
+    auto ignore = [](std::span<const std::byte>) {};
+
+    SUBCASE("Truncated") {
+        REQUIRE_THROWS_AS(Batch<65536>::for_each(view.first(view.size() - 1), ignore), std::system_error);
+        REQUIRE_THROWS_AS(Batch<65536>::for_each(view.first(4), ignore), std::system_error);
+    }
+
+    SUBCASE("Record longer than the batch") {
+        auto length = std::uint64_t{1} << 40;
+        std::memcpy(batch->payload, &length, sizeof(length));
+        REQUIRE_THROWS_AS(Batch<65536>::for_each(view, ignore), std::system_error);
+    }
+}
+
+TEST_CASE("Varint") {
+    auto buffer = std::array<std::byte, remotefs::max_varint_size>{};
+    for (auto value : {0ul, 1ul, 127ul, 128ul, 300ul, 1ul << 35, std::numeric_limits<std::uint64_t>::max()}) {
+        auto written = remotefs::write_varint(buffer.data(), value);
+        CHECK(written <= buffer.size());
+        auto in = std::span<const std::byte>{buffer}.first(written);
+        CHECK(remotefs::read_varint(in) == value);
+        CHECK(in.empty());
+
+        auto truncated = std::span<const std::byte>{buffer}.first(written - 1);
+        CHECK(!remotefs::read_varint(truncated));
+    }
+
+    for (auto value : {0l, -1l, 1l, -64l, std::numeric_limits<std::int64_t>::min()}) {
+        CHECK(remotefs::zigzag_decode(remotefs::zigzag_encode(value)) == value);
+    }
+    CHECK(remotefs::zigzag_encode(-1) == 1);
+}
+
+TEST_CASE("Compact replies") {
+    struct stat stat {};
+    stat.st_ino = 0x7f12'3456'7890;
+    stat.st_mode = S_IFREG | 0644;
+    stat.st_nlink = 1;
+    stat.st_uid = 1000;
+    stat.st_gid = 1000;
+    stat.st_size = 123456;
+    stat.st_blocks = 256;
+    stat.st_blksize = 4096;
+    stat.st_atim = {1'700'000'000, 123};
+    stat.st_mtim = {-1, 999'999'999};
+    stat.st_ctim = {1'700'000'002, 0};
+
+    auto check_attributes = [&stat](const struct stat& decoded) {
+        CHECK(decoded.st_ino == stat.st_ino);
+        CHECK(decoded.st_mode == stat.st_mode);
+        CHECK(decoded.st_nlink == stat.st_nlink);
+        CHECK(decoded.st_uid == stat.st_uid);
+        CHECK(decoded.st_gid == stat.st_gid);
+        CHECK(decoded.st_size == stat.st_size);
+        CHECK(decoded.st_blocks == stat.st_blocks);
+        CHECK(decoded.st_blksize == stat.st_blksize);
+        CHECK(decoded.st_atim.tv_sec == stat.st_atim.tv_sec);
+        CHECK(decoded.st_atim.tv_nsec == stat.st_atim.tv_nsec);
+        CHECK(decoded.st_mtim.tv_sec == stat.st_mtim.tv_sec);
+        CHECK(decoded.st_mtim.tv_nsec == stat.st_mtim.tv_nsec);
+        CHECK(decoded.st_ctim.tv_sec == stat.st_ctim.tv_sec);
+    };
+
+    SUBCASE("Entry") {
+        auto reply = FuseReplyEntry{
+            1,
+            fuse_entry_param{.ino = stat.st_ino, .generation = 3, .attr = stat, .attr_timeout = 1, .entry_timeout = 2}};
+        CHECK(reply.view().size() < 64);
+
+        auto entry = reply.entry();
+        REQUIRE(entry);
+        CHECK(entry->ino == stat.st_ino);
+        CHECK(entry->generation == 3);
+        CHECK(entry->attr_timeout == 1);
+        CHECK(entry->entry_timeout == 2);
+        check_attributes(entry->attr);
+
+        reply.size--;
+        CHECK(!reply.entry());
+    }
+
+    SUBCASE("Create") {
+        auto reply = FuseReplyCreate{
+            1, fuse_entry_param{.ino = stat.st_ino, .attr = stat, .attr_timeout = 1, .entry_timeout = 1},
+            fuse_file_info{.flags = O_RDWR}};
+        CHECK(reply.view().size() < 128);
+        CHECK(reply.file_info.flags == O_RDWR);
+
+        auto entry = reply.entry();
+        REQUIRE(entry);
+        CHECK(entry->ino == stat.st_ino);
+        check_attributes(entry->attr);
+    }
+
+    SUBCASE("Attr") {
+        auto reply = FuseReplyAttr{1, stat};
+        CHECK(reply.view().size() < 64);
+
+        auto attr = reply.attr();
+        REQUIRE(attr);
+        check_attributes(*attr);
+    }
+}
+
+TEST_CASE("Lookup only sends its path") {
+    auto lookup = std::make_unique<Lookup>();
+    std::strcpy(lookup->path.data(), "file.txt");
+    CHECK(lookup->view().size() == offsetof(Lookup, path) + sizeof("file.txt"));
+}
+
+TEST_CASE("Pushes only send what was read") {
+    using Push = remotefs::messages::responses::FusePush<65536>;
+    auto push = std::make_unique<Push>(3, 4096, 1000);
+    CHECK(push->write_view().size() == 1000);
+    CHECK(push->outer_view().size() == offsetof(Push, payload));
+    push->result = 10;
+    CHECK(push->read_view().size() == 10);
+    CHECK(push->outer_view().size() == offsetof(Push, payload) + 10);
+    push->result = -EIO;
+    CHECK(push->read_view().empty());
+}
+
+TEST_CASE("Write only sends its data") {
+    auto data = std::vector<std::byte>(1000, std::byte{42});
+    auto message = std::make_unique<Write<65536>>(1, 2, 4096, data);
+    CHECK(message->view().size() == offsetof(Write<65536>, payload) + data.size());
+    CHECK(std::ranges::equal(message->data(), data));
+    CHECK(message->max_payload_size() < 65536);
+}
+
+TEST_CASE("Content versions change with the size or the modification time") {
+    struct stat stat {};
+    stat.st_size = 10;
+    stat.st_atim = {1, 0};
+    stat.st_mtim = {2, 3};
+    auto version = remotefs::messages::ContentVersion::of(stat);
+    CHECK(version != remotefs::messages::ContentVersion{});
+
+    stat.st_atim = {5, 0};
+    CHECK(remotefs::messages::ContentVersion::of(stat) == version);
+    stat.st_mtim.tv_nsec = 4;
+    CHECK(remotefs::messages::ContentVersion::of(stat) != version);
+    stat.st_mtim.tv_nsec = 3;
+    stat.st_size = 11;
+    CHECK(remotefs::messages::ContentVersion::of(stat) != version);
+}
+
+TEST_CASE("Rename only sends its names") {
+    auto rename = std::make_unique<Rename>();
+    REQUIRE(rename->set_names("old.txt", "new.txt"));
+    CHECK(std::string_view{rename->name()} == "old.txt");
+    CHECK(std::string_view{rename->new_name()} == "new.txt");
+    CHECK(rename->view().size() == offsetof(Rename, names) + sizeof("old.txt") + sizeof("new.txt"));
+    CHECK(!rename->set_names(std::string(PATH_MAX + 1, 'a'), std::string(PATH_MAX, 'b')));
+}
+
+TEST_CASE("Tunneled requests") {
+    SUBCASE("Only the request is sent") {
+        auto message = std::make_unique<Fuse>();
+        message->header() = fuse_in_header{.len = sizeof(fuse_in_header) + sizeof(fuse_read_in), .opcode = FUSE_READ};
+        CHECK(message->view().size() == offsetof(Fuse, request) + sizeof(fuse_in_header) + sizeof(fuse_read_in));
+    }
+
+    SUBCASE("Replies are ready for the kernel") {
+        auto out = fuse_attr_out{.attr_valid = 1, .attr = {.ino = 42}};
+        auto reply = FuseReplyRaw{3, 7, 0, std::as_bytes(std::span{&out, 1})};
+        CHECK(reply.header.len == sizeof(fuse_out_header) + sizeof(out));
+        CHECK(reply.header.unique == 7);
+        CHECK(reply.fuse_view().size() == reply.header.len);
+        CHECK(reply.view().size() == offsetof(FuseReplyRaw, header) + reply.header.len);
+        REQUIRE(reply.get<fuse_attr_out>() != nullptr);
+        CHECK(reply.get<fuse_attr_out>()->attr.ino == 42);
+        CHECK(reply.get<fuse_entry_out>() == nullptr);
+        // The header is right before the payload, where the client expects it when replying in place.
+        CHECK(offsetof(FuseReplyRaw, payload) - offsetof(FuseReplyRaw, header) == sizeof(fuse_out_header));
+    }
+
+    SUBCASE("Errors have no payload") {
+        auto reply = FuseReplyRaw{3, 7, ENOENT};
+        CHECK(reply.header.error == -ENOENT);
+        CHECK(reply.fuse_view().size() == sizeof(fuse_out_header));
+    }
+}
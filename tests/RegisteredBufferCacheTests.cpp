@@ -0,0 +1,40 @@
+#include <doctest/doctest.h>
+
+#include "remotefs/uring/IoUring.h"
+
+TEST_CASE("CachedRegisteredBuffersResource") {
+    auto pool = remotefs::CachedRegisteredBuffersResource<4096>{2};
+    REQUIRE(pool.available() == 2);
+
+    SUBCASE("Hands out registered buffers") {
+        auto* buffer = pool.allocate(1024);
+        CHECK(pool.is_registered(buffer));
+        CHECK(pool.available() == 1);
+        pool.deallocate(buffer, 1024);
+        CHECK(pool.available() == 2);
+    }
+
+    SUBCASE("Unregistered memory doesn't take a buffer") {
+        auto* memory = pool.allocate_unregistered(1 << 20);
+        CHECK(!pool.is_registered(memory));
+        CHECK(pool.available() == 2);
+        pool.deallocate(memory, 1 << 20);
+        CHECK(pool.available() == 2);
+    }
+
+    SUBCASE("Falls back to the heap once the registered buffers are gone") {
+        // The buffers are only aligned for 8 bytes, like the callbacks stored in them.
+        auto* first = pool.allocate(1024, 8);
+        auto* second = pool.allocate(1024, 8);
+        REQUIRE(pool.available() == 0);
+        auto* third = pool.allocate(1024, 8);
+        CHECK(!pool.is_registered(third));
+        CHECK(pool.get_index(third) == -1);
+        CHECK(pool.get_index(first) >= 0);
+        pool.deallocate(third, 1024, 8);
+        CHECK(pool.available() == 0);
+        pool.deallocate(first, 1024, 8);
+        pool.deallocate(second, 1024, 8);
+        CHECK(pool.available() == 2);
+    }
+}
@@ -0,0 +1,54 @@
+#include <doctest/doctest.h>
+
+#include "remotefs/inodecache/RemoteInodes.h"
+
+using remotefs::RemoteInodes;
+
+TEST_CASE("RemoteInodes") {
+    auto inodes = RemoteInodes{};
+    auto directory = inodes.add(RemoteInodes::root, "directory", 1000);
+    auto file = inodes.add(directory, "file", 2000);
+
+    SUBCASE("Maps to the inodes of the server") {
+        CHECK(directory != file);
+        CHECK(inodes.server_ino(RemoteInodes::root) == RemoteInodes::root);
+        CHECK(inodes.server_ino(directory) == 1000);
+        CHECK(inodes.server_ino(file) == 2000);
+        CHECK(inodes.server_ino(12345) == RemoteInodes::unresolved);
+    }
+
+    SUBCASE("Keeps the same inode for the same path") {
+        CHECK(inodes.find(directory, "file") == file);
+        CHECK(inodes.find(directory, "other") == RemoteInodes::unresolved);
+        CHECK(inodes.add(directory, "file", 3000) == file);
+        CHECK(inodes.server_ino(file) == 3000);
+    }
+
+    SUBCASE("Resolves again from the path") {
+        inodes.invalidate(file);
+        CHECK(inodes.server_ino(file) == RemoteInodes::unresolved);
+        CHECK(inodes.path(file) == "directory/file");
+        CHECK(inodes.path(RemoteInodes::root) == "");
+        CHECK(!inodes.path(12345));
+
+        inodes.resolved(file, 4000);
+        CHECK(inodes.server_ino(file) == 4000);
+    }
+
+    SUBCASE("Forgets the removed paths") {
+        inodes.remove(directory, "file");
+        CHECK(inodes.find(directory, "file") == RemoteInodes::unresolved);
+        CHECK(inodes.server_ino(file) == 2000);
+        CHECK(!inodes.path(file));
+        CHECK(inodes.add(directory, "file", 3000) != file);
+    }
+
+    SUBCASE("Moves the renamed paths") {
+        auto replaced = inodes.add(RemoteInodes::root, "other", 3000);
+        inodes.rename(RemoteInodes::root, "directory", RemoteInodes::root, "other");
+        CHECK(inodes.find(RemoteInodes::root, "directory") == RemoteInodes::unresolved);
+        CHECK(inodes.find(RemoteInodes::root, "other") == directory);
+        CHECK(inodes.path(file) == "other/file");
+        CHECK(!inodes.path(replaced));
+    }
+}
@@ -0,0 +1,70 @@
+#include <doctest/doctest.h>
+
+#include <set>
+
+#include "remotefs/tools/RequestTable.h"
+
+using Table = remotefs::RequestTable<int>;
+
+TEST_CASE("RequestTable") {
+    auto table = Table{};
+
+    SUBCASE("Finds what was inserted") {
+        auto issued = Table::Clock::now();
+        auto first = table.insert(1, issued);
+        auto second = table.insert(2);
+        CHECK(first != second);
+        CHECK(table.size() == 2);
+
+        REQUIRE(table.find(first) != nullptr);
+        CHECK(table.find(first)->request == 1);
+        CHECK(table.find(first)->issued == issued);
+
+        auto taken = table.take(second);
+        REQUIRE(taken);
+        CHECK(taken->request == 2);
+        CHECK(table.size() == 1);
+    }
+
+    SUBCASE("Rejects answered requests") {
+        auto id = table.insert(1);
+        REQUIRE(table.take(id));
+        CHECK(table.find(id) == nullptr);
+        CHECK(!table.take(id));
+    }
+
+    SUBCASE("Reuses slots with a new generation") {
+        auto old_id = table.insert(1);
+        table.take(old_id);
+        auto new_id = table.insert(2);
+        CHECK(new_id != old_id);
+        CHECK((new_id & (Table::max_in_flight - 1)) == (old_id & (Table::max_in_flight - 1)));
+        CHECK(!table.take(old_id));
+        CHECK(table.take(new_id)->request == 2);
+    }
+
+    SUBCASE("Ids are unique among those in flight") {
+        auto ids = std::set<Table::Id>{};
+        for (auto i = 0; i < 1000; i++) {
+            ids.insert(table.insert(i));
+        }
+        CHECK(ids.size() == 1000);
+    }
+
+    SUBCASE("Visits the requests in flight") {
+        auto first = table.insert(1);
+        auto second = table.insert(2);
+        table.take(first);
+        auto visited = std::set<Table::Id>{};
+        table.for_each([&visited](Table::Id id, Table::Entry& entry) {
+            visited.insert(id);
+            CHECK(entry.request == 2);
+        });
+        CHECK((visited == std::set{second}));
+    }
+
+    SUBCASE("Rejects unknown ids") {
+        CHECK(table.find(12345) == nullptr);
+        CHECK(!table.take(12345));
+    }
+}
@@ -0,0 +1,160 @@
+#include <doctest/doctest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "remotefs/sockets/SharedMemory.h"
+
+using remotefs::SharedMemoryChannel;
+using remotefs::SharedRing;
+
+namespace {
+std::vector<std::byte> make_message(std::size_t size, int seed) {
+    auto message = std::vector<std::byte>(size);
+    for (auto i = 0ul; i < size; i++) {
+        message[i] = static_cast<std::byte>(i + seed);
+    }
+    return message;
+}
+
+bool equal(std::span<const std::byte> a, std::span<const std::byte> b) {
+    return std::ranges::equal(a, b);
+}
+}  // namespace
+
+TEST_CASE("SharedRing") {
+    alignas(64) static auto region = std::array<std::byte, 4096>{};
+    auto producer = SharedRing::create(region);
+    auto consumer = SharedRing{region};
+
+    SUBCASE("Starts empty") {
+        CHECK(consumer.front().empty());
+    }
+
+    SUBCASE("Keeps messages in order") {
+        auto first = make_message(10, 1);
+        auto second = make_message(100, 2);
+        REQUIRE(producer.try_write(first));
+        REQUIRE(producer.try_write(second));
+
+        CHECK(equal(consumer.front(), first));
+        consumer.pop();
+        CHECK(equal(consumer.front(), second));
+        consumer.pop();
+        CHECK(consumer.front().empty());
+    }
+
+    SUBCASE("Refuses messages when full") {
+        auto message = make_message(1000, 3);
+        auto written = 0;
+        while (producer.try_write(message)) {
+            written++;
+        }
+        CHECK(written > 0);
+
+        consumer.pop();
+        CHECK(producer.try_write(message));
+    }
+
+    SUBCASE("Wraps around") {
+        // Sizes that don't divide the capacity, so that messages regularly land near the end.
+        for (auto i = 0; i < 1000; i++) {
+            auto message = make_message(1 + (i * 37) % producer.max_message_size(), i);
+            REQUIRE(producer.try_write(message));
+            REQUIRE(equal(consumer.front(), message));
+            consumer.pop();
+        }
+        CHECK(consumer.front().empty());
+    }
+
+    SUBCASE("Wakeup flags") {
+        CHECK(!producer.take_consumer_waiting());
+        consumer.set_consumer_waiting();
+        CHECK(producer.take_consumer_waiting());
+        CHECK(!producer.take_consumer_waiting());
+
+        producer.set_producer_waiting();
+        CHECK(consumer.take_producer_waiting());
+        CHECK(!consumer.take_producer_waiting());
+    }
+}
+
+TEST_CASE("SharedRing rejects corrupted rings") {
+    alignas(64) static auto region = std::array<std::byte, 4096>{};
+    auto producer = SharedRing::create(region);
+    auto consumer = SharedRing{region};
+    auto& header = *reinterpret_cast<SharedRing::Header*>(region.data());
+
+    SUBCASE("Records past the end") {
+        REQUIRE(producer.try_write(make_message(10, 1)));
+        auto size = std::uint32_t{1 << 20};
+        std::memcpy(&region[sizeof(SharedRing::Header)], &size, sizeof(size));
+        REQUIRE_THROWS_AS(consumer.front(), std::system_error);
+    }
+
+    SUBCASE("Heads past the end") {
+        header.head.store(header.tail.load() + region.size());
+        REQUIRE_THROWS_AS(consumer.front(), std::system_error);
+    }
+}
+
+TEST_CASE("SharedMemoryChannel") {
+    auto fds = std::array<int, 2>{};
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds.data()) == 0);
+
+    // Both sides send, then receive, the socket buffer is big enough for the handshake to not deadlock.
+    auto other = std::unique_ptr<SharedMemoryChannel>{};
+    auto thread = std::thread{[&] { other = std::make_unique<SharedMemoryChannel>(fds[1], 65536); }};
+    auto channel = SharedMemoryChannel{fds[0], 65536};
+    thread.join();
+
+    auto message = make_message(1000, 4);
+    REQUIRE(channel.outgoing().try_write(message));
+    CHECK(equal(other->incoming().front(), message));
+    CHECK(channel.incoming().front().empty());
+
+    REQUIRE(other->outgoing().try_write(message));
+    CHECK(equal(channel.incoming().front(), message));
+
+    other->incoming().set_consumer_waiting();
+    CHECK(channel.outgoing().take_consumer_waiting());
+    channel.notify_peer();
+    auto value = std::uint64_t{};
+    CHECK(::read(other->wakeup_fd(), &value, sizeof(value)) == sizeof(value));
+    CHECK(value == 1);
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST_CASE("SharedMemoryChannel deferred handshake") {
+    auto fds = std::array<int, 2>{};
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds.data()) == 0);
+
+    // The deferred side only sends, nothing blocks until its peer answered.
+    auto channel = SharedMemoryChannel{fds[0], std::nullopt, 65536};
+    auto other = SharedMemoryChannel{fds[1], 65536};
+
+    SUBCASE("Completes with the peer's half") {
+        auto handshake = SharedMemoryChannel::Handshake{};
+        auto received = ::recvmsg(fds[0], handshake.message(), MSG_CMSG_CLOEXEC);
+        channel.complete(handshake, received);
+
+        auto message = make_message(100, 2);
+        REQUIRE(other.outgoing().try_write(message));
+        CHECK(equal(channel.incoming().front(), message));
+    }
+
+    SUBCASE("Fails when the peer closed") {
+        auto handshake = SharedMemoryChannel::Handshake{};
+        REQUIRE_THROWS_AS(channel.complete(handshake, 0), std::system_error);
+    }
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}